@@ -0,0 +1,229 @@
+/* libpyxss: connections, queries and trackers.  See pyxss.h. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "pyxss.h"
+#include "pyxss_probes.h"
+
+XSS_DEFINE_SEMAPHORE(query_start);
+XSS_DEFINE_SEMAPHORE(query_end);
+XSS_DEFINE_SEMAPHORE(connect);
+XSS_DEFINE_SEMAPHORE(connection_lost);
+XSS_DEFINE_SEMAPHORE(extension);
+XSS_DEFINE_SEMAPHORE(tracker);
+
+struct pyxss_connection {
+    Display *dpy;
+    Window root;
+    int have_extension;
+};
+
+/* Opens conn's display, if it isn't open yet. */
+static int connection_open(pyxss_connection *conn, const char *display) {
+    int event_base, error_base;
+    long long start;
+
+    if (conn->dpy)
+        return 1;
+    start = XSS_PROBE_CLOCK(connect);
+    conn->dpy = XOpenDisplay(display ? display : "");
+    XSS_PROBE3(connect, XSS_ENGINE_XLIB, conn->dpy != NULL,
+               XSS_PROBE_SINCE(start));
+    if (!conn->dpy)
+        return 0;
+    conn->root = DefaultRootWindow(conn->dpy);
+    start = XSS_PROBE_CLOCK(extension);
+    conn->have_extension = XScreenSaverQueryExtension(conn->dpy,
+        &event_base, &error_base);
+    XSS_PROBE3(extension, XSS_ENGINE_XLIB, conn->have_extension,
+               XSS_PROBE_SINCE(start));
+    return 1;
+}
+
+pyxss_connection *pyxss_connect(const char *display) {
+    pyxss_connection *conn;
+
+    conn = (pyxss_connection *) calloc(1, sizeof(pyxss_connection));
+    if (!conn)
+        return NULL;
+    if (!connection_open(conn, display)) {
+        free(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+void pyxss_disconnect(pyxss_connection *conn) {
+    if (!conn)
+        return;
+    if (conn->dpy)
+        XCloseDisplay(conn->dpy);
+    free(conn);
+}
+
+int pyxss_has_extension(const pyxss_connection *conn) {
+    return conn->have_extension;
+}
+
+Display *pyxss_display(const pyxss_connection *conn) {
+    return conn->dpy;
+}
+
+int pyxss_query(pyxss_connection *conn, XScreenSaverInfo *info) {
+    long long start;
+    int ok;
+
+    if (!conn->dpy || !conn->have_extension)
+        return 0;
+    start = XSS_PROBE_CLOCK(query_end);
+    XSS_PROBE2(query_start, XSS_ENGINE_XLIB, -1);
+    ok = XScreenSaverQueryInfo(conn->dpy, conn->root, info) != 0;
+    XSS_PROBE4(query_end, XSS_ENGINE_XLIB, -1, ok, XSS_PROBE_SINCE(start));
+    return ok;
+}
+
+/* Every thread gets its own connection, so queries from different threads
+   neither share a Display nor wait for each other.  Nothing here is
+   process-wide except the key that finds the connection. */
+
+static pthread_key_t connection_key;
+static pthread_once_t connection_once = PTHREAD_ONCE_INIT;
+
+static void connection_free(void *data) {
+    pyxss_disconnect((pyxss_connection *) data);
+}
+
+static void connection_key_create(void) {
+    pthread_key_create(&connection_key, connection_free);
+}
+
+int pyxss_get_info(XScreenSaverInfo *info) {
+    pyxss_connection *conn;
+
+    pthread_once(&connection_once, connection_key_create);
+    conn = (pyxss_connection *) pthread_getspecific(connection_key);
+    if (!conn) {
+        conn = (pyxss_connection *) calloc(1, sizeof(pyxss_connection));
+        if (!conn || pthread_setspecific(connection_key, conn)) {
+            free(conn);
+            return 0;
+        }
+    }
+    if (!pyxss_governor_admit(info))
+        return PYXSS_SHARED;
+    /* retried on every call until there is an X server to talk to */
+    if (!connection_open(conn, NULL))
+        return 0;
+    if (!pyxss_query(conn, info))
+        return 0;
+    pyxss_governor_publish(info);
+    return PYXSS_QUERIED;
+}
+
+/* Trackers.  These are the state machines of xss.IdleTracker and
+   xss.XSSTracker; keep them in step. */
+
+const char *pyxss_change_name(int change) {
+    switch (change) {
+    case PYXSS_IDLE:
+        return "idle";
+    case PYXSS_UNIDLE:
+        return "unidle";
+    case PYXSS_DISABLED:
+        return "disabled";
+    default:
+        return NULL;
+    }
+}
+
+void pyxss_idle_tracker_init(pyxss_idle_tracker *tracker, long idle_threshold,
+                             long when_idle_wait, long when_disabled_wait) {
+    tracker->idle_threshold = idle_threshold;
+    tracker->when_idle_wait = when_idle_wait;
+    tracker->when_disabled_wait = when_disabled_wait;
+    tracker->last_state = 0;
+}
+
+int pyxss_idle_tracker_update(pyxss_idle_tracker *tracker,
+                              const XScreenSaverInfo *info, long *wait) {
+    int state;
+
+    if (!info) {
+        *wait = tracker->when_disabled_wait;
+        return PYXSS_DISABLED;
+    }
+    if ((long) info->idle > tracker->idle_threshold) {
+        state = PYXSS_IDLE;
+        *wait = tracker->when_idle_wait;
+    } else {
+        state = PYXSS_UNIDLE;
+        /* not before idle time can reach the threshold */
+        *wait = tracker->idle_threshold - (long) info->idle;
+    }
+    if (state == tracker->last_state)
+        return PYXSS_NO_CHANGE;
+    tracker->last_state = state;
+    XSS_PROBE4(tracker, "IdleTracker", pyxss_change_name(state),
+               (long) info->idle, *wait);
+    return state;
+}
+
+int pyxss_idle_tracker_check(pyxss_idle_tracker *tracker, long *wait,
+                             unsigned long *idle) {
+    XScreenSaverInfo info;
+    int ok = pyxss_get_info(&info);
+    int change = pyxss_idle_tracker_update(tracker, ok ? &info : NULL, wait);
+
+    if (idle)
+        *idle = change == PYXSS_DISABLED ? 0 : info.idle;
+    return change;
+}
+
+void pyxss_saver_tracker_init(pyxss_saver_tracker *tracker,
+                              long when_idle_wait, long when_disabled_wait) {
+    tracker->when_idle_wait = when_idle_wait;
+    tracker->when_disabled_wait = when_disabled_wait;
+    /* so that the first check reports the state it finds */
+    tracker->last_state = ScreenSaverDisabled;
+}
+
+int pyxss_saver_tracker_update(pyxss_saver_tracker *tracker,
+                               const XScreenSaverInfo *info, long *wait) {
+    int change;
+
+    if (!info) {
+        *wait = tracker->when_disabled_wait;
+        return PYXSS_DISABLED;
+    }
+    if (info->state == ScreenSaverDisabled) {
+        if (tracker->last_state != ScreenSaverDisabled)
+            XSS_PROBE4(tracker, "XSSTracker", "disabled", (long) info->idle,
+                       tracker->when_disabled_wait);
+        tracker->last_state = ScreenSaverDisabled;
+        *wait = tracker->when_disabled_wait;
+        return PYXSS_DISABLED;
+    }
+    if (info->state == ScreenSaverOff)
+        /* til_or_since is how long until the saver would come on */
+        *wait = (long) info->til_or_since;
+    else
+        *wait = tracker->when_idle_wait;
+    if (info->state == tracker->last_state)
+        return PYXSS_NO_CHANGE;
+    change = info->state == ScreenSaverOff ? PYXSS_UNIDLE : PYXSS_IDLE;
+    tracker->last_state = info->state;
+    XSS_PROBE4(tracker, "XSSTracker", pyxss_change_name(change),
+               (long) info->idle, *wait);
+    return change;
+}
+
+int pyxss_saver_tracker_check(pyxss_saver_tracker *tracker, long *wait,
+                              unsigned long *idle) {
+    XScreenSaverInfo info;
+    int ok = pyxss_get_info(&info);
+    int change = pyxss_saver_tracker_update(tracker, ok ? &info : NULL, wait);
+
+    if (idle)
+        *idle = change == PYXSS_DISABLED ? 0 : info.idle;
+    return change;
+}
@@ -0,0 +1,309 @@
+/* libpyxss: the part of PyXSS that has nothing to do with Python.  It
+   queries the MIT-SCREEN-SAVER extension and keeps the idle state
+   machines that xss.IdleTracker and xss.XSSTracker drive, for programs
+   that want them without an interpreter.  pyxss.hpp wraps it for C++17.
+
+   Link with `pkg-config --libs pyxss`.  All times are in milliseconds. */
+
+#ifndef PYXSS_H
+#define PYXSS_H
+
+#include <X11/Xlib.h>
+#include <X11/extensions/scrnsaver.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PYXSS_VERSION           "2.1.1"
+
+/* What a tracker check reports. */
+#define PYXSS_NO_CHANGE         0
+#define PYXSS_IDLE              1       /* the user went idle */
+#define PYXSS_UNIDLE            2       /* the user came back */
+#define PYXSS_DISABLED          3       /* no idle information */
+
+/* A connection to an X server.  A connection is used by one thread at a
+   time. */
+typedef struct pyxss_connection pyxss_connection;
+
+/* Opens a connection to display (the default display if NULL).  Returns
+   NULL if there is no X server to talk to. */
+pyxss_connection *pyxss_connect(const char *display);
+void pyxss_disconnect(pyxss_connection *conn);
+
+/* Whether the server has the MIT-SCREEN-SAVER extension. */
+int pyxss_has_extension(const pyxss_connection *conn);
+Display *pyxss_display(const pyxss_connection *conn);
+
+/* Fills in info for the default screen in one round trip.  Returns 0 if
+   the server can't tell. */
+int pyxss_query(pyxss_connection *conn, XScreenSaverInfo *info);
+
+/* pyxss_query() on the calling thread's own connection to the default
+   display, opened on first use (and retried on every call until there is
+   an X server) and closed when the thread exits.  With the governor on,
+   it may be the shared sample instead.  Returns 0 if the server can't
+   tell, PYXSS_QUERIED after a round trip and PYXSS_SHARED for the shared
+   sample. */
+#define PYXSS_QUERIED           1
+#define PYXSS_SHARED            2
+int pyxss_get_info(XScreenSaverInfo *info);
+
+/* The query governor: an opt-in cap on the queries a second that all the
+   processes which turn it on make to the default display's X server, for
+   when dozens of them start polling at once.  They share a token bucket
+   and the last sample any of them got, in a shared memory segment named
+   for the user and the display ($DISPLAY, less the screen).  While it is
+   on, pyxss_get_info() takes a token before it queries; with none left it
+   doesn't wait but hands back the shared sample, its idle time aged to
+   now, and only queries anyway if there is no recent sample (from the
+   last second, or two intervals at low rates).  The rate and
+   burst are the segment's: the last process to set them wins. */
+typedef struct {
+    double rate, burst;         /* 0 while off */
+    unsigned long queries;      /* this process's queries let through */
+    unsigned long cached;       /* ... and answered with the shared sample */
+    unsigned long shared_queries;       /* the same, for every process */
+    unsigned long shared_cached;
+} pyxss_governor_stats;
+
+/* Turns the governor on at rate queries a second, with bursts of up to
+   burst (at least 1), or off with rate <= 0.  Returns 0 if the segment
+   can't be opened. */
+int pyxss_governor_enable(double rate, double burst);
+/* For queries on a connection of the caller's own: returns 1 if one may
+   go ahead (pass it on with pyxss_governor_publish() if it succeeds) or 0
+   with info filled in from the shared sample.  Always 1 while off. */
+int pyxss_governor_admit(XScreenSaverInfo *info);
+void pyxss_governor_publish(const XScreenSaverInfo *info);
+void pyxss_governor_read_stats(pyxss_governor_stats *stats);
+
+/* Reports a change when idle time crosses idle_threshold. */
+typedef struct {
+    long when_idle_wait;        /* poll interval while idle */
+    long when_disabled_wait;    /* poll interval without information */
+    long idle_threshold;
+    int last_state;             /* PYXSS_IDLE, PYXSS_UNIDLE, or 0 at first */
+} pyxss_idle_tracker;
+
+/* Reports a change when the screensaver turns on or off. */
+typedef struct {
+    long when_idle_wait;        /* poll interval while the saver is on */
+    long when_disabled_wait;    /* ... and while it's disabled */
+    int last_state;             /* ScreenSaverOff, On, Cycle or Disabled */
+} pyxss_saver_tracker;
+
+void pyxss_idle_tracker_init(pyxss_idle_tracker *tracker, long idle_threshold,
+                             long when_idle_wait, long when_disabled_wait);
+void pyxss_saver_tracker_init(pyxss_saver_tracker *tracker,
+                              long when_idle_wait, long when_disabled_wait);
+
+/* Takes in a sample (NULL if the query failed), and returns the change it
+   makes and in *wait how long to sleep before the next one.  The first
+   sample always reports the state it finds. */
+int pyxss_idle_tracker_update(pyxss_idle_tracker *tracker,
+                              const XScreenSaverInfo *info, long *wait);
+int pyxss_saver_tracker_update(pyxss_saver_tracker *tracker,
+                               const XScreenSaverInfo *info, long *wait);
+
+/* The same, on a sample from pyxss_get_info().  idle may be NULL. */
+int pyxss_idle_tracker_check(pyxss_idle_tracker *tracker, long *wait,
+                             unsigned long *idle);
+int pyxss_saver_tracker_check(pyxss_saver_tracker *tracker, long *wait,
+                              unsigned long *idle);
+
+const char *pyxss_change_name(int change);
+
+/* Bulk analytics over recorded samples, kept as parallel arrays.  Samples
+   are in time order; a sample is idle when its idle time is above the
+   threshold, as for pyxss_idle_tracker. */
+typedef struct {
+    const int64_t *time;        /* when each sample was taken */
+    const int32_t *idle;
+    const uint8_t *state;       /* ScreenSaverOff, On, ...; may be NULL */
+    size_t n;
+} pyxss_series;
+
+typedef struct {
+    size_t samples;
+    size_t above;               /* idle samples */
+    size_t went_idle;           /* crossings from active to idle */
+    size_t came_back;           /* ... and back */
+    size_t saver_on;            /* samples with the screensaver on */
+} pyxss_series_counts;
+
+void pyxss_series_count(const pyxss_series *s, int32_t threshold,
+                        pyxss_series_counts *counts);
+
+/* Stores in at[] (up to max of them) the index of every sample on the
+   other side of threshold from the one before it, and returns how many
+   there are in all. */
+size_t pyxss_series_crossings(const pyxss_series *s, int32_t threshold,
+                              size_t *at, size_t max);
+
+typedef struct {
+    int64_t start;
+    size_t samples;
+    size_t active;              /* samples at or below the threshold */
+    size_t saver_on;
+    int64_t active_ms;          /* time from active samples to the next */
+    int64_t idle_sum;
+    int32_t idle_max;
+} pyxss_bucket;
+
+/* Fills count buckets of width ms, the first starting at origin, with the
+   samples that fall in them.  Returns how many samples were placed. */
+size_t pyxss_series_buckets(const pyxss_series *s, int64_t origin,
+                            int64_t width, int32_t threshold,
+                            pyxss_bucket *buckets, size_t count);
+
+/* The kernels in use, "avx2" or "scalar".  pyxss_series_use_simd(0)
+   switches to the scalar ones (for comparison) and (1) back, where the CPU
+   has AVX2; it returns whether the vector kernels are now in use. */
+const char *pyxss_series_kernels(void);
+int pyxss_series_use_simd(int enable);
+
+/* A fleet of idle trackers kept as parallel arrays, one entry per seat,
+   updated from a batch of readings in one pass (with the same kernels
+   as the series).  Seat i behaves as a pyxss_idle_tracker would on
+   idle[i]: its change and its wait come out the same, a negative reading
+   standing for a failed query (PYXSS_DISABLED, reported every time). */
+typedef struct {
+    size_t seats, size;
+    int32_t *threshold;
+    int32_t *idle_wait;         /* when_idle_wait */
+    int32_t *disabled_wait;     /* when_disabled_wait */
+    int32_t *idle;              /* the last reading */
+    int32_t *wait;              /* from the last update */
+    uint8_t *state;             /* PYXSS_IDLE, PYXSS_UNIDLE, or 0 at first */
+    uint32_t *changed;          /* seats the last update reported */
+    size_t nchanged;
+    int32_t min_wait;           /* the shortest wait, -1 with no seats */
+} pyxss_fleet;
+
+void pyxss_fleet_init(pyxss_fleet *fleet);
+void pyxss_fleet_free(pyxss_fleet *fleet);
+/* Adds a seat and returns its index, or -1 if there isn't the memory. */
+long pyxss_fleet_add(pyxss_fleet *fleet, int32_t idle_threshold,
+                     int32_t when_idle_wait, int32_t when_disabled_wait);
+/* Takes a reading for every seat and returns how many seats report a
+   change; their indices are in fleet->changed, in order, and what each
+   reports is pyxss_fleet_change(). */
+size_t pyxss_fleet_update(pyxss_fleet *fleet, const int32_t *idle);
+int pyxss_fleet_change(const pyxss_fleet *fleet, size_t seat);
+
+/* A t-digest: quantiles of a stream of values in fixed memory, with the
+   tails (p99 and up) kept most accurately.  Sketches merge losslessly
+   enough that a fleet's distribution is the merge of its seats', and
+   serialize to a line of text of a few kilobytes at most. */
+#define PYXSS_SKETCH_COMPRESSION 200
+#define PYXSS_SKETCH_CENTROIDS  (2 * PYXSS_SKETCH_COMPRESSION)
+#define PYXSS_SKETCH_BUFFER     64
+
+typedef struct {
+    double mean, weight;
+} pyxss_centroid;
+
+typedef struct {
+    double count, sum, min, max;
+    size_t centroids, buffered;
+    pyxss_centroid centroid[PYXSS_SKETCH_CENTROIDS];
+    pyxss_centroid buffer[PYXSS_SKETCH_BUFFER];    /* not yet merged in */
+} pyxss_sketch;
+
+void pyxss_sketch_init(pyxss_sketch *sketch);
+void pyxss_sketch_add(pyxss_sketch *sketch, double value, double weight);
+void pyxss_sketch_merge(pyxss_sketch *sketch, const pyxss_sketch *other);
+/* The value below which a fraction q of the weight lies; NaN if empty. */
+double pyxss_sketch_quantile(pyxss_sketch *sketch, double q);
+/* Writes a NUL-terminated line into buf and returns its length (which may
+   be size or more, as for snprintf). */
+size_t pyxss_sketch_format(pyxss_sketch *sketch, char *buf, size_t size);
+/* Merges in a line written by pyxss_sketch_format().  Returns 0, merging
+   nothing, if it isn't one. */
+int pyxss_sketch_parse(pyxss_sketch *sketch, const char *text);
+
+/* Sketches of how long idle runs (from the last input before going idle
+   to the input that ends it) and active runs (from there to the last
+   input before the next idle run) last, in ms, fed with what a tracker
+   reports:
+
+       change = pyxss_idle_tracker_update(&tracker, &info, &wait);
+       pyxss_runs_update(&runs, change, now, info.idle);
+
+   Runs cut short by PYXSS_DISABLED, and the first, whose start wasn't
+   seen, are left out. */
+typedef struct {
+    pyxss_sketch idle;
+    pyxss_sketch active;
+    double mark;                /* when the current run began */
+    int state;                  /* PYXSS_IDLE, PYXSS_UNIDLE, or 0 */
+} pyxss_runs;
+
+void pyxss_runs_init(pyxss_runs *runs);
+void pyxss_runs_update(pyxss_runs *runs, int change, double now,
+                       unsigned long idle);
+
+/* Activity rolled up at four resolutions, kept up to date sample by
+   sample in fixed memory, so that a dashboard's view of any zoom level is
+   a read of the buckets it shows.  Each level is a ring of buckets
+   aligned to multiples of their width (in whatever clock the samples are
+   timed by, wall-clock ms to line days up with UTC midnight); a bucket
+   is reused once the ring comes round to it again.
+
+   The time from one sample to the next counts as active if the first
+   sample's idle time is at or below the threshold and idle otherwise, as
+   for pyxss_series_buckets(), and as saver-on time if its screensaver
+   was on.  Gaps longer than max_gap (a suspend, a failed query) count as
+   neither. */
+#define PYXSS_ROLLUP_LEVELS     4
+#define PYXSS_ROLLUP_SECONDS    3600    /* 1 s buckets: the last hour */
+#define PYXSS_ROLLUP_MINUTES    1440    /* 1 min: the last day */
+#define PYXSS_ROLLUP_HOURS      744     /* 1 h: the last 31 days */
+#define PYXSS_ROLLUP_DAYS       400     /* 1 day: more than a year */
+
+typedef struct {
+    int64_t start;
+    int64_t active_ms;
+    int64_t idle_ms;
+    int64_t saver_ms;
+    uint32_t transitions;       /* between active and idle, either way */
+    uint32_t samples;
+} pyxss_rollup_bucket;
+
+typedef struct {
+    int32_t threshold;
+    int64_t max_gap;
+    int have_last;
+    int64_t last_time;
+    int last_active, last_saver;
+    pyxss_rollup_bucket seconds[PYXSS_ROLLUP_SECONDS];
+    pyxss_rollup_bucket minutes[PYXSS_ROLLUP_MINUTES];
+    pyxss_rollup_bucket hours[PYXSS_ROLLUP_HOURS];
+    pyxss_rollup_bucket days[PYXSS_ROLLUP_DAYS];
+} pyxss_rollup;
+
+void pyxss_rollup_init(pyxss_rollup *rollup, int32_t threshold,
+                       int64_t max_gap);
+void pyxss_rollup_add(pyxss_rollup *rollup, int64_t time, unsigned long idle,
+                      int saver_state);
+/* Forgets the last sample: the time to the next one is a gap. */
+void pyxss_rollup_gap(pyxss_rollup *rollup);
+/* The width of level's buckets in ms (level 0 is seconds, 3 days), or 0
+   for no such level. */
+int64_t pyxss_rollup_width(int level);
+/* Copies count buckets of a level into out, the first being the one that
+   holds start; buckets with nothing recorded, or recycled since, come out
+   empty with only their start set.  Returns how many were copied (0 for
+   no such level). */
+size_t pyxss_rollup_read(const pyxss_rollup *rollup, int level, int64_t start,
+                         pyxss_rollup_bucket *out, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
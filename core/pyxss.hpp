@@ -0,0 +1,190 @@
+// C++17 interface to libpyxss (see pyxss.h).  Header-only: link with
+// `pkg-config --libs pyxss` as for the C library.
+//
+//     pyxss::IdleTracker tracker(std::chrono::minutes(5));
+//     for (;;) {
+//         auto check = tracker.check();
+//         if (check.change == pyxss::Change::idle)
+//             ...
+//         std::this_thread::sleep_for(check.wait);
+//     }
+
+#ifndef PYXSS_HPP
+#define PYXSS_HPP
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "pyxss.h"
+
+namespace pyxss {
+
+using std::chrono::milliseconds;
+
+class Error : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+struct Info {
+    int state;                  // ScreenSaverOff, On, Cycle or Disabled
+    int kind;                   // ScreenSaverBlanked, Internal or External
+    milliseconds til_or_since;
+    milliseconds idle;
+
+    static Info from(const XScreenSaverInfo &info) {
+        return {info.state, info.kind,
+                milliseconds(info.til_or_since), milliseconds(info.idle)};
+    }
+};
+
+// The calling thread's connection, as for xss.get_info() in Python.
+inline std::optional<Info> get_info() noexcept {
+    XScreenSaverInfo info;
+    if (!pyxss_get_info(&info))
+        return std::nullopt;
+    return Info::from(info);
+}
+
+// A connection of one's own, to any display.  Movable, not copyable, and
+// used by one thread at a time.
+class Connection {
+  public:
+    explicit Connection(const char *display = nullptr)
+        : conn_(pyxss_connect(display)) {
+        if (!conn_)
+            throw Error(std::string("Couldn't open display ") +
+                        (display ? display : "(default)"));
+    }
+
+    bool has_extension() const noexcept {
+        return pyxss_has_extension(conn_.get());
+    }
+
+    Display *display() const noexcept { return pyxss_display(conn_.get()); }
+
+    std::optional<Info> query() noexcept {
+        XScreenSaverInfo info;
+        if (!pyxss_query(conn_.get(), &info))
+            return std::nullopt;
+        return Info::from(info);
+    }
+
+    // Throws Error where query() returns nothing.
+    Info get_info() {
+        if (auto info = query())
+            return *info;
+        throw Error("Couldn't query screensaver extension.");
+    }
+
+  private:
+    struct Disconnect {
+        void operator()(pyxss_connection *conn) const noexcept {
+            pyxss_disconnect(conn);
+        }
+    };
+    std::unique_ptr<pyxss_connection, Disconnect> conn_;
+};
+
+enum class Change {
+    none = PYXSS_NO_CHANGE,
+    idle = PYXSS_IDLE,
+    unidle = PYXSS_UNIDLE,
+    disabled = PYXSS_DISABLED,
+};
+
+inline const char *to_string(Change change) noexcept {
+    const char *name = pyxss_change_name(static_cast<int>(change));
+    return name ? name : "none";
+}
+
+// What a tracker's check reports: the change, how long to wait before the
+// next check, and the idle time it saw.
+struct Check {
+    Change change;
+    milliseconds wait;
+    milliseconds idle;
+};
+
+namespace detail {
+
+inline XScreenSaverInfo to_raw(const Info &info) noexcept {
+    XScreenSaverInfo raw{};
+    raw.state = info.state;
+    raw.kind = info.kind;
+    raw.til_or_since = static_cast<unsigned long>(info.til_or_since.count());
+    raw.idle = static_cast<unsigned long>(info.idle.count());
+    return raw;
+}
+
+inline Check make_check(int change, long wait, milliseconds idle) noexcept {
+    return {static_cast<Change>(change), milliseconds(wait),
+            change == PYXSS_DISABLED ? milliseconds(0) : idle};
+}
+
+}  // namespace detail
+
+// xss.IdleTracker: idle once idle time passes threshold.
+class IdleTracker {
+  public:
+    explicit IdleTracker(
+        milliseconds threshold = milliseconds(60000),
+        milliseconds when_idle_wait = milliseconds(5000),
+        milliseconds when_disabled_wait = milliseconds(120000)) {
+        pyxss_idle_tracker_init(&tracker_, threshold.count(),
+                                when_idle_wait.count(),
+                                when_disabled_wait.count());
+    }
+
+    // Queries the calling thread's connection.
+    Check check() noexcept { return update(get_info()); }
+
+    // Takes a sample from anywhere else (nullopt: the query failed).
+    Check update(const std::optional<Info> &info) noexcept {
+        XScreenSaverInfo raw;
+        long wait;
+        if (info)
+            raw = detail::to_raw(*info);
+        int change = pyxss_idle_tracker_update(&tracker_,
+                                               info ? &raw : nullptr, &wait);
+        return detail::make_check(change, wait,
+                                  info ? info->idle : milliseconds(0));
+    }
+
+  private:
+    pyxss_idle_tracker tracker_;
+};
+
+// xss.XSSTracker: idle while the screensaver is on.
+class SaverTracker {
+  public:
+    explicit SaverTracker(
+        milliseconds when_idle_wait = milliseconds(5000),
+        milliseconds when_disabled_wait = milliseconds(120000)) {
+        pyxss_saver_tracker_init(&tracker_, when_idle_wait.count(),
+                                 when_disabled_wait.count());
+    }
+
+    Check check() noexcept { return update(get_info()); }
+
+    Check update(const std::optional<Info> &info) noexcept {
+        XScreenSaverInfo raw;
+        long wait;
+        if (info)
+            raw = detail::to_raw(*info);
+        int change = pyxss_saver_tracker_update(&tracker_,
+                                                info ? &raw : nullptr, &wait);
+        return detail::make_check(change, wait,
+                                  info ? info->idle : milliseconds(0));
+    }
+
+  private:
+    pyxss_saver_tracker tracker_;
+};
+
+}  // namespace pyxss
+
+#endif
@@ -0,0 +1,114 @@
+/* The xss module's C API: its query path, the Sampler's last sample and
+   the trackers, for other extension modules that want them in a tight
+   loop without Python objects in the way.  The module exports a table of
+   functions as the capsule xss._C_API:
+
+       #include <pyxss_capi.h>
+
+       static const PyXSS_CAPI *xss_api;
+
+       // once, with the GIL held, say in the module's init function
+       if (!(xss_api = PyXSS_ImportCAPI()))
+           return NULL;
+
+       // then from any thread, with or without the GIL
+       XScreenSaverInfo info;
+       if (xss_api->get_info(&info))
+           ... info.idle ...
+
+   The functions are libpyxss's (see pyxss.h), the copies compiled into
+   the module: get_info() shares the calling thread's connection and the
+   query governor with xss.get_info().  Don't link libpyxss as well.  None
+   of them needs the GIL except sampler_from_object(); the ones that talk
+   to the X server block for a round trip, so release the GIL around them
+   if other threads need it.
+
+   The table only grows: new members go at the end, and size says how
+   much of it the module has.  version changes only when something
+   already in it does, and PyXSS_ImportCAPI() refuses a module whose
+   version differs or whose table is shorter than this header's. */
+
+#ifndef PYXSS_CAPI_H
+#define PYXSS_CAPI_H
+
+#include <Python.h>
+#include "pyxss.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PYXSS_CAPI_NAME         "xss._C_API"
+#define PYXSS_CAPI_VERSION      1
+
+/* As Sampler.latest() returns it. */
+typedef struct {
+    double time;                /* CLOCK_MONOTONIC ms */
+    unsigned long idle;         /* raw idle time */
+    int saver_state;            /* raw ScreenSaverOff, On, ... */
+    double value;               /* filtered */
+    int state;                  /* filtered */
+    int changed;                /* state differs from the last output */
+    int ok;                     /* 0 if the query failed */
+} PyXSS_Sample;
+
+typedef struct {
+    unsigned int version;       /* PYXSS_CAPI_VERSION */
+    size_t size;                /* sizeof(PyXSS_CAPI) in the module */
+
+    /* Connections and queries. */
+    pyxss_connection *(*connect)(const char *display);
+    void (*disconnect)(pyxss_connection *conn);
+    int (*query)(pyxss_connection *conn, XScreenSaverInfo *info);
+    int (*get_info)(XScreenSaverInfo *info);
+
+    /* Cached samples: the query governor's shared one, and a Sampler's
+       last.  sampler_from_object() returns the Sampler behind a Python
+       one, or NULL with TypeError set; it is good for as long as the
+       caller keeps a reference to the object.  sampler_latest() returns 0
+       if there is no sample yet. */
+    int (*governor_admit)(XScreenSaverInfo *info);
+    void (*governor_publish)(const XScreenSaverInfo *info);
+    void *(*sampler_from_object)(PyObject *obj);
+    int (*sampler_latest)(void *sampler, PyXSS_Sample *out);
+
+    /* Trackers. */
+    void (*idle_tracker_init)(pyxss_idle_tracker *tracker,
+                              long idle_threshold, long when_idle_wait,
+                              long when_disabled_wait);
+    int (*idle_tracker_update)(pyxss_idle_tracker *tracker,
+                               const XScreenSaverInfo *info, long *wait);
+    int (*idle_tracker_check)(pyxss_idle_tracker *tracker, long *wait,
+                              unsigned long *idle);
+    void (*saver_tracker_init)(pyxss_saver_tracker *tracker,
+                               long when_idle_wait, long when_disabled_wait);
+    int (*saver_tracker_update)(pyxss_saver_tracker *tracker,
+                                const XScreenSaverInfo *info, long *wait);
+    int (*saver_tracker_check)(pyxss_saver_tracker *tracker, long *wait,
+                               unsigned long *idle);
+} PyXSS_CAPI;
+
+/* Imports xss and returns its table, or NULL with an exception set. */
+static inline const PyXSS_CAPI *PyXSS_ImportCAPI(void) {
+    const PyXSS_CAPI *api;
+
+    api = (const PyXSS_CAPI *) PyCapsule_Import(PYXSS_CAPI_NAME, 0);
+    if (!api)
+        return NULL;
+    if (api->version != PYXSS_CAPI_VERSION ||
+        api->size < sizeof(PyXSS_CAPI)) {
+        PyErr_Format(PyExc_ImportError,
+                     "xss has C API version %u (%zu bytes), but this was "
+                     "built for version %u (%zu bytes)", api->version,
+                     api->size, (unsigned) PYXSS_CAPI_VERSION,
+                     sizeof(PyXSS_CAPI));
+        return NULL;
+    }
+    return api;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
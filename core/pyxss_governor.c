@@ -0,0 +1,305 @@
+/* libpyxss: the cross-process query governor.  See pyxss.h.
+
+   The segment is shared by processes that know nothing of each other and
+   may die at any point, so nothing in it is guarded by a lock.  The token
+   bucket is a single time (the generic cell rate algorithm): tat, when
+   the bucket would be full again, may run at most tolerance ahead of now;
+   a query that finds it so moves it on by one interval with a
+   compare-and-swap.  The shared sample is two seqlocked slots: a writer
+   claims the older one by making its sequence number odd, and a reader
+   keeps whatever copy it got with the same even number before and after.
+   A writer that dies mid-write only loses its slot. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "pyxss.h"
+
+#define GOVERNOR_MAGIC          0x70797873u     /* "pyxs" */
+#define GOVERNOR_VERSION        1
+#define GOVERNOR_WAIT_MS        100     /* for another process's setup */
+#define GOVERNOR_FRESH_NS       1000000000      /* or two intervals */
+
+/* Fixed widths, for 32- and 64-bit processes alike. */
+typedef struct {
+    uint32_t seq;               /* odd while written, 0 if never */
+    int32_t state, kind;
+    int64_t taken;              /* CLOCK_MONOTONIC ns */
+    uint64_t window, til_or_since, idle, event_mask;
+} governor_sample;
+
+typedef struct {
+    uint32_t magic;             /* set last, once the rest is */
+    uint32_t version;
+    int64_t interval;           /* ns between queries at the rate */
+    int64_t tolerance;          /* (burst - 1) * interval */
+    int64_t tat;
+    uint64_t queries, cached;
+    governor_sample sample[2];
+} governor_segment;
+
+/* A segment stays mapped once it is, since other threads may be in it
+   when the governor is turned off. */
+static governor_segment *mapped;
+static governor_segment *active;        /* NULL while off */
+static pthread_mutex_t enable_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long queries, cached;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, ms % 1000 * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+/* "/pyxss-<uid>-<host>:<display>", the screen left out: every screen of a
+   server shares its bucket. */
+static void segment_name(char *name, size_t size) {
+    const char *display = getenv("DISPLAY");
+    const char *colon, *end;
+    char host[128];
+    size_t i, n;
+
+    if (!display)
+        display = "";
+    colon = strrchr(display, ':');
+    n = colon ? (size_t) (colon - display) : 0;
+    if (n >= sizeof(host))
+        n = sizeof(host) - 1;
+    memcpy(host, display, n);
+    host[n] = '\0';
+    if (!strcmp(host, "unix"))
+        host[0] = '\0';
+    for (i = 0; i < n; i++)
+        if (host[i] == '/')
+            host[i] = '_';
+    colon = colon ? colon + 1 : display;
+    end = strchr(colon, '.');
+    snprintf(name, size, "/pyxss-%u-%s:%.*s", (unsigned) getuid(), host,
+             (int) (end ? end - colon : (long) strlen(colon)), colon);
+}
+
+static governor_segment *segment_open(void) {
+    governor_segment *seg;
+    char name[256];
+    struct stat st;
+    int fd, creator = 1, tries;
+
+    segment_name(name, sizeof(name));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        if (ftruncate(fd, sizeof(governor_segment)) < 0) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else if (errno == EEXIST) {
+        creator = 0;
+        fd = shm_open(name, O_RDWR, 0);
+        for (tries = 0; fd >= 0 && !fstat(fd, &st) &&
+             st.st_size < (off_t) sizeof(governor_segment); tries++) {
+            if (tries == GOVERNOR_WAIT_MS) {
+                close(fd);
+                return NULL;
+            }
+            sleep_ms(1);
+        }
+    }
+    if (fd < 0)
+        return NULL;
+    seg = (governor_segment *) mmap(NULL, sizeof(governor_segment),
+                                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+        return NULL;
+    if (creator) {
+        /* ftruncate() zeroed the rest */
+        seg->version = GOVERNOR_VERSION;
+        __atomic_store_n(&seg->magic, GOVERNOR_MAGIC, __ATOMIC_RELEASE);
+        return seg;
+    }
+    for (tries = 0; __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) !=
+         GOVERNOR_MAGIC; tries++) {
+        if (tries == GOVERNOR_WAIT_MS)
+            break;
+        sleep_ms(1);
+    }
+    if (seg->magic != GOVERNOR_MAGIC || seg->version != GOVERNOR_VERSION) {
+        munmap(seg, sizeof(governor_segment));
+        return NULL;
+    }
+    return seg;
+}
+
+int pyxss_governor_enable(double rate, double burst) {
+    governor_segment *seg;
+    int64_t interval;
+
+    pthread_mutex_lock(&enable_lock);
+    if (rate <= 0) {
+        __atomic_store_n(&active, NULL, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&enable_lock);
+        return 1;
+    }
+    if (!mapped)
+        mapped = segment_open();
+    if (!(seg = mapped)) {
+        pthread_mutex_unlock(&enable_lock);
+        return 0;
+    }
+    interval = (int64_t) (1e9 / rate);
+    if (interval < 1)
+        interval = 1;
+    if (burst < 1)
+        burst = 1;
+    __atomic_store_n(&seg->interval, interval, __ATOMIC_RELAXED);
+    __atomic_store_n(&seg->tolerance, (int64_t) ((burst - 1) * interval),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&active, seg, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&enable_lock);
+    return 1;
+}
+
+/* Copies out the newer of the slots, if either holds a whole sample. */
+static int sample_read(governor_segment *seg, governor_sample *out) {
+    governor_sample copy;
+    uint32_t seq;
+    int i, found = 0;
+
+    for (i = 0; i < 2; i++) {
+        governor_sample *s = &seg->sample[i];
+
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (!seq || (seq & 1))
+            continue;
+        copy.state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+        copy.kind = __atomic_load_n(&s->kind, __ATOMIC_RELAXED);
+        copy.taken = __atomic_load_n(&s->taken, __ATOMIC_RELAXED);
+        copy.window = __atomic_load_n(&s->window, __ATOMIC_RELAXED);
+        copy.til_or_since = __atomic_load_n(&s->til_or_since,
+                                            __ATOMIC_RELAXED);
+        copy.idle = __atomic_load_n(&s->idle, __ATOMIC_RELAXED);
+        copy.event_mask = __atomic_load_n(&s->event_mask, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+        if (!found || copy.taken > out->taken)
+            *out = copy;
+        found = 1;
+    }
+    return found;
+}
+
+int pyxss_governor_admit(XScreenSaverInfo *info) {
+    governor_segment *seg = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    governor_sample sample = { 0 };
+    int64_t now, tat, next, tolerance, interval;
+    unsigned long age;
+
+    if (!seg)
+        return 1;
+    now = now_ns();
+    interval = __atomic_load_n(&seg->interval, __ATOMIC_RELAXED);
+    tolerance = __atomic_load_n(&seg->tolerance, __ATOMIC_RELAXED);
+    tat = __atomic_load_n(&seg->tat, __ATOMIC_RELAXED);
+    do {
+        next = tat > now ? tat : now;
+        if (next - now > tolerance)
+            goto throttled;
+    } while (!__atomic_compare_exchange_n(&seg->tat, &tat, next + interval, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    goto query;
+
+throttled:
+    /* none yet, or none lately: the queries are failing, or the server
+       was restarted since */
+    if (!sample_read(seg, &sample) ||
+        now - sample.taken > (2 * interval > GOVERNOR_FRESH_NS ?
+                              2 * interval : GOVERNOR_FRESH_NS))
+        goto query;
+    age = sample.taken < now ? (unsigned long) ((now - sample.taken) / 1000000)
+                             : 0;
+    info->window = (Window) sample.window;
+    info->state = sample.state;
+    info->kind = sample.kind;
+    info->idle = (unsigned long) sample.idle + age;
+    info->til_or_since = (unsigned long) sample.til_or_since;
+    /* time since the saver came on, or until it comes on */
+    if (sample.state == ScreenSaverOn)
+        info->til_or_since += age;
+    else if (sample.state == ScreenSaverOff)
+        info->til_or_since = info->til_or_since > age ?
+                             info->til_or_since - age : 0;
+    info->eventMask = (unsigned long) sample.event_mask;
+    __atomic_fetch_add(&seg->cached, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cached, 1, __ATOMIC_RELAXED);
+    return 0;
+
+query:
+    __atomic_fetch_add(&seg->queries, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&queries, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void pyxss_governor_publish(const XScreenSaverInfo *info) {
+    governor_segment *seg = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    governor_sample *s;
+    uint32_t seq;
+    int i, older;
+
+    if (!seg)
+        return;
+    older = __atomic_load_n(&seg->sample[1].taken, __ATOMIC_RELAXED) <
+            __atomic_load_n(&seg->sample[0].taken, __ATOMIC_RELAXED);
+    for (i = 0; i < 2; i++) {
+        s = &seg->sample[i ? !older : older];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+        if (!(seq & 1) &&
+            __atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == 2)
+        return;                 /* both being written: theirs will do */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&s->state, info->state, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->kind, info->kind, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->taken, now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&s->window, (uint64_t) info->window, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->til_or_since, (uint64_t) info->til_or_since,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&s->idle, (uint64_t) info->idle, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->event_mask, (uint64_t) info->eventMask,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void pyxss_governor_read_stats(pyxss_governor_stats *stats) {
+    governor_segment *seg = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    int64_t interval;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->queries = __atomic_load_n(&queries, __ATOMIC_RELAXED);
+    stats->cached = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+    if (!seg)
+        return;
+    interval = __atomic_load_n(&seg->interval, __ATOMIC_RELAXED);
+    stats->rate = 1e9 / interval;
+    stats->burst = (double) __atomic_load_n(&seg->tolerance,
+                                            __ATOMIC_RELAXED) / interval + 1;
+    stats->shared_queries = __atomic_load_n(&seg->queries, __ATOMIC_RELAXED);
+    stats->shared_cached = __atomic_load_n(&seg->cached, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,71 @@
+/* Static probes (provider "pyxss") for perf, bpftrace and SystemTap, built
+   in when HAVE_SYS_SDT_H is defined (setup.py and the Makefile define it
+   when they find sys/sdt.h).  An unattached probe is a single nop;
+   arguments that cost something, like the clock reads behind latencies,
+   are only computed while a tracer holds the probe's semaphore.
+
+     query_start(engine, screen)            engine: 0 Xlib, 1 XCB
+     query_end(engine, screen, ok, latency_ns)
+     connect(engine, ok, latency_ns)        also every reconnect attempt
+     connection_lost(engine, screen)
+     extension(engine, present, latency_ns)
+     tracker(tracker, change, idle, wait)   only on state changes
+
+   screen is -1 for queries on a thread's or a caller's own connection.
+   The semaphores are defined once, in pyxss.c; this header is private to
+   the library and the Python module. */
+
+#ifndef PYXSS_PROBES_H
+#define PYXSS_PROBES_H
+
+#include <time.h>
+
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define XSS_SEMAPHORE(name) \
+    extern unsigned short pyxss_##name##_semaphore
+#define XSS_DEFINE_SEMAPHORE(name) \
+    __extension__ unsigned short pyxss_##name##_semaphore \
+    __attribute__((unused)) __attribute__((section(".probes")))
+#define XSS_PROBE_ENABLED(name) \
+    __builtin_expect(pyxss_##name##_semaphore != 0, 0)
+#define XSS_PROBE2(name, a, b) STAP_PROBE2(pyxss, name, a, b)
+#define XSS_PROBE3(name, a, b, c) STAP_PROBE3(pyxss, name, a, b, c)
+#define XSS_PROBE4(name, a, b, c, d) STAP_PROBE4(pyxss, name, a, b, c, d)
+#else
+#define XSS_SEMAPHORE(name) extern int pyxss_no_probes
+#define XSS_DEFINE_SEMAPHORE(name) extern int pyxss_no_probes
+#define XSS_PROBE_ENABLED(name) 0
+/* sizeof keeps the arguments "used" without evaluating them */
+#define XSS_PROBE2(name, a, b) \
+    do { (void) sizeof(a); (void) sizeof(b); } while (0)
+#define XSS_PROBE3(name, a, b, c) \
+    do { XSS_PROBE2(name, a, b); (void) sizeof(c); } while (0)
+#define XSS_PROBE4(name, a, b, c, d) \
+    do { XSS_PROBE3(name, a, b, c); (void) sizeof(d); } while (0)
+#endif
+
+#define XSS_ENGINE_XLIB         0
+#define XSS_ENGINE_XCB          1
+
+XSS_SEMAPHORE(query_start);
+XSS_SEMAPHORE(query_end);
+XSS_SEMAPHORE(connect);
+XSS_SEMAPHORE(connection_lost);
+XSS_SEMAPHORE(extension);
+XSS_SEMAPHORE(tracker);
+
+static inline long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* The start time for a probe that reports a latency, or 0 when nobody is
+   listening. */
+#define XSS_PROBE_CLOCK(name) \
+    (XSS_PROBE_ENABLED(name) ? monotonic_ns() : 0)
+#define XSS_PROBE_SINCE(start) ((start) ? monotonic_ns() - (start) : 0)
+
+#endif
@@ -0,0 +1,147 @@
+/* libpyxss: multi-resolution activity rollups.  See pyxss.h.
+
+   Every sample adds the stretch since the one before to the buckets it
+   overlaps at each level, split at bucket boundaries, so a level never
+   has to be derived from the one below and each sample costs a handful
+   of bucket updates whatever the resolution. */
+
+#include <string.h>
+#include "pyxss.h"
+
+static const int64_t level_width[PYXSS_ROLLUP_LEVELS] = {
+    1000, 60000, 3600000, 86400000
+};
+
+static pyxss_rollup_bucket *level_ring(pyxss_rollup *rollup, int level,
+                                       size_t *size) {
+    switch (level) {
+    case 0:
+        *size = PYXSS_ROLLUP_SECONDS;
+        return rollup->seconds;
+    case 1:
+        *size = PYXSS_ROLLUP_MINUTES;
+        return rollup->minutes;
+    case 2:
+        *size = PYXSS_ROLLUP_HOURS;
+        return rollup->hours;
+    case 3:
+        *size = PYXSS_ROLLUP_DAYS;
+        return rollup->days;
+    }
+    *size = 0;
+    return NULL;
+}
+
+/* Rounds down to a multiple of width, for negative times too. */
+static int64_t align(int64_t time, int64_t width) {
+    int64_t r = time % width;
+
+    return time - (r < 0 ? r + width : r);
+}
+
+static size_t slot(int64_t start, int64_t width, size_t size) {
+    int64_t i = (start / width) % (int64_t) size;
+
+    return (size_t) (i < 0 ? i + (int64_t) size : i);
+}
+
+/* The bucket starting at start, emptied if its slot held an older one, or
+   NULL if the slot has already moved on to a newer one. */
+static pyxss_rollup_bucket *bucket_at(pyxss_rollup_bucket *ring, size_t size,
+                                      int64_t width, int64_t start) {
+    pyxss_rollup_bucket *b = &ring[slot(start, width, size)];
+
+    if (b->start > start)
+        return NULL;
+    if (b->start < start) {
+        memset(b, 0, sizeof(*b));
+        b->start = start;
+    }
+    return b;
+}
+
+void pyxss_rollup_init(pyxss_rollup *rollup, int32_t threshold,
+                       int64_t max_gap) {
+    size_t size, i;
+    pyxss_rollup_bucket *ring;
+    int level;
+
+    memset(rollup, 0, sizeof(*rollup));
+    for (level = 0; level < PYXSS_ROLLUP_LEVELS; level++)
+        for (ring = level_ring(rollup, level, &size), i = 0; i < size; i++)
+            ring[i].start = INT64_MIN;      /* older than any bucket */
+    rollup->threshold = threshold;
+    rollup->max_gap = max_gap;
+}
+
+void pyxss_rollup_gap(pyxss_rollup *rollup) {
+    rollup->have_last = 0;
+}
+
+void pyxss_rollup_add(pyxss_rollup *rollup, int64_t time, unsigned long idle,
+                      int saver_state) {
+    int active = idle <= (unsigned long) rollup->threshold;
+    int saver = saver_state == ScreenSaverOn;
+    int spans = rollup->have_last && time >= rollup->last_time &&
+                time - rollup->last_time <= rollup->max_gap;
+    int level;
+
+    for (level = 0; level < PYXSS_ROLLUP_LEVELS; level++) {
+        int64_t width = level_width[level];
+        pyxss_rollup_bucket *ring, *b;
+        size_t size;
+        int64_t from, to;
+
+        ring = level_ring(rollup, level, &size);
+        for (from = spans ? rollup->last_time : time; from < time; from = to) {
+            to = align(from, width) + width;
+            if (to > time)
+                to = time;
+            if (!(b = bucket_at(ring, size, width, align(from, width))))
+                continue;
+            if (rollup->last_active)
+                b->active_ms += to - from;
+            else
+                b->idle_ms += to - from;
+            if (rollup->last_saver)
+                b->saver_ms += to - from;
+        }
+        if (!(b = bucket_at(ring, size, width, align(time, width))))
+            continue;
+        b->samples++;
+        if (spans && active != rollup->last_active)
+            b->transitions++;
+    }
+    rollup->have_last = 1;
+    rollup->last_time = time;
+    rollup->last_active = active;
+    rollup->last_saver = saver;
+}
+
+int64_t pyxss_rollup_width(int level) {
+    if (level < 0 || level >= PYXSS_ROLLUP_LEVELS)
+        return 0;
+    return level_width[level];
+}
+
+size_t pyxss_rollup_read(const pyxss_rollup *rollup, int level, int64_t start,
+                         pyxss_rollup_bucket *out, size_t count) {
+    const pyxss_rollup_bucket *ring, *b;
+    int64_t width = pyxss_rollup_width(level);
+    size_t size, i;
+
+    if (!width)
+        return 0;
+    ring = level_ring((pyxss_rollup *) rollup, level, &size);
+    start = align(start, width);
+    for (i = 0; i < count; i++, start += width) {
+        b = &ring[slot(start, width, size)];
+        if (b->start == start)
+            out[i] = *b;
+        else {
+            memset(&out[i], 0, sizeof(out[i]));
+            out[i].start = start;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,451 @@
+/* libpyxss: bulk analytics over recorded sample series, and fleets of
+   trackers updated in bulk.  See pyxss.h.
+
+   Every kernel has a scalar version and, on x86 with GCC or clang, an
+   AVX2 one, picked at run time by what the CPU supports.  Both give the
+   same answers; test/series1.py checks that and times them. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pyxss.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SERIES_AVX2 1
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2,popcnt")))
+#endif
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+static int simd_have, simd_on;
+
+static void simd_detect(void) {
+#ifdef SERIES_AVX2
+    __builtin_cpu_init();
+    simd_have = __builtin_cpu_supports("avx2") &&
+                __builtin_cpu_supports("popcnt");
+#endif
+    simd_on = simd_have;
+}
+
+static int use_simd(void) {
+    pthread_once(&simd_once, simd_detect);
+    return __atomic_load_n(&simd_on, __ATOMIC_RELAXED);
+}
+
+int pyxss_series_use_simd(int enable) {
+    pthread_once(&simd_once, simd_detect);
+    __atomic_store_n(&simd_on, enable && simd_have, __ATOMIC_RELAXED);
+    return enable && simd_have;
+}
+
+const char *pyxss_series_kernels(void) {
+    return use_simd() ? "avx2" : "scalar";
+}
+
+/* Counting */
+
+static void count_scalar(const pyxss_series *s, size_t from, int32_t threshold,
+                         pyxss_series_counts *counts) {
+    size_t i;
+
+    for (i = from; i < s->n; i++) {
+        int above = s->idle[i] > threshold;
+        int before = s->idle[i - 1] > threshold;
+
+        counts->above += above;
+        counts->went_idle += above & !before;
+        counts->came_back += before & !above;
+    }
+}
+
+#ifdef SERIES_AVX2
+/* Eight samples at a time: the comparison of each sample and of the one
+   before it become bit masks, and the crossings are where they differ. */
+AVX2 static size_t count_avx2(const pyxss_series *s, int32_t threshold,
+                              pyxss_series_counts *counts) {
+    __m256i limit = _mm256_set1_epi32(threshold);
+    size_t i;
+
+    for (i = 1; i + 8 <= s->n; i += 8) {
+        __m256i cur = _mm256_loadu_si256((const __m256i *) (s->idle + i));
+        __m256i prev = _mm256_loadu_si256((const __m256i *) (s->idle + i - 1));
+        unsigned above = (unsigned) _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpgt_epi32(cur, limit)));
+        unsigned before = (unsigned) _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpgt_epi32(prev, limit)));
+
+        counts->above += (size_t) __builtin_popcount(above);
+        counts->went_idle += (size_t) __builtin_popcount(above & ~before);
+        counts->came_back += (size_t) __builtin_popcount(before & ~above);
+    }
+    return i;
+}
+
+AVX2 static size_t count_state_avx2(const uint8_t *state, size_t n,
+                                    uint8_t value) {
+    __m256i want = _mm256_set1_epi8((char) value);
+    size_t i, count = 0;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (state + i));
+        count += (size_t) __builtin_popcount(
+            (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, want)));
+    }
+    for (; i < n; i++)
+        count += state[i] == value;
+    return count;
+}
+#endif
+
+static size_t count_state(const uint8_t *state, size_t n, uint8_t value) {
+    size_t i, count = 0;
+
+#ifdef SERIES_AVX2
+    if (use_simd())
+        return count_state_avx2(state, n, value);
+#endif
+    for (i = 0; i < n; i++)
+        count += state[i] == value;
+    return count;
+}
+
+void pyxss_series_count(const pyxss_series *s, int32_t threshold,
+                        pyxss_series_counts *counts) {
+    size_t from = 1;
+
+    memset(counts, 0, sizeof(*counts));
+    counts->samples = s->n;
+    if (!s->n)
+        return;
+    counts->above = s->idle[0] > threshold;
+#ifdef SERIES_AVX2
+    if (use_simd())
+        from = count_avx2(s, threshold, counts);
+#endif
+    count_scalar(s, from, threshold, counts);
+    if (s->state)
+        counts->saver_on = count_state(s->state, s->n, ScreenSaverOn);
+}
+
+/* Crossings */
+
+static size_t crossings_scalar(const pyxss_series *s, size_t from,
+                               int32_t threshold, size_t *at, size_t max,
+                               size_t found) {
+    size_t i;
+
+    for (i = from; i < s->n; i++)
+        if ((s->idle[i] > threshold) != (s->idle[i - 1] > threshold)) {
+            if (found < max)
+                at[found] = i;
+            found++;
+        }
+    return found;
+}
+
+#ifdef SERIES_AVX2
+/* Crossings are rare, so most blocks of eight have none and cost a compare
+   and a test; the ones that do are walked bit by bit. */
+AVX2 static size_t crossings_avx2(const pyxss_series *s, int32_t threshold,
+                                  size_t *at, size_t max, size_t *found) {
+    __m256i limit = _mm256_set1_epi32(threshold);
+    size_t i;
+
+    for (i = 1; i + 8 <= s->n; i += 8) {
+        __m256i cur = _mm256_loadu_si256((const __m256i *) (s->idle + i));
+        __m256i prev = _mm256_loadu_si256((const __m256i *) (s->idle + i - 1));
+        unsigned changed = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_xor_si256(_mm256_cmpgt_epi32(cur, limit),
+                             _mm256_cmpgt_epi32(prev, limit))));
+
+        while (changed) {
+            if (*found < max)
+                at[*found] = i + (size_t) __builtin_ctz(changed);
+            (*found)++;
+            changed &= changed - 1;
+        }
+    }
+    return i;
+}
+#endif
+
+size_t pyxss_series_crossings(const pyxss_series *s, int32_t threshold,
+                              size_t *at, size_t max) {
+    size_t from = 1, found = 0;
+
+#ifdef SERIES_AVX2
+    if (use_simd())
+        from = crossings_avx2(s, threshold, at, max, &found);
+#endif
+    return crossings_scalar(s, from, threshold, at, max, found);
+}
+
+/* Buckets */
+
+static void bucket_scalar(const pyxss_series *s, size_t lo, size_t hi,
+                          int32_t threshold, pyxss_bucket *b) {
+    size_t i;
+
+    for (i = lo; i < hi; i++) {
+        int active = s->idle[i] <= threshold;
+
+        b->active += active;
+        b->idle_sum += s->idle[i];
+        if (s->idle[i] > b->idle_max)
+            b->idle_max = s->idle[i];
+        if (active && i + 1 < s->n)
+            b->active_ms += s->time[i + 1] - s->time[i];
+    }
+}
+
+#ifdef SERIES_AVX2
+AVX2 static inline int64_t sum_epi64(__m256i v) {
+    int64_t lanes[4];
+
+    _mm256_storeu_si256((__m256i *) lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/* Four samples at a time, so that idle times widen to 64-bit sums and the
+   active mask lines up with the 64-bit time gaps. */
+AVX2 static size_t bucket_avx2(const pyxss_series *s, size_t lo, size_t hi,
+                               int32_t threshold, pyxss_bucket *b) {
+    __m128i limit = _mm_set1_epi32(threshold);
+    __m256i sum = _mm256_setzero_si256(), gaps = _mm256_setzero_si256();
+    __m128i max = _mm_set1_epi32(b->idle_max);
+    size_t i, active = 0;
+    /* the gap after sample i needs time[i + 1] */
+    size_t end;
+
+    if (hi == lo)
+        return lo;
+    end = hi < s->n ? hi : s->n - 1;
+    for (i = lo; i + 4 <= end; i += 4) {
+        __m128i idle = _mm_loadu_si128((const __m128i *) (s->idle + i));
+        __m128i is_active = _mm_xor_si128(_mm_cmpgt_epi32(idle, limit),
+                                          _mm_set1_epi32(-1));
+        __m256i now = _mm256_loadu_si256((const __m256i *) (s->time + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *) (s->time + i + 1));
+
+        active += (size_t) __builtin_popcount(
+            (unsigned) _mm_movemask_ps(_mm_castsi128_ps(is_active)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(idle));
+        max = _mm_max_epi32(max, idle);
+        gaps = _mm256_add_epi64(gaps, _mm256_and_si256(
+            _mm256_sub_epi64(next, now), _mm256_cvtepi32_epi64(is_active)));
+    }
+    max = _mm_max_epi32(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+    max = _mm_max_epi32(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+    b->idle_max = _mm_cvtsi128_si32(max);
+    b->idle_sum += sum_epi64(sum);
+    b->active_ms += sum_epi64(gaps);
+    b->active += active;
+    return i;
+}
+#endif
+
+/* The first sample at or after time t in s->time[lo, n). */
+static size_t series_find(const pyxss_series *s, size_t lo, int64_t t) {
+    size_t hi = s->n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (s->time[mid] < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+size_t pyxss_series_buckets(const pyxss_series *s, int64_t origin,
+                            int64_t width, int32_t threshold,
+                            pyxss_bucket *buckets, size_t count) {
+    size_t k, lo, placed = 0;
+
+    lo = series_find(s, 0, origin);
+    for (k = 0; k < count; k++) {
+        pyxss_bucket *b = &buckets[k];
+        size_t from, hi;
+
+        memset(b, 0, sizeof(*b));
+        b->start = origin + (int64_t) k * width;
+        hi = series_find(s, lo, b->start + width);
+        b->samples = hi - lo;
+        from = lo;
+#ifdef SERIES_AVX2
+        if (use_simd())
+            from = bucket_avx2(s, lo, hi, threshold, b);
+#endif
+        bucket_scalar(s, from, hi, threshold, b);
+        if (s->state)
+            b->saver_on = count_state(s->state + lo, hi - lo, ScreenSaverOn);
+        placed += hi - lo;
+        lo = hi;
+    }
+    return placed;
+}
+
+/* Fleets */
+
+void pyxss_fleet_init(pyxss_fleet *fleet) {
+    memset(fleet, 0, sizeof(*fleet));
+    fleet->min_wait = -1;
+}
+
+void pyxss_fleet_free(pyxss_fleet *fleet) {
+    free(fleet->threshold);
+    free(fleet->idle_wait);
+    free(fleet->disabled_wait);
+    free(fleet->idle);
+    free(fleet->wait);
+    free(fleet->state);
+    free(fleet->changed);
+    pyxss_fleet_init(fleet);
+}
+
+static int fleet_grow(void **array, size_t size, size_t item) {
+    void *p = realloc(*array, size * item);
+
+    if (!p)
+        return 0;
+    *array = p;
+    return 1;
+}
+
+long pyxss_fleet_add(pyxss_fleet *fleet, int32_t idle_threshold,
+                     int32_t when_idle_wait, int32_t when_disabled_wait) {
+    size_t n = fleet->seats;
+
+    if (n == fleet->size) {
+        size_t size = fleet->size ? 2 * fleet->size : 64;
+
+        /* arrays that have grown keep their size if a later one fails */
+        if (!fleet_grow((void **) &fleet->threshold, size, sizeof(int32_t)) ||
+            !fleet_grow((void **) &fleet->idle_wait, size, sizeof(int32_t)) ||
+            !fleet_grow((void **) &fleet->disabled_wait, size,
+                        sizeof(int32_t)) ||
+            !fleet_grow((void **) &fleet->idle, size, sizeof(int32_t)) ||
+            !fleet_grow((void **) &fleet->wait, size, sizeof(int32_t)) ||
+            !fleet_grow((void **) &fleet->state, size, 1) ||
+            !fleet_grow((void **) &fleet->changed, size, sizeof(uint32_t)))
+            return -1;
+        fleet->size = size;
+    }
+    fleet->threshold[n] = idle_threshold;
+    fleet->idle_wait[n] = when_idle_wait;
+    fleet->disabled_wait[n] = when_disabled_wait;
+    fleet->idle[n] = -1;
+    fleet->wait[n] = 0;
+    fleet->state[n] = 0;
+    fleet->seats++;
+    return (long) n;
+}
+
+int pyxss_fleet_change(const pyxss_fleet *fleet, size_t seat) {
+    return fleet->idle[seat] < 0 ? PYXSS_DISABLED : fleet->state[seat];
+}
+
+/* Seats [from, seats), one at a time: pyxss_idle_tracker_update() over
+   the arrays. */
+static void fleet_scalar(pyxss_fleet *fleet, size_t from, const int32_t *idle,
+                         int32_t *min_wait) {
+    size_t i;
+
+    for (i = from; i < fleet->seats; i++) {
+        int32_t wait;
+        uint8_t state;
+
+        fleet->idle[i] = idle[i];
+        if (idle[i] < 0) {
+            wait = fleet->disabled_wait[i];
+            fleet->changed[fleet->nchanged++] = (uint32_t) i;
+        } else {
+            if (idle[i] > fleet->threshold[i]) {
+                state = PYXSS_IDLE;
+                wait = fleet->idle_wait[i];
+            } else {
+                state = PYXSS_UNIDLE;
+                wait = fleet->threshold[i] - idle[i];
+            }
+            if (state != fleet->state[i]) {
+                fleet->state[i] = state;
+                fleet->changed[fleet->nchanged++] = (uint32_t) i;
+            }
+        }
+        fleet->wait[i] = wait;
+        if (wait < *min_wait)
+            *min_wait = wait;
+    }
+}
+
+#ifdef SERIES_AVX2
+/* Eight seats at a time.  The states and waits are worked out for all of
+   them with compares and blends; seats that change are rare, so only their
+   states are written back, walking the mask bit by bit. */
+AVX2 static size_t fleet_avx2(pyxss_fleet *fleet, const int32_t *idle,
+                              int32_t *min_wait) {
+    __m256i idle_state = _mm256_set1_epi32(PYXSS_IDLE);
+    __m256i unidle_state = _mm256_set1_epi32(PYXSS_UNIDLE);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i least = _mm256_set1_epi32(*min_wait);
+    __m128i low;
+    size_t i;
+
+    for (i = 0; i + 8 <= fleet->seats; i += 8) {
+        __m256i now = _mm256_loadu_si256((const __m256i *) (idle + i));
+        __m256i limit = _mm256_loadu_si256(
+            (const __m256i *) (fleet->threshold + i));
+        __m256i before = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *) (fleet->state + i)));
+        __m256i failed = _mm256_cmpgt_epi32(zero, now);
+        __m256i above = _mm256_cmpgt_epi32(now, limit);
+        __m256i state = _mm256_blendv_epi8(unidle_state, idle_state, above);
+        __m256i wait = _mm256_blendv_epi8(
+            _mm256_sub_epi32(limit, now),
+            _mm256_loadu_si256((const __m256i *) (fleet->idle_wait + i)),
+            above);
+        unsigned report;
+
+        wait = _mm256_blendv_epi8(wait, _mm256_loadu_si256(
+            (const __m256i *) (fleet->disabled_wait + i)), failed);
+        report = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_or_si256(failed, _mm256_xor_si256(
+                _mm256_cmpeq_epi32(state, before), _mm256_set1_epi32(-1)))));
+        _mm256_storeu_si256((__m256i *) (fleet->idle + i), now);
+        _mm256_storeu_si256((__m256i *) (fleet->wait + i), wait);
+        least = _mm256_min_epi32(least, wait);
+        while (report) {
+            size_t seat = i + (size_t) __builtin_ctz(report);
+
+            if (idle[seat] >= 0)
+                fleet->state[seat] = idle[seat] > fleet->threshold[seat] ?
+                                     PYXSS_IDLE : PYXSS_UNIDLE;
+            fleet->changed[fleet->nchanged++] = (uint32_t) seat;
+            report &= report - 1;
+        }
+    }
+    low = _mm_min_epi32(_mm256_castsi256_si128(least),
+                        _mm256_extracti128_si256(least, 1));
+    low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+    low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+    *min_wait = _mm_cvtsi128_si32(low);
+    return i;
+}
+#endif
+
+size_t pyxss_fleet_update(pyxss_fleet *fleet, const int32_t *idle) {
+    int32_t min_wait = INT32_MAX;
+    size_t from = 0;
+
+    fleet->nchanged = 0;
+#ifdef SERIES_AVX2
+    if (use_simd())
+        from = fleet_avx2(fleet, idle, &min_wait);
+#endif
+    fleet_scalar(fleet, from, idle, &min_wait);
+    fleet->min_wait = fleet->seats ? min_wait : -1;
+    return fleet->nchanged;
+}
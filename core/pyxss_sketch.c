@@ -0,0 +1,250 @@
+/* libpyxss: t-digest quantile sketches, and run lengths fed into them.
+   See pyxss.h.
+
+   This is the merging t-digest (Dunning and Ertl, "Computing extremely
+   accurate quantiles using t-digests") with the arcsine scale function:
+   sorted centroids are merged greedily as long as each covers at most
+   one unit of k(q) = compression / 2pi * asin(2q - 1), which keeps them
+   small near q = 0 and 1 and bounds their number by about compression.
+   New values wait in a small buffer and are merged in a batch. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pyxss.h"
+
+#define SKETCH_FORMAT   "tdigest1"
+#define SKETCH_ITEMS    (2 * (PYXSS_SKETCH_CENTROIDS + PYXSS_SKETCH_BUFFER))
+
+static double scale_k(double q) {
+    return PYXSS_SKETCH_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+/* The q where the centroid starting at q0 has to end. */
+static double scale_limit(double q0) {
+    double k = scale_k(q0) + 1;
+
+    if (k >= PYXSS_SKETCH_COMPRESSION / 4.0)
+        return 1;
+    return (sin(k * 2 * M_PI / PYXSS_SKETCH_COMPRESSION) + 1) / 2;
+}
+
+static int centroid_cmp(const void *a, const void *b) {
+    double x = ((const pyxss_centroid *) a)->mean;
+    double y = ((const pyxss_centroid *) b)->mean;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Merges the buffer and n extra centroids into the sketch's centroids. */
+static void sketch_compress(pyxss_sketch *sketch, const pyxss_centroid *extra,
+                            size_t n) {
+    pyxss_centroid all[SKETCH_ITEMS], cur;
+    size_t count = 0, out = 0, i;
+    double total = 0, so_far = 0, limit;
+
+    memcpy(all, sketch->centroid, sketch->centroids * sizeof(*all));
+    count += sketch->centroids;
+    memcpy(all + count, sketch->buffer, sketch->buffered * sizeof(*all));
+    count += sketch->buffered;
+    memcpy(all + count, extra, n * sizeof(*all));
+    count += n;
+    sketch->buffered = 0;
+    if (!count)
+        return;
+    qsort(all, count, sizeof(*all), centroid_cmp);
+    for (i = 0; i < count; i++)
+        total += all[i].weight;
+
+    cur = all[0];
+    limit = scale_limit(0) * total;
+    for (i = 1; i < count; i++) {
+        if (so_far + cur.weight + all[i].weight <= limit ||
+            out == PYXSS_SKETCH_CENTROIDS - 1) {
+            cur.weight += all[i].weight;
+            cur.mean += (all[i].mean - cur.mean) * all[i].weight / cur.weight;
+        } else {
+            sketch->centroid[out++] = cur;
+            so_far += cur.weight;
+            limit = scale_limit(so_far / total) * total;
+            cur = all[i];
+        }
+    }
+    sketch->centroid[out++] = cur;
+    sketch->centroids = out;
+}
+
+void pyxss_sketch_init(pyxss_sketch *sketch) {
+    sketch->count = sketch->sum = 0;
+    sketch->min = INFINITY;
+    sketch->max = -INFINITY;
+    sketch->centroids = sketch->buffered = 0;
+}
+
+void pyxss_sketch_add(pyxss_sketch *sketch, double value, double weight) {
+    if (!(weight > 0) || isnan(value))
+        return;
+    if (sketch->buffered == PYXSS_SKETCH_BUFFER)
+        sketch_compress(sketch, NULL, 0);
+    sketch->buffer[sketch->buffered].mean = value;
+    sketch->buffer[sketch->buffered++].weight = weight;
+    sketch->count += weight;
+    sketch->sum += value * weight;
+    if (value < sketch->min)
+        sketch->min = value;
+    if (value > sketch->max)
+        sketch->max = value;
+}
+
+void pyxss_sketch_merge(pyxss_sketch *sketch, const pyxss_sketch *other) {
+    pyxss_centroid extra[PYXSS_SKETCH_CENTROIDS + PYXSS_SKETCH_BUFFER];
+
+    if (!other->count)
+        return;
+    memcpy(extra, other->centroid, other->centroids * sizeof(*extra));
+    memcpy(extra + other->centroids, other->buffer,
+           other->buffered * sizeof(*extra));
+    sketch_compress(sketch, extra, other->centroids + other->buffered);
+    sketch->count += other->count;
+    sketch->sum += other->sum;
+    if (other->min < sketch->min)
+        sketch->min = other->min;
+    if (other->max > sketch->max)
+        sketch->max = other->max;
+}
+
+double pyxss_sketch_quantile(pyxss_sketch *sketch, double q) {
+    const pyxss_centroid *c = sketch->centroid;
+    double index, cum = 0, left, right, value;
+    size_t i, n;
+
+    if (sketch->buffered)
+        sketch_compress(sketch, NULL, 0);
+    n = sketch->centroids;
+    if (!n)
+        return NAN;
+    if (n == 1)
+        return c[0].mean;
+    q = q < 0 ? 0 : q > 1 ? 1 : q;
+    index = q * sketch->count;
+
+    /* values are spread evenly between centroid centres, and between the
+       outer centres and the extremes */
+    if (index < c[0].weight / 2)
+        value = sketch->min + (c[0].mean - sketch->min) * index /
+                (c[0].weight / 2);
+    else {
+        value = sketch->max;
+        for (i = 0; i + 1 < n; i++) {
+            left = cum + c[i].weight / 2;
+            right = cum + c[i].weight + c[i + 1].weight / 2;
+            if (index < right) {
+                value = c[i].mean + (c[i + 1].mean - c[i].mean) *
+                        (index - left) / (right - left);
+                break;
+            }
+            cum += c[i].weight;
+        }
+        if (i + 1 == n) {
+            left = sketch->count - c[n - 1].weight / 2;
+            value = c[n - 1].mean + (sketch->max - c[n - 1].mean) *
+                    (index - left) / (c[n - 1].weight / 2);
+        }
+    }
+    return value < sketch->min ? sketch->min :
+           value > sketch->max ? sketch->max : value;
+}
+
+size_t pyxss_sketch_format(pyxss_sketch *sketch, char *buf, size_t size) {
+    size_t len, i;
+
+#define APPEND(...) \
+    len += (size_t) snprintf(buf + (len < size ? len : size), \
+                             len < size ? size - len : 0, __VA_ARGS__)
+
+    if (sketch->buffered)
+        sketch_compress(sketch, NULL, 0);
+    len = 0;
+    APPEND("%s %.17g %.17g %.17g %.17g %zu", SKETCH_FORMAT, sketch->count,
+           sketch->sum, sketch->count ? sketch->min : 0,
+           sketch->count ? sketch->max : 0, sketch->centroids);
+    for (i = 0; i < sketch->centroids; i++)
+        APPEND(" %.17g:%.17g", sketch->centroid[i].mean,
+               sketch->centroid[i].weight);
+
+#undef APPEND
+    return len;
+}
+
+int pyxss_sketch_parse(pyxss_sketch *sketch, const char *text) {
+    pyxss_sketch other;
+    char format[16], *end;
+    const char *p;
+    double weight = 0;
+    size_t i, n;
+    int used;
+
+    pyxss_sketch_init(&other);
+    if (sscanf(text, "%15s %lf %lf %lf %lf %zu%n", format, &other.count,
+               &other.sum, &other.min, &other.max, &n, &used) != 6 ||
+        strcmp(format, SKETCH_FORMAT) || n > PYXSS_SKETCH_CENTROIDS)
+        return 0;
+    /* %lf takes nan and inf, which would poison every merge after */
+    if (!isfinite(other.count) || other.count < 0 ||
+        !isfinite(other.sum) || !isfinite(other.min) ||
+        !isfinite(other.max))
+        return 0;
+    p = text + used;
+    for (i = 0; i < n; i++) {
+        other.centroid[i].mean = strtod(p, &end);
+        if (end == p || *end != ':' || !isfinite(other.centroid[i].mean))
+            return 0;
+        p = end + 1;
+        other.centroid[i].weight = strtod(p, &end);
+        if (end == p || !(other.centroid[i].weight > 0) ||
+            !isfinite(other.centroid[i].weight))
+            return 0;
+        weight += other.centroid[i].weight;
+        p = end;
+    }
+    p += strspn(p, " \t\r\n");
+    /* the centroids have to add up */
+    if (*p || fabs(weight - other.count) > 1e-9 * other.count)
+        return 0;
+    other.centroids = n;
+    pyxss_sketch_merge(sketch, &other);
+    return 1;
+}
+
+void pyxss_runs_init(pyxss_runs *runs) {
+    pyxss_sketch_init(&runs->idle);
+    pyxss_sketch_init(&runs->active);
+    runs->mark = 0;
+    runs->state = 0;
+}
+
+void pyxss_runs_update(pyxss_runs *runs, int change, double now,
+                       unsigned long idle) {
+    /* both kinds of run turn over at an input: the last one before an idle
+       run, or the one that ends it */
+    double input = now - (double) idle;
+
+    switch (change) {
+    case PYXSS_IDLE:
+        if (runs->state == PYXSS_UNIDLE && input >= runs->mark)
+            pyxss_sketch_add(&runs->active, input - runs->mark, 1);
+        break;
+    case PYXSS_UNIDLE:
+        if (runs->state == PYXSS_IDLE && input >= runs->mark)
+            pyxss_sketch_add(&runs->idle, input - runs->mark, 1);
+        break;
+    case PYXSS_DISABLED:
+        runs->state = 0;
+        return;
+    default:
+        return;
+    }
+    runs->mark = input;
+    runs->state = change;
+}
@@ -3,7 +3,7 @@
 import os
 import sys
 from distutils.core import Extension, setup
-from distutils.sysconfig import get_python_lib
+from distutils.sysconfig import get_config_var, get_python_lib
 
 
 """The purpose of this module was to let Python access X11 idle times.
@@ -58,6 +58,18 @@ def have_swig(print_config=1):
     return not swig.close()
 
 
+def have_header(header, print_config=1):
+    """Returns whether header can be found in the compiler's usual include
+    directories"""
+    if print_config: print("Checking for %s..." % header, end=' ')
+    multiarch = get_config_var('MULTIARCH') or ''
+    dirs = [get_config_var('INCLUDEDIR'), '/usr/local/include',
+            '/usr/include', os.path.join('/usr/include', multiarch)]
+    found = [d for d in dirs if d and os.path.exists(os.path.join(d, header))]
+    if print_config: print(found[0] if found else "no")
+    return bool(found)
+
+
 print_config = 1
 if sys.argv[-1] == 'setup.py':
     print("To install, run 'python setup.py install'")
@@ -70,8 +82,22 @@ else:
     # than trying to compile the included xss.c file.
     raise OSError("SWIG not installed, please install it and try again")
 
+# static probes for perf and bpftrace (see xss.i), if systemtap's sdt.h is
+# there.  PYXSS_NO_PROBES=1 leaves them out anyway.
+define_macros = []
+if not os.environ.get('PYXSS_NO_PROBES') and \
+        have_header('sys/sdt.h', print_config=print_config):
+    define_macros.append(('HAVE_SYS_SDT_H', '1'))
+
+# the C core (core/*.c) is compiled straight into the module; core/Makefile
+# builds it as a library of its own
 xss_module = Extension(
-    name='xss', sources=[extension_file], libraries=['Xss', 'Xext'])
+    name='xss', sources=[extension_file, 'core/pyxss.c',
+                         'core/pyxss_series.c', 'core/pyxss_sketch.c',
+                         'core/pyxss_rollup.c', 'core/pyxss_governor.c'],
+    include_dirs=['core'], define_macros=define_macros,
+    libraries=['Xss', 'Xext', 'Xi', 'xcb', 'xcb-screensaver', 'xcb-dpms',
+               'm', 'rt'])
 
 setup(
     name='PyXSS',
@@ -87,4 +113,6 @@ setup(
     url="http://bebop.bigasterisk.com/python",
     license="GPLv2",
     packages=['xss'],
+    # for extensions using the C API
+    headers=['core/pyxss.h', 'core/pyxss_capi.h'],
     ext_modules=[xss_module])
@@ -0,0 +1,19 @@
+"""Shows which kind of input device you used last and how busily, from
+XInput2 raw events.  The events are counted in C; this loop only wakes up
+once a second to print the totals."""
+
+import time
+import xss
+
+monitor = xss.ActivityMonitor()
+while 1:
+    end = time.time() + 1
+    while time.time() < end:
+        monitor.wait(int((end - time.time()) * 1000) + 1)
+    s = monitor.summary()
+    print(time.asctime(), end=' ')
+    print("keyboard: idle %5.1fs %4.1f/s  pointer: idle %5.1fs %4.1f/s  " \
+          "touch: idle %5.1fs %4.1f/s" % \
+          (s.keyboard_idle / 1000.0, s.keyboard_rate,
+           s.pointer_idle / 1000.0, s.pointer_rate,
+           s.touch_idle / 1000.0, s.touch_rate))
@@ -0,0 +1,78 @@
+"""Compares IdleTracker's fixed when_idle_wait with an AdaptivePolicy on
+a synthetic fortnight of one user's activity (short breaks by day, long
+ones at lunch and overnight), replayed on a virtual clock.  Reports how
+many queries each made and how quickly and reliably they noticed the
+user coming back.
+
+    python adaptive1.py [days] [latency_target_ms] [miss_budget]"""
+
+import sys, math, random, time
+import xss
+
+days = int(sys.argv[1]) if len(sys.argv) > 1 else 14
+target = int(sys.argv[2]) if len(sys.argv) > 2 else 5000
+budget = float(sys.argv[3]) if len(sys.argv) > 3 else 0.05
+threshold = 60000
+epoch = time.mktime((2024, 3, 4, 0, 0, 0, 0, 0, -1))   # a Monday
+
+def idle_run(rng, hour):
+    """How long the user stays away after a stretch of work, in ms."""
+    if hour < 7 or hour >= 23:
+        median = 5 * 3600
+    elif 12 <= hour < 13 and rng.random() < 0.5:
+        median = 45 * 60
+    elif hour >= 18:
+        median = 40 * 60
+    else:
+        median = 4 * 60 if rng.random() < 0.8 else 30 * 60
+    return int(1000 * median * math.exp(rng.gauss(0, 0.6)))
+
+def session(seed):
+    rng = random.Random(seed)
+    samples = []
+    t = 0
+    end = days * 86400000
+    while t < end:
+        # a stretch of work: a key press every few seconds
+        stop = t + int(rng.expovariate(1 / 900000.0)) + 1000
+        while t < stop:
+            samples.append(xss.RecordedInfo(t))
+            t += rng.randint(500, 5000)
+        hour = time.localtime(epoch + t / 1000.0).tm_hour
+        t += idle_run(rng, hour)
+    return samples
+
+def run(samples, policy):
+    replay = xss.ReplayBackend(samples)
+    log = xss.LatencyLog()
+    tracker = xss.IdleTracker(idle_threshold=threshold, backend=replay,
+                              latency=log, policy=policy)
+    if policy is not None:
+        policy.clock = lambda: epoch + replay.now() / 1000.0
+    queries = 0
+    try:
+        while True:
+            change, wait, idle = tracker.check_idle()
+            queries += 1
+            replay.advance(max(wait, 500))
+    except xss.ReplayFinished:
+        pass
+    back = log.histogram('poll', 'unidle')
+    late = sum(1 for s in log.recent if s.change == 'unidle' and
+               s.latency > target)
+    returns = sum(1 for s in log.recent if s.change == 'unidle')
+    return queries, back, late / max(returns, 1)
+
+samples = session(1)
+print("%d days, %d samples, idle threshold %ds, latency target %.1fs, "
+      "miss budget %.0f%%\n" % (days, len(samples), threshold // 1000,
+                                target / 1000.0, budget * 100))
+print("%-24s %9s %12s %12s %12s %9s" % ("", "queries", "mean back ms",
+                                         "p99 back ms", "max back ms",
+                                         "misses"))
+for name, policy in (("fixed when_idle_wait", None),
+                     ("adaptive", xss.AdaptivePolicy(target, budget))):
+    queries, back, misses = run(samples, policy)
+    print("%-24s %9d %12.0f %12.0f %12.0f %8.1f%%" %
+          (name, queries, back.mean(), back.percentile(99), back.max,
+           misses * 100))
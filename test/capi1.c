@@ -0,0 +1,89 @@
+/* An extension module that uses xss's C API; test/capi1.py builds it. */
+
+#include <Python.h>
+#include <time.h>
+#include "pyxss_capi.h"
+
+static const PyXSS_CAPI *xss_api;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* get_info(n): n queries on this thread's connection; returns the seconds
+   they took, the last idle time and how many failed. */
+static PyObject *capi1_get_info(PyObject *self, PyObject *args) {
+    XScreenSaverInfo info = { 0 };
+    long n, i, failed = 0;
+    double start, elapsed;
+
+    if (!PyArg_ParseTuple(args, "l", &n))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    start = now();
+    for (i = 0; i < n; i++)
+        failed += !xss_api->get_info(&info);
+    elapsed = now() - start;
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("dkl", elapsed, info.idle, failed);
+}
+
+/* latest(sampler, n): n reads of a Sampler's last sample; returns the
+   seconds they took and that sample's time and idle time. */
+static PyObject *capi1_latest(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    PyXSS_Sample sample = { 0 };
+    void *sampler;
+    long n, i, missing = 0;
+    double start, elapsed;
+
+    if (!PyArg_ParseTuple(args, "Ol", &obj, &n))
+        return NULL;
+    if (!(sampler = xss_api->sampler_from_object(obj)))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    start = now();
+    for (i = 0; i < n; i++)
+        missing += !xss_api->sampler_latest(sampler, &sample);
+    elapsed = now() - start;
+    Py_END_ALLOW_THREADS
+    if (missing)
+        Py_RETURN_NONE;
+    return Py_BuildValue("ddk", elapsed, sample.time, sample.idle);
+}
+
+/* check(threshold): what a new idle tracker reports on its first check. */
+static PyObject *capi1_check(PyObject *self, PyObject *args) {
+    pyxss_idle_tracker tracker;
+    unsigned long idle;
+    long threshold, wait;
+    int change;
+
+    if (!PyArg_ParseTuple(args, "l", &threshold))
+        return NULL;
+    xss_api->idle_tracker_init(&tracker, threshold, 5000, 120000);
+    Py_BEGIN_ALLOW_THREADS
+    change = xss_api->idle_tracker_check(&tracker, &wait, &idle);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("ilk", change, wait, idle);
+}
+
+static PyMethodDef capi1_methods[] = {
+    {"get_info", capi1_get_info, METH_VARARGS, NULL},
+    {"latest", capi1_latest, METH_VARARGS, NULL},
+    {"check", capi1_check, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef capi1_module = {
+    PyModuleDef_HEAD_INIT, "capi1", NULL, -1, capi1_methods
+};
+
+PyMODINIT_FUNC PyInit_capi1(void) {
+    if (!(xss_api = PyXSS_ImportCAPI()))
+        return NULL;
+    return PyModule_Create(&capi1_module);
+}
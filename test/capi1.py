@@ -0,0 +1,79 @@
+"""Builds test/capi1.c, an extension module using xss's C API, and times
+the hot paths through it against the same calls from Python.
+
+    python test/capi1.py [calls]             # 20000 by default
+
+Runs against the fake server.  Each path is called that many times in a
+loop, from Python and from the module: get_info() with a round trip to
+the server, get_info() answered from the query governor's shared sample
+(so the cost is all call overhead), and a Sampler's latest().  The
+answers have to agree, and a tracker driven through the C API has to
+report the user idle."""
+
+import os, subprocess, sys, sysconfig, tempfile, time
+import xss
+from xss.fakeserver import FakeXServer, Timeline
+
+DISPLAY = 4801
+TOLERANCE = 50          # ms between Python's answer and the module's
+
+def build():
+    here = os.path.dirname(os.path.abspath(__file__))
+    out = tempfile.mkdtemp()
+    target = os.path.join(out,
+                          'capi1' + sysconfig.get_config_var('EXT_SUFFIX'))
+    subprocess.check_call([os.environ.get('CC', 'cc'), '-shared', '-fPIC',
+                           '-O2', '-I' + sysconfig.get_paths()['include'],
+                           '-I' + os.path.join(here, '..', 'core'),
+                           os.path.join(here, 'capi1.c'), '-o', target])
+    sys.path.insert(0, out)
+    import capi1
+    return capi1
+
+def per_call(elapsed, calls):
+    return elapsed / calls * 1e6
+
+def compare(name, python, native, calls):
+    began = time.perf_counter()
+    for i in range(calls):
+        python()
+    elapsed = time.perf_counter() - began
+    print("  %-26s %7.2f us from Python  %7.2f us through the C API" %
+          (name, per_call(elapsed, calls), per_call(native(calls), calls)))
+
+calls = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+
+# the user was last active ten minutes before the server started
+server = FakeXServer()
+display = server.add_display(DISPLAY, timeout=0,
+                             timeline=Timeline.from_dict({'idle': 600000}))
+server.start()
+os.environ['DISPLAY'] = display.name
+try:
+    capi1 = build()
+    elapsed, idle, failed = capi1.get_info(1)
+    assert not failed
+    assert abs(idle - xss.get_info().idle) < TOLERANCE, idle
+    change, wait, idle = capi1.check(60000)
+    assert change == 1 and wait == 5000, (change, wait)    # PYXSS_IDLE
+    print("answers and tracker agree with Python's")
+
+    print("per call, %d calls:" % calls)
+    compare("get_info()", xss.get_info, lambda n: capi1.get_info(n)[0],
+            calls)
+    xss.govern_queries(1)
+    compare("get_info(), governed", xss.get_info,
+            lambda n: capi1.get_info(n)[0], calls)
+    xss.govern_queries(0)
+
+    sampler = xss.Sampler(10)
+    sampler.start()
+    while sampler.latest() is None:
+        time.sleep(0.01)
+    compare("Sampler.latest()", sampler.latest,
+            lambda n: capi1.latest(sampler, n)[0], calls)
+    sampler.stop()
+    elapsed, when, idle = capi1.latest(sampler, 1)
+    assert (when, idle) == (sampler.latest().time, sampler.latest().idle)
+finally:
+    server.stop()
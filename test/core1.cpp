@@ -0,0 +1,31 @@
+// The trackers from C++, without Python: prints every change, like
+// idletracker1.py.  Build against an installed libpyxss with
+//
+//     c++ -std=c++17 -o core1 test/core1.cpp $(pkg-config --cflags --libs pyxss)
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+
+#include <pyxss.hpp>
+
+int main(int argc, char **argv) {
+    using namespace std::chrono;
+    milliseconds threshold(argc > 1 ? std::atol(argv[1]) : 5000);
+    pyxss::IdleTracker tracker(threshold);
+
+    std::printf("Using IdleTracker, threshold=%ldms\n",
+                static_cast<long>(threshold.count()));
+    for (;;) {
+        pyxss::Check check = tracker.check();
+        std::time_t now = std::time(nullptr);
+        std::printf("%.24s Change: %s, suggested wait time: %ld, "
+                    "idle time: %ld\n", std::ctime(&now),
+                    pyxss::to_string(check.change),
+                    static_cast<long>(check.wait.count()),
+                    static_cast<long>(check.idle.count()));
+        std::fflush(stdout);
+        std::this_thread::sleep_for(check.wait);
+    }
+}
@@ -0,0 +1,68 @@
+"""Compares the Xlib and XCB query engines against the fake X server: one
+blocking get_info() per display, versus XCBEngine pipelining a QueryInfo
+to every display before collecting any replies.
+
+    python engines1.py [displays] [latency_ms] [rounds]"""
+
+import os, sys, time, subprocess
+
+displays = int(sys.argv[1]) if len(sys.argv) > 1 else 100
+latency = sys.argv[2] if len(sys.argv) > 2 else '1'
+rounds = int(sys.argv[3]) if len(sys.argv) > 3 else 20
+base = 4000
+
+# the fake server runs in its own process, since a blocking query holds
+# the interpreter while it waits for the reply
+server = subprocess.Popen([sys.executable, '-m', 'xss.fakeserver',
+                           '-n', str(displays), '--base', str(base),
+                           '--random', '1', '--latency', latency],
+                          stdout=subprocess.PIPE)
+server.stdout.readline()
+os.environ['DISPLAY'] = ':%d' % base
+import xss
+
+def report(name, queries, elapsed):
+    print("%-28s %8.0f queries/s  %8.3f ms/round" % \
+          (name, queries / elapsed, elapsed * 1000.0 / rounds))
+
+try:
+    start = time.perf_counter()
+    for i in range(rounds):
+        xss.get_info()
+    report("Xlib get_info, 1 display", rounds, time.perf_counter() - start)
+
+    engine = xss.XCBEngine()
+    for i in range(displays):
+        engine.add_display(':%d' % (base + i))
+    engine.submit()
+    engine.wait()   # the first round also negotiates the extension
+
+    start = time.perf_counter()
+    for i in range(rounds):
+        engine.query(0)
+    report("XCB query, 1 display", rounds, time.perf_counter() - start)
+
+    start = time.perf_counter()
+    for i in range(rounds):
+        for screen in range(engine.nscreens):
+            engine.query(screen)
+    report("XCB query, %d displays" % displays, rounds * engine.nscreens,
+           time.perf_counter() - start)
+
+    start = time.perf_counter()
+    for i in range(rounds):
+        engine.submit()
+        engine.wait()
+    report("XCB pipelined, %d displays" % displays, rounds * engine.nscreens,
+           time.perf_counter() - start)
+
+    start = time.perf_counter()
+    for i in range(rounds):
+        engine.submit()
+        while engine.poll():
+            pass
+    report("XCB polled, %d displays" % displays, rounds * engine.nscreens,
+           time.perf_counter() - start)
+    print("last screen:", engine.result(engine.nscreens - 1).idle, "ms idle")
+finally:
+    server.terminate()
@@ -0,0 +1,79 @@
+"""Runs IdleTracker on evdev input instead of the X server.
+
+    python test/evdev1.py                    # every /dev/input/event*
+    python test/evdev1.py /dev/input/event3  # just these devices
+    python test/evdev1.py --replay keys.rec  # a recorded session
+
+A recording is raw struct input_event records, as captured with
+'cat /dev/input/event3 > keys.rec'.  It is played into a FIFO with its
+original gaps, timestamps moved to now, so the tracker sees it as a live
+device.  Without a recording or devices readable, a short synthetic
+session is played."""
+
+import os, struct, sys, tempfile, threading, time
+import xss
+
+EVENT = struct.Struct('llHHi')      # struct input_event on 64-bit Linux
+EV_SYN, EV_KEY = 0, 1
+
+def synthetic():
+    """Key presses every 0.2 s for 2 s, a 3 s break, and 1 s more."""
+    t = 0.0
+    for start, stop in ((0.0, 2.0), (5.0, 6.0)):
+        t = start
+        while t < stop:
+            yield t, EV_KEY, 30, 1
+            yield t, EV_SYN, 0, 0
+            t += 0.2
+
+def recorded(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    first = None
+    for i in range(len(data) // EVENT.size):
+        sec, usec, type, code, value = EVENT.unpack_from(data, i * EVENT.size)
+        t = sec + usec / 1e6
+        first = t if first is None else first
+        yield t - first, type, code, value
+
+def play(fifo, events, done):
+    writer = os.open(fifo, os.O_WRONLY)
+    start = time.monotonic()
+    for offset, type, code, value in events:
+        delay = start + offset - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        now = time.monotonic()
+        os.write(writer, EVENT.pack(int(now), int(now % 1 * 1e6), type, code,
+                                    value))
+    time.sleep(2)
+    done.set()
+    os.close(writer)
+
+args = sys.argv[1:]
+done = threading.Event()
+if args and args[0] != '--replay':
+    backend = xss.EvdevBackend(args)
+elif not args and xss.EvdevBackend().monitor.present():
+    backend = xss.EvdevBackend()
+else:
+    fifo = os.path.join(tempfile.mkdtemp(), 'events')
+    os.mkfifo(fifo)
+    events = recorded(args[1]) if args else synthetic()
+    player = threading.Thread(target=play, args=(fifo, events, done))
+    player.start()
+    # the player waits in open() until this opens the FIFO, so no EOF
+    backend = xss.EvdevBackend([fifo])
+
+tracker = xss.IdleTracker(idle_threshold=1000, when_idle_wait=250,
+                          backend=backend)
+print("reading", [backend.monitor.device(i).path
+                  for i in range(backend.monitor.device_count())])
+while not done.is_set():
+    change, wait_time, idle = tracker.check_idle()
+    if change:
+        print("%.2f %s (idle %d ms)" % (time.monotonic() % 100, change, idle))
+    # input can end an idle stretch at any moment: wake up for it
+    if change == 'disabled':
+        break
+    backend.monitor.wait(int(min(wait_time, 250)))
@@ -0,0 +1,35 @@
+"""Exports idle and query metrics for Prometheus: into a file for
+node-exporter's textfile collector, over HTTP, or both.
+
+    python test/exporter1.py --textfile /var/lib/node_exporter/pyxss.prom
+    python test/exporter1.py --listen 9139 --seat kiosk1
+"""
+
+import argparse, time, xss
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--textfile", help="file to keep rewriting")
+parser.add_argument("--interval", type=int, default=15000,
+                    help="ms between file writes")
+parser.add_argument("--listen", help="[host:]port or unix socket path")
+parser.add_argument("--period", type=int, default=1000,
+                    help="ms between samples")
+parser.add_argument("--threshold", type=int, default=60000,
+                    help="idle ms before the user counts as idle")
+parser.add_argument("--seat", help="value of a seat label")
+args = parser.parse_args()
+
+exporter = xss.Exporter(args.period, args.threshold)
+if args.seat:
+    exporter.add_label('seat', args.seat)
+if args.textfile:
+    exporter.write_to(args.textfile, args.interval)
+if args.listen and not exporter.serve(args.listen):
+    raise SystemExit("can't listen on %s" % args.listen)
+exporter.start()
+try:
+    while 1:
+        time.sleep(3600)
+except KeyboardInterrupt:
+    exporter.stop()
+print(exporter.render())
@@ -0,0 +1,138 @@
+"""Replays a known timeline through an Exporter at several periods and
+checks its totals against the exact ones.
+
+    python test/exporter2.py [hours]                # 6 by default
+
+The timeline is key presses 20 s to several minutes apart, with the
+screensaver coming on after two minutes idle and going off at the next
+press, recorded every 100 ms.  A ReplayBackend polls it every period
+(off the recording's grid, so no poll lands on an input) and each sample
+goes to Exporter.feed().  While at most one press falls between samples
+(any period under 20 s), idle, active and screensaver seconds and the
+transitions have to come out exact; coarser periods still have to
+account for every second.  Then labels: values are escaped, bad ones
+refused, and the longest labels still render in full."""
+
+import random, sys
+import xss
+
+THRESHOLD = 60000
+SAVER = 120000
+GRID = 100              # ms between recorded samples
+OFFSET = 50             # ms from the grid to the first poll
+TOLERANCE = 0.005       # s: the text has ms resolution
+
+def timeline(hours, seed=7):
+    """Key press times (ms) from the first, before the recording starts."""
+    rng = random.Random(seed)
+    presses = [-30000]
+    while presses[-1] < hours * 3600000:
+        if rng.random() < 0.6:
+            gap = rng.randint(200, 550) * GRID
+        else:
+            gap = rng.randint(610, 4000) * GRID
+        presses.append(presses[-1] + gap)
+    return presses
+
+def record(presses, end):
+    samples = []
+    i = 0
+    for t in range(0, end + 1, GRID):
+        while i + 1 < len(presses) and presses[i + 1] <= t:
+            i += 1
+        idle = t - presses[i]
+        if idle >= SAVER:
+            samples.append(xss.RecordedInfo(t, xss.ScreenSaverOn, 0,
+                                            idle - SAVER, idle))
+        else:
+            samples.append(xss.RecordedInfo(t, xss.ScreenSaverOff, 0,
+                                            SAVER - idle, idle))
+    return samples
+
+def overlap(start, end, lo, hi):
+    return max(0, min(end, hi) - max(start, lo))
+
+def exact(presses, lo, hi):
+    """Idle, active and saver seconds, and transitions, over [lo, hi]."""
+    idle = saver = 0
+    to_idle = to_active = 0
+    for a, b in zip(presses, presses[1:] + [float('inf')]):
+        idle += overlap(a + THRESHOLD, b, lo, hi)
+        saver += overlap(a + SAVER, b, lo, hi)
+        # idle means past the threshold, so from just after a + THRESHOLD
+        if lo <= a + THRESHOLD < hi and a + THRESHOLD < b:
+            to_idle += 1
+        if lo < b <= hi and b - a > THRESHOLD:
+            to_active += 1
+    return {'idle': idle / 1000.0, 'active': (hi - lo - idle) / 1000.0,
+            'saver': saver / 1000.0, 'to_idle': to_idle,
+            'to_active': to_active}
+
+def totals(text):
+    values = {}
+    for line in text.splitlines():
+        if line and not line.startswith('#'):
+            name, value = line.rsplit(' ', 1)
+            values[name] = float(value)
+    return {'idle': values['pyxss_idle_seconds_total'],
+            'active': values['pyxss_active_seconds_total'],
+            'saver': values['pyxss_screensaver_on_seconds_total'],
+            'to_idle': values['pyxss_transitions_total{to="idle"}'],
+            'to_active': values['pyxss_transitions_total{to="active"}']}
+
+def replay(samples, period):
+    exporter = xss.Exporter(period, THRESHOLD)
+    backend = xss.ReplayBackend(samples)
+    backend.advance(OFFSET)
+    first = backend.now()
+    while True:
+        try:
+            info = backend.get_info()
+        except xss.ReplayFinished:
+            break
+        exporter.feed(info.timestamp, info.idle, info.state,
+                      info.til_or_since)
+        last = backend.now()
+        backend.advance(period)
+    return totals(exporter.render()), first, last
+
+def check(name, got, want):
+    good = abs(got - want) <= TOLERANCE
+    if not good:
+        print("  %s: %g, should be %g" % (name, got, want))
+    return good
+
+hours = float(sys.argv[1]) if len(sys.argv) > 1 else 6
+presses = timeline(hours)
+samples = record(presses, int(hours * 3600000))
+good = True
+for period in (100, 1000, 7000, 19000, 150000):
+    got, first, last = replay(samples, period)
+    want = exact(presses, first, last)
+    print("every %6d ms: %8.1f s idle  %8.1f s active  %8.1f s saver  "
+          "%d/%d transitions" % (period, got['idle'], got['active'],
+                                 got['saver'], got['to_idle'],
+                                 got['to_active']))
+    good = check("idle + active", got['idle'] + got['active'],
+                 (last - first) / 1000.0) and good
+    if period < 20000:
+        for key in sorted(want):
+            good = check(key, got[key], want[key]) and good
+
+exporter = xss.Exporter()
+exporter.add_label('seat', 'say "hi"\\\n')
+assert 'seat="say \\"hi\\"\\\\\\n"' in exporter.render()
+for bad in ('seat=kiosk', 'seat="a"b"', 'le="1"', '1seat="a"', 'seat="a",'):
+    try:
+        exporter.set_labels(bad)
+    except ValueError:
+        continue
+    print("  set_labels() took %r" % bad)
+    good = False
+exporter.set_labels('a="%s"' % ('x' * 250))
+text = exporter.render()
+assert text.endswith('pyxss_query_duration_seconds_count{a="%s"} 0\n' %
+                     ('x' * 250)), text[-200:]
+print("labels are escaped and checked, and %d bytes render in full" %
+      len(text))
+sys.exit(0 if good else 1)
@@ -0,0 +1,43 @@
+"""Load-tests xss.get_info() against the fake X server: starts N fake
+displays with random activity and one client process per display, each
+querying as fast as it can, and reports the aggregate queries per second.
+
+    python fakeserver1.py [displays] [seconds] [latency_ms]"""
+
+import os, sys, time, subprocess
+from xss.fakeserver import FakeXServer, Timeline
+
+displays = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+seconds = float(sys.argv[2]) if len(sys.argv) > 2 else 5
+latency = float(sys.argv[3]) if len(sys.argv) > 3 else 0
+
+client = """
+import sys, time, xss
+end = time.time() + %f
+count = 0
+while time.time() < end:
+    xss.get_info()
+    count += 1
+print(count)
+""" % seconds
+
+server = FakeXServer()
+for i in range(displays):
+    server.add_display(timeline=Timeline.random(i), latency=latency)
+server.start()
+
+procs = []
+for display in server.displays:
+    env = dict(os.environ, DISPLAY=display.name)
+    procs.append(subprocess.Popen([sys.executable, '-c', client], env=env,
+                                  stdout=subprocess.PIPE))
+total = 0
+for proc in procs:
+    out, _ = proc.communicate()
+    total += int(out or 0)
+server.stop()
+
+print("%d displays, %d queries in %.1fs: %.0f queries/s" % \
+      (displays, total, seconds, total / seconds))
+print("requests seen by the server: %d" % \
+      sum(d.requests for d in server.displays))
@@ -0,0 +1,94 @@
+"""Runs IdleTracker logic for a fleet of seats, natively and in Python.
+
+    python test/fleet1.py [seats] [ticks]      # 5000 and 200 by default
+
+Every tick, each seat gets an idle reading (a random walk of input and
+breaks, with now and then a failed query), and a Fleet and one
+IdleTracker per seat are both updated with them.  Their changes and waits
+have to agree; then both are timed per tick, the Fleet with the vector
+kernels and with the scalar ones."""
+
+import random, sys, time
+from array import array
+import xss
+
+TICK = 1000
+
+class Readings:
+    """A backend for the Python trackers: seat i's reading this tick."""
+    def __init__(self, readings, seat):
+        self.readings = readings
+        self.seat = seat
+    def get_info(self):
+        idle = self.readings[self.seat]
+        if idle < 0:
+            raise RuntimeError("Couldn't query screensaver extension.")
+        return xss.RecordedInfo(0, idle=idle)
+
+def simulate(seats, ticks):
+    rng = random.Random(46)
+    idle = [rng.randrange(0, 300000) for i in range(seats)]
+    away = [rng.random() < 0.3 for i in range(seats)]
+    for t in range(ticks):
+        readings = array('i')
+        for i in range(seats):
+            if rng.random() < 0.01:
+                away[i] = not away[i]
+            idle[i] = idle[i] + TICK if away[i] else rng.randrange(0, TICK)
+            readings.append(-1 if rng.random() < 0.001 else idle[i])
+        yield readings
+
+seats = int(sys.argv[1]) if len(sys.argv) > 1 else 5000
+ticks = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+rng = random.Random(7)
+thresholds = [rng.choice([60000, 120000, 300000]) for i in range(seats)]
+ticks_data = list(simulate(seats, ticks))
+
+fleet = xss.Fleet()
+for threshold in thresholds:
+    fleet.add(threshold)
+current = array('i', [0] * seats)
+trackers = [xss.IdleTracker(idle_threshold=threshold,
+                            backend=Readings(current, i))
+            for i, threshold in enumerate(thresholds)]
+waits = array('i', [0] * seats)
+changes = 0
+for readings in ticks_data:
+    current[:] = readings
+    expected, expected_waits = [], []
+    for i, tracker in enumerate(trackers):
+        change, wait, idle = tracker.check_idle()
+        if change:
+            expected.append((i, change, wait))
+        expected_waits.append(wait)
+    fleet.update(readings)
+    got = [fleet.change(i) for i in range(fleet.changes)]
+    assert [(c.seat, c.change, c.wait) for c in got] == expected
+    fleet.waits(waits)
+    assert list(waits) == expected_waits
+    assert fleet.min_wait == min(expected_waits)
+    changes += len(got)
+print("%d seats, %d ticks: %d changes, all as IdleTracker reports them" %
+      (seats, ticks, changes))
+
+began = time.perf_counter()
+for readings in ticks_data[:20]:
+    current[:] = readings
+    for tracker in trackers:
+        tracker.check_idle()
+python_tick = (time.perf_counter() - began) / 20
+print("  %-22s %9.1f us per tick" % ("IdleTracker per seat", python_tick * 1e6))
+for simd in (1, 0):
+    if not xss.series_use_simd(simd) and simd:
+        continue
+    began = time.perf_counter()
+    for readings in ticks_data:
+        fleet.update(readings)
+        for i in range(fleet.changes):
+            fleet.change(i)
+    native_tick = (time.perf_counter() - began) / ticks
+    print("  %-22s %9.1f us per tick (%.0fx)" %
+          ("Fleet, " + xss.series_kernels(), native_tick * 1e6,
+           python_tick / native_tick))
+xss.series_use_simd(1)
+print("next tick due in %d ms" % fleet.min_wait)
@@ -0,0 +1,123 @@
+"""Starts a login's worth of polling processes, with and without the
+query governor, and counts the queries that reach the X server.
+
+    python test/governor1.py [processes] [rate] [seconds]   # 32, 20, 3
+
+Each process polls get_info() every 10 ms, first ungoverned and then with
+xss.govern_queries(rate).  The fake server counts the QueryInfo requests
+it answers; governed, they have to stay within the rate (plus the burst,
+and the few that go through before there is a shared sample), while
+every process still gets an answer every time.  As in threads1.py, there
+is no input on the display, so every answer, queried or aged from the
+shared sample, has to agree on when the last input was."""
+
+import json, os, subprocess, sys, time
+import xss
+from xss.fakeserver import FakeXServer, Timeline
+
+DISPLAY = 4800
+POLL = 0.01
+SETTLE = 0.5            # s: the start, when every process queries at once
+TOLERANCE = 3           # ms: the server rounds idle time, and clocks tick
+
+def monotonic_ms():
+    return time.monotonic() * 1000.0
+
+def cached():
+    return xss.get_governor_stats().cached
+
+def helper(rate):
+    if rate:
+        xss.govern_queries(rate)
+    print("ready")
+    sys.stdout.flush()
+    start, end = [float(t) for t in sys.stdin.readline().split()]
+    answers = shared = 0
+    lo, hi = -float('inf'), float('inf')    # bounds on the last input
+    last = []           # when cached answers put it, and round trips
+    time.sleep(max(0, start - monotonic_ms()) / 1000.0)
+    while monotonic_ms() < end:
+        before = cached()
+        sent = monotonic_ms()
+        idle = xss.get_info().idle
+        done = monotonic_ms()
+        if cached() == before:
+            lo, hi = max(lo, sent - idle), min(hi, done - idle)
+            last.append(done - sent)
+        else:
+            shared += 1
+            last.append(-(done - idle))
+        answers += 1
+        time.sleep(POLL)
+    print(json.dumps({'answers': answers, 'shared': shared, 'lo': lo,
+                      'hi': hi,
+                      'rtt': max([0] + [l for l in last if l >= 0]),
+                      'aged': [-l for l in last if l < 0]}))
+
+def run(processes, rate, seconds, display):
+    helpers = [subprocess.Popen([sys.executable, __file__, '--helper',
+                                 str(rate)],
+                                stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+               for i in range(processes)]
+    # everyone starts polling together, once their interpreters are up
+    for h in helpers:
+        h.stdout.readline()
+    start = monotonic_ms() + 100
+    end = start + seconds * 1000
+    for h in helpers:
+        h.stdin.write(b"%f %f\n" % (start, end))
+        h.stdin.close()
+    time.sleep((start - monotonic_ms()) / 1000.0)
+    before = display.queries
+    time.sleep(SETTLE)
+    settled = display.queries
+    time.sleep((end - monotonic_ms()) / 1000.0)
+    queries = display.queries - before
+    steady = (display.queries - settled) / (seconds - SETTLE)
+    results = [json.loads(h.stdout.read()) for h in helpers]
+    for h in helpers:
+        h.wait()
+
+    answers = sum(r['answers'] for r in results)
+    shared = sum(r['shared'] for r in results)
+    # a shared sample is aged from when its query returned, so it puts the
+    # last input later than it was by up to that query's round trip
+    rtt = max(r['rtt'] for r in results)
+    lo = max([r['lo'] for r in results] +
+             [t - rtt for r in results for t in r['aged']])
+    hi = min([r['hi'] for r in results] +
+             [t for r in results for t in r['aged']])
+    consistent = lo <= hi + TOLERANCE
+    print("%-16s %3d processes  %7.1f QueryInfo/s at the server (%.1f after "
+          "the start)  %5.1f answers/s each  %3.0f%% shared  %s" %
+          ("governor at %g/s" % rate if rate else "ungoverned", processes,
+           queries / float(seconds), steady,
+           answers / float(seconds) / processes,
+           100.0 * shared / max(answers, 1),
+           "ok" if consistent else "INCONSISTENT"))
+    # each process may also query once before there is a shared sample
+    within = not rate or queries <= rate * seconds + 1 + processes
+    if not within:
+        print("  %d queries is more than the rate allows" % queries)
+    return consistent and within
+
+if sys.argv[1:2] == ['--helper']:
+    helper(float(sys.argv[2]))
+    sys.exit(0)
+
+processes = int(sys.argv[1]) if len(sys.argv) > 1 else 32
+rate = float(sys.argv[2]) if len(sys.argv) > 2 else 20
+seconds = float(sys.argv[3]) if len(sys.argv) > 3 else 3
+
+# the user was last active ten minutes before the server started
+server = FakeXServer()
+display = server.add_display(DISPLAY, timeout=0,
+                             timeline=Timeline.from_dict({'idle': 600000}))
+server.start()
+os.environ['DISPLAY'] = display.name
+try:
+    good = run(processes, 0, seconds, display)
+    good = run(processes, rate, seconds, display) and good
+finally:
+    server.stop()
+sys.exit(0 if good else 1)
@@ -20,5 +20,4 @@ while 1:
     info = tracker.check_idle()
     print(time.asctime(), end=' ') 
     print("Change: %s, suggested wait time: %s, idle time: %s" % info)
-    wait_time = info[1] / 1000.0
-    time.sleep(wait_time)
+    tracker.sleep(info[1])
@@ -0,0 +1,41 @@
+"""Holds the screensaver off past its timeout, then lets it come on.
+
+    python test/inhibit1.py [timeout]
+
+Sets the screensaver timeout to timeout seconds (default 2), holds an
+inhibit for twice that with no input, and lets go: the screensaver
+should stay off while it's held and come on a timeout later.  The old
+timeout is put back at the end."""
+
+import sys, time
+import xss
+
+def show(what):
+    info = xss.get_info()
+    state = {xss.ScreenSaverOff: 'off', xss.ScreenSaverOn: 'on',
+             xss.ScreenSaverDisabled: 'disabled'}.get(info.state, 'cycle')
+    print("%-10s saver %-8s idle %6d ms  inhibits %d" %
+          (what, state, info.idle, xss.inhibit_count()))
+
+timeout = int(sys.argv[1]) if len(sys.argv) > 1 else 2
+old = xss.get_snapshot()
+xss.set_screensaver(timeout, old.saver_interval)
+xss.force_screensaver(xss.ScreenSaverReset)
+try:
+    with xss.Inhibit():
+        with xss.Inhibit():     # nested: still one suspension
+            for i in range(timeout * 2):
+                time.sleep(1)
+                show("held")
+    for i in range(timeout + 1):
+        time.sleep(1)
+        show("released")
+    xss.force_screensaver(xss.ScreenSaverReset)
+    time.sleep(0.1)
+    show("reset")
+    xss.force_screensaver(xss.ScreenSaverActive)
+    time.sleep(0.1)
+    show("activated")
+finally:
+    xss.force_screensaver(xss.ScreenSaverReset)
+    xss.set_screensaver(old.saver_timeout, old.saver_interval)
@@ -0,0 +1,53 @@
+"""Measures idle-detection latency three ways against the fake X server:
+an IdleTracker polling at its suggested times (but no more often than
+--poll-floor), and a mainloop.Watcher getting SYNC alarms and screensaver
+events.  A simulated user presses a key now and then.
+
+    python latency1.py [seconds] [threshold_ms] [latency_ms]"""
+
+import os, sys, time, random, select
+from xss.fakeserver import FakeXServer, Timeline
+
+seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 60
+threshold = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+latency = float(sys.argv[3]) if len(sys.argv) > 3 else 1
+poll_floor = 500
+
+server = FakeXServer()
+display = server.add_display(timeline=Timeline(), timeout=threshold * 2,
+                             latency=latency)
+server.start()
+os.environ['DISPLAY'] = display.name
+import xss
+from xss.mainloop import Watcher
+
+log = xss.LatencyLog()
+tracker = xss.IdleTracker(idle_threshold=threshold, latency=log)
+watcher = Watcher(latency=log)
+watcher.on_idle(threshold, lambda event: None)
+print("server clock synced to within %.2f ms" % watcher.watch.clock_error)
+
+rng = random.Random(1)
+start = time.monotonic()
+next_key = start + rng.expovariate(1.0 / (threshold * 2.5 / 1000.0))
+next_poll = start
+while time.monotonic() - start < seconds:
+    now = time.monotonic()
+    timeout = max(min(next_key, next_poll) - now, 0)
+    if not watcher.pending():
+        select.select([watcher], [], [], timeout)
+    if watcher.pending() or select.select([watcher], [], [], 0)[0]:
+        watcher.dispatch()
+    now = time.monotonic()
+    if now >= next_key:
+        display.input()
+        next_key = now + rng.expovariate(1.0 / (threshold * 2.5 / 1000.0))
+    if now >= next_poll:
+        change, wait, idle = tracker.check_idle()
+        next_poll = now + max(wait, poll_floor) / 1000.0
+server.stop()
+
+print(log.report())
+for mode in ('poll', 'event', 'alarm'):
+    print("\n%s:" % mode)
+    print(log.histogram(mode))
@@ -0,0 +1,88 @@
+"""Records your idle times to a file, or replays a recording through
+IdleTracker as fast as possible and reports how many samples per second the
+tracker gets through.
+
+    python replay1.py record session.rec    (Ctrl-C to stop)
+    python replay1.py bench session.rec
+    python replay1.py bench                 (uses a synthetic recording)"""
+
+import sys, time, random
+import xss
+
+def record(filename):
+    recorder = xss.Recorder(open(filename, 'w'))
+    try:
+        while 1:
+            info = recorder.get_info()
+            print(time.asctime(), "Idle: %sms" % info.idle)
+            time.sleep(0.1)
+    except KeyboardInterrupt:
+        recorder.close()
+
+def synthetic(hours=24, period=100):
+    """A day of samples every 100ms, alternating random active and idle
+    stretches, with the screensaver coming on after 10 minutes idle."""
+    samples = []
+    rng = random.Random(42)
+    t = last_input = 0
+    next_break = rng.randint(1000, 60000)
+    resume = None
+    while t < hours * 3600 * 1000:
+        if resume is None:
+            last_input = t
+            if t >= next_break:
+                resume = t + rng.expovariate(1 / 300000.0)
+        elif t >= resume:
+            resume = None
+            next_break = t + rng.randint(1000, 600000)
+        idle = t - last_input
+        if idle >= 600000:
+            samples.append(xss.RecordedInfo(t, xss.ScreenSaverOn, 0,
+                                            idle - 600000, idle))
+        else:
+            samples.append(xss.RecordedInfo(t, xss.ScreenSaverOff, 0,
+                                            600000 - idle, idle))
+        t += period
+    return samples
+
+def bench(samples):
+    replay = xss.ReplayBackend(samples)
+    count = 0
+    start = time.perf_counter()
+    try:
+        while 1:
+            replay.get_info()
+            replay.advance(100)
+            count += 1
+    except xss.ReplayFinished:
+        pass
+    elapsed = time.perf_counter() - start
+    print("get_info: %d samples in %.2fs, %.0f samples/s" % \
+          (count, elapsed, count / elapsed))
+
+    for tracker in (xss.IdleTracker(idle_threshold=60000, backend=replay),
+                    xss.XSSTracker(backend=replay)):
+        replay.rewind()
+        count = changes = 0
+        start = time.perf_counter()
+        try:
+            while 1:
+                change, wait_time, idle = tracker.check_idle()
+                if change:
+                    changes += 1
+                # poll every 100ms so every sample goes through the tracker
+                replay.sleep(100)
+                count += 1
+        except xss.ReplayFinished:
+            pass
+        elapsed = time.perf_counter() - start
+        print("%s: %d samples, %d changes in %.2fs, %.0f samples/s" % \
+              (tracker.__class__.__name__, count, changes, elapsed,
+               count / elapsed))
+
+if len(sys.argv) > 2 and sys.argv[1] == 'record':
+    record(sys.argv[2])
+elif len(sys.argv) > 2 and sys.argv[1] == 'bench':
+    bench(xss.load_recording(open(sys.argv[2])))
+else:
+    bench(synthetic())
@@ -0,0 +1,124 @@
+"""Rolls a synthetic week up at four resolutions and reads views off it.
+
+    python test/rollup1.py [days]            # 7 by default
+    python test/rollup1.py --live [seconds]  # a real Sampler, 120 s
+
+Feeds a Sampler a sample a second of a synthetic recording with rollups
+on, checks the hourly buckets against Series.buckets() over the same
+samples and that every level adds up to the same totals, then times
+reading each zoom level and prints the last day hour by hour.  --live
+runs the sampler on the X server instead and prints the last minute."""
+
+import random, sys, time
+from array import array
+import xss
+
+THRESHOLD = 60000
+START = 1700006400000       # a UTC midnight
+LEVELS = [('seconds', xss.RollupSeconds, 3600),
+          ('minutes', xss.RollupMinutes, 1440),
+          ('hours', xss.RollupHours, 744), ('days', xss.RollupDays, 400)]
+
+def synthetic(days):
+    """Working hours with breaks, the screensaver on after ten minutes."""
+    rng = random.Random(45)
+    times, idles, states = array('q'), array('i'), array('B')
+    last_input = START
+    back = 0                # when a break ends
+    for s in range(days * 86400):
+        t = START + s * 1000
+        hour = s // 3600 % 24
+        if t >= back and 9 <= hour < 18 and rng.random() < 0.2:
+            last_input = t
+            if rng.random() < 0.003:
+                back = t + rng.randint(1, 40) * 60000
+        idle = t - last_input
+        times.append(t)
+        idles.append(idle)
+        states.append(xss.ScreenSaverOn if idle >= 600000 else
+                      xss.ScreenSaverOff)
+    return times, idles, states
+
+def bar(ms, width):
+    return '#' * int(round(40.0 * ms / width))
+
+def show_totals(name, total):
+    print("  %-8s active %9.1f min  idle %9.1f min  saver %9.1f min  "
+          "%5d transitions" % (name, total.active_ms / 60000.0,
+                               total.idle_ms / 60000.0,
+                               total.saver_ms / 60000.0, total.transitions))
+
+def offline(days):
+    times, idles, states = synthetic(days)
+    sampler = xss.Sampler(1000)
+    sampler.enable_rollups(THRESHOLD)
+    began = time.perf_counter()
+    for t, idle, state in zip(times, idles, states):
+        sampler.feed(t, idle, state)
+    elapsed = time.perf_counter() - began
+    print("%d samples rolled up in %.2f s (%.2f us each, with feed())" %
+          (len(times), elapsed, elapsed / len(times) * 1e6))
+
+    hours = days * 24
+    series = xss.Series()
+    series.extend(times, idles, states)
+    series.buckets(START, 3600000, hours, THRESHOLD)
+    view = sampler.rollup(xss.RollupHours, START, hours)
+    for i in range(hours):
+        assert view.bucket(i).active_ms == series.bucket(i).active_ms, i
+    print("hourly active time agrees with Series.buckets()")
+
+    def same(a, b):
+        return (a.active_ms, a.idle_ms, a.saver_ms, a.transitions) == \
+               (b.active_ms, b.idle_ms, b.saver_ms, b.transitions)
+    last_day = START + (days - 1) * 86400000
+    assert same(sampler.rollup(xss.RollupDays, START, days).total(),
+                sampler.rollup(xss.RollupHours, START, hours).total())
+    assert same(sampler.rollup(xss.RollupHours, last_day, 24).total(),
+                sampler.rollup(xss.RollupMinutes, last_day, 1440).total())
+    print("days, hours and minutes add up to the same totals")
+
+    # what each level still holds, covering its whole retention
+    end = times[-1]
+    print("totals over each level's retention:")
+    for name, level, count in LEVELS:
+        width = sampler.rollup(level, 0, 1).width
+        view = sampler.rollup(level, end - (count - 1) * width, count)
+        show_totals(name, view.total())
+
+    for name, level, count in LEVELS:
+        began = time.perf_counter()
+        for i in range(100):
+            sampler.rollup(level, -1, count)
+        elapsed = (time.perf_counter() - began) / 100
+        print("  reading %4d %-8s %7.1f us" % (count, name, elapsed * 1e6))
+
+    print("the last day:")
+    view = sampler.rollup(xss.RollupHours, -1, 24)
+    for i in range(view.count):
+        b = view.bucket(i)
+        print("  %02d:00  %5.1f min  %s" % ((b.start // 3600000) % 24,
+                                           b.active_ms / 60000.0,
+                                           bar(b.active_ms, 3600000)))
+
+def live(seconds):
+    sampler = xss.Sampler(100)
+    sampler.enable_rollups(5000)
+    sampler.start()
+    try:
+        time.sleep(seconds)
+    finally:
+        sampler.stop()
+    view = sampler.rollup(xss.RollupSeconds, -1, 60)
+    for i in range(view.count):
+        b = view.bucket(i)
+        print("  %s  active %4d ms  idle %4d ms  %2d samples  %s" %
+              (time.strftime("%H:%M:%S", time.localtime(b.start / 1000)),
+               b.active_ms, b.idle_ms, b.samples,
+               "*" if b.transitions else ""))
+    show_totals("minute", sampler.rollup(xss.RollupMinutes, -1, 1).total())
+
+if sys.argv[1:2] == ['--live']:
+    live(int(sys.argv[2]) if len(sys.argv) > 2 else 120)
+else:
+    offline(int(sys.argv[1]) if len(sys.argv) > 1 else 7)
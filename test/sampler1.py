@@ -0,0 +1,27 @@
+"""Samples idle time every 100 ms in a native thread, smooths it and
+reports only when the filtered state changes."""
+
+import time, xss
+
+sampler = xss.Sampler(100)
+sampler.add_filter(xss.SamplerEWMA, 1000)               # 1 s time constant
+sampler.add_filter(xss.SamplerHysteresis, 4000, 5000)   # idle from 5 s, back below 4 s
+sampler.add_filter(xss.SamplerDebounce, 300)
+sampler.add_filter(xss.SamplerMinDwell, 2000)
+sampler.start()
+
+try:
+    while 1:
+        sampler.wait()
+        out = sampler.next()
+        while out is not None:
+            if not out.ok:
+                print(time.asctime(), "(can't query the X server)")
+            else:
+                print(time.asctime(), "idle" if out.state else "active",
+                      "raw %dms, smoothed %.0fms" % (out.idle, out.value))
+            out = sampler.next()
+        print("   %d samples, %d published" % (sampler.samples,
+                                              sampler.published))
+except KeyboardInterrupt:
+    sampler.stop()
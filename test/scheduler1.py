@@ -0,0 +1,58 @@
+"""Runs a few jobs in idle windows and prints what happens to them.
+
+    python test/scheduler1.py [min_idle] [seconds]
+
+Submits a shell loop (paused on input), a Python callable that counts with
+checkpoints (also paused) and one that starts over on input, all wanting
+min_idle seconds of idle time (default 2), then prints the jobs' states
+every half second for the given time (default 30).  Leave the keyboard
+alone to see them start; touch it to see them stop.  The scheduler's
+stats are printed at the end."""
+
+import sys, time
+import xss
+
+def counter(job):
+    total = 0
+    for i in range(200):
+        job.checkpoint()
+        time.sleep(0.05)
+        total += i
+    return total
+
+min_idle = float(sys.argv[1]) if len(sys.argv) > 1 else 2
+seconds = int(sys.argv[2]) if len(sys.argv) > 2 else 30
+
+scheduler = xss.IdleScheduler()
+print("detecting input by", scheduler.mode)
+jobs = [
+    scheduler.submit_process(['sh', '-c', 'for i in $(seq 16); do sleep 0.5; '
+                              'done'], min_idle=int(min_idle * 1000),
+                             name='shell'),
+    scheduler.submit(counter, min_idle=int(min_idle * 1000)),
+    scheduler.submit(counter, min_idle=int(min_idle * 1000),
+                     on_activity='restart', name='restarting'),
+]
+scheduler.max_jobs = len(jobs)
+scheduler.start()
+
+last = None
+for i in range(seconds * 2):
+    states = ["%s %s (%.1f s)" % (job.name, job.state, job.run_ms / 1000)
+              for job in jobs]
+    if states != last:
+        print("%5.1f s  %s" % (i / 2, ",  ".join(states)))
+        last = states
+    if all(job.wait(0) for job in jobs):
+        break
+    time.sleep(0.5)
+scheduler.stop()
+
+for job in jobs:
+    print("%-10s %-9s started %d times, result %r, returncode %r" %
+          (job.name, job.state, job.starts, job.result, job.returncode))
+stats = scheduler.stats()
+pauses = stats.pop('pause_ms')
+print(stats)
+print("input to pause:")
+print(pauses)
@@ -0,0 +1,108 @@
+"""Benchmarks the bulk analytics kernels, vector and scalar.
+
+    python test/series1.py                   # 20 million synthetic samples
+    python test/series1.py -n 100000000
+    python test/series1.py session.rec       # a Recorder file instead
+
+Checks the kernels against plain Python on the first 200000 samples, then
+times each of them with the AVX2 kernels and with the scalar ones, in
+samples per second, and prints the busiest hours."""
+
+import random, sys, time
+from array import array
+import xss
+
+THRESHOLD = 60000
+HOUR = 3600000
+
+def synthetic(n):
+    """A sample a second; the user is away for a while 3% of the time."""
+    times, idles, states = array('q'), array('i'), array('B')
+    rng = random.Random(42)
+    idle, away = 0, 0
+    for i in range(n):
+        if away:
+            away -= 1
+            idle += 1000
+        elif rng.random() < 0.03:
+            away = rng.randrange(10, 900)
+        else:
+            idle = rng.randrange(0, 1000)
+        times.append(i * 1000)
+        idles.append(idle)
+        states.append(xss.ScreenSaverOn if idle > 600000 else
+                      xss.ScreenSaverOff)
+    return times, idles, states
+
+def python_count(idles, threshold):
+    above = went_idle = came_back = 0
+    before = None
+    for idle in idles:
+        now = idle > threshold
+        above += now
+        if before is not None and now != before:
+            if now:
+                went_idle += 1
+            else:
+                came_back += 1
+        before = now
+    return above, went_idle, came_back
+
+def check(times, idles, states):
+    series = xss.Series()
+    series.extend(times, idles, states)
+    counts = series.count(THRESHOLD)
+    expected = python_count(idles, THRESHOLD)
+    got = (counts.above, counts.went_idle, counts.came_back)
+    assert got == expected, (got, expected)
+    active = sum(t1 - t0 for t0, t1, idle in zip(times, times[1:], idles)
+                 if idle <= THRESHOLD)
+    series.buckets(times[0], times[-1] - times[0] + 1, 1, THRESHOLD)
+    assert series.bucket(0).active_ms == active
+    print("kernels agree with Python on %d samples" % len(idles))
+
+def bench(series, name, run):
+    start = time.perf_counter()
+    run()
+    elapsed = time.perf_counter() - start
+    print("  %-10s %8.0f M samples/s" % (name, series.samples / elapsed / 1e6))
+
+args = sys.argv[1:]
+series = xss.Series()
+if args and args[0] != '-n':
+    series.load(args[0])
+else:
+    n = int(args[1]) if args else 20000000
+    # built in pieces to keep the Python side's memory down
+    piece = synthetic(min(n, 200000))
+    check(*piece)
+    for start in range(0, n, len(piece[0])):
+        count = min(len(piece[0]), n - start)
+        times = array('q', (t + start * 1000 for t in piece[0][:count]))
+        series.extend(times, piece[1][:count], piece[2][:count])
+print("%d samples" % series.samples)
+
+origin = series.time(0)
+hours = (series.time(series.samples - 1) - origin) // HOUR + 1
+for simd in (1, 0):
+    if not xss.series_use_simd(simd) and simd:
+        print("no AVX2 here")
+        continue
+    print(xss.series_kernels())
+    bench(series, "count", lambda: series.count(THRESHOLD))
+    bench(series, "crossings", lambda: series.crossings(THRESHOLD))
+    bench(series, "segments", lambda: series.segments(THRESHOLD))
+    bench(series, "buckets", lambda: series.buckets(origin, HOUR, hours,
+                                                    THRESHOLD))
+xss.series_use_simd(1)
+
+counts = series.count(THRESHOLD)
+print("%d went idle, %d came back, screensaver on in %d samples" %
+      (counts.went_idle, counts.came_back, counts.saver_on))
+series.buckets(origin, HOUR, hours, THRESHOLD)
+busiest = sorted((series.bucket(i) for i in range(hours)),
+                 key=lambda b: -b.active_ms)[:5]
+for b in busiest:
+    print("  hour %4d: active %5.1f min, %d samples, longest idle %d s" %
+          ((b.start - origin) // HOUR, b.active_ms / 60000, b.samples,
+           b.idle_max // 1000))
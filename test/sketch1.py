@@ -0,0 +1,97 @@
+"""Keeps run-length sketches for a few simulated seats and merges them.
+
+    python test/sketch1.py [seats] [days]
+
+Every seat is a synthetic recording (as in replay1.py, with breaks of
+random lengths) replayed through an IdleTracker with a RunSketches.  The
+run lengths are also kept exactly, to compare: each seat's p50, p90 and
+p99 of idle and active runs are printed from both, then the seats'
+sketches are serialized, merged back into one and checked against the
+fleet's exact quantiles."""
+
+import random, sys
+import xss
+
+THRESHOLD = 60000
+
+def synthetic(seed, days, period=1000):
+    """Active stretches of up to 20 minutes, and breaks mostly short but
+    now and then hours long."""
+    rng = random.Random(seed)
+    samples = []
+    t = last_input = 0
+    next_break = rng.randint(1000, 1200000)
+    resume = None
+    while t < days * 86400 * 1000:
+        if resume is None:
+            last_input = t
+            if t >= next_break:
+                resume = t + rng.lognormvariate(12, 1.2)
+        elif t >= resume:
+            resume = None
+            next_break = t + rng.randint(1000, 1200000)
+        samples.append(xss.RecordedInfo(t, xss.ScreenSaverOff, 0, 0,
+                                        t - last_input))
+        t += period
+    return samples
+
+def exact_runs(samples):
+    """The idle and active run lengths, as RunSketches defines them."""
+    idle_runs, active_runs = [], []
+    state = mark = None
+    for s in samples:
+        now = 'idle' if s.idle > THRESHOLD else 'unidle'
+        if now != state:
+            input_time = s.timestamp - s.idle
+            if state == 'unidle' and now == 'idle':
+                active_runs.append(input_time - mark)
+            elif state == 'idle' and now == 'unidle':
+                idle_runs.append(input_time - mark)
+            state, mark = now, input_time
+    return idle_runs, active_runs
+
+def quantile(values, q):
+    values = sorted(values)
+    return values[int(q * (len(values) - 1))]
+
+def show(name, sketch, exact):
+    print("  %-6s %5d runs" % (name, sketch.count), end='')
+    for q in (0.5, 0.9, 0.99):
+        print("  p%-2d %7.1f s (exact %7.1f)" %
+              (q * 100, sketch.quantile(q) / 1000,
+               quantile(exact, q) / 1000), end='')
+    print()
+
+seats = int(sys.argv[1]) if len(sys.argv) > 1 else 4
+days = int(sys.argv[2]) if len(sys.argv) > 2 else 7
+fleet_idle, fleet_active = xss.Sketch(), xss.Sketch()
+all_idle, all_active = [], []
+size = 0
+for seat in range(seats):
+    samples = synthetic(seat, days)
+    replay = xss.ReplayBackend(samples)
+    runs = xss.RunSketches()
+    tracker = xss.IdleTracker(idle_threshold=THRESHOLD, backend=replay,
+                              runs=runs)
+    try:
+        while 1:
+            tracker.check_idle()
+            replay.advance(1000)
+    except xss.ReplayFinished:
+        pass
+    idle_runs, active_runs = exact_runs(samples)
+    all_idle += idle_runs
+    all_active += active_runs
+    print("seat %d:" % seat)
+    show("idle", runs.idle(), idle_runs)
+    show("active", runs.active(), active_runs)
+
+    # what a seat would send to be aggregated
+    idle_text, active_text = runs.idle().serialize(), runs.active().serialize()
+    size += len(idle_text) + len(active_text)
+    fleet_idle.merge_serialized(idle_text)
+    fleet_active.merge_serialized(active_text)
+
+print("fleet, from %d bytes of sketches:" % size)
+show("idle", fleet_idle, all_idle)
+show("active", fleet_active, all_active)
@@ -2,15 +2,20 @@
 screensaver will activate."""
 
 import xss
+from xss.mainloop import Watcher, TkSource
 from tkinter.tix import *
 
 class IdleMeter(Meter):
-    def __init__(self, master, *args, **kw):
+    """Rather than polling, the meter sits still until the X server says
+    the screensaver is less than a minute away, then counts down."""
+    def __init__(self, master, watcher, *args, **kw):
         Meter.__init__(self, master, *args, **kw)
         self.master = master
-        self.after(0, self.update_xss)
-    def update_xss(self):
-        self.info = xss.get_info()
+        watcher.on_progress(self.update_xss)
+        watcher.on_screensaver(self.saver_changed)
+        self.configure(value=0, text="active")
+    def update_xss(self, info):
+        self.info = info
         if self.info.state == xss.ScreenSaverOff:
             total = float(self.info.idle + self.info.til_or_since)
             self.configure(value=self.info.idle / total,
@@ -18,7 +23,12 @@ class IdleMeter(Meter):
                      (self.info.til_or_since / 1000.0, 
                       self.info.idle / 1000.0))
             self.fade()
-        self.after(100, self.update_xss)
+    def saver_changed(self, event):
+        if event.state == xss.ScreenSaverOff:
+            self.configure(value=0, text="active")
+        else:
+            self.configure(value=1, text="screensaver on")
+        self.fade()
     def fade(self):
         self['fillcolor'] = colorfade(blue, red, float(self['value']))
 
@@ -45,6 +55,8 @@ root = Tk()
 blue = colortotuple(root, "blue")
 red = colortotuple(root, "red")
 root.wm_geometry("175x25")
-meter = IdleMeter(root)
+watcher = Watcher(progress_window=60000)
+meter = IdleMeter(root, watcher)
 meter.pack(fill=BOTH, expand=1)
+TkSource(root, watcher).attach()
 mainloop()
@@ -0,0 +1,194 @@
+"""Scales every query path from 1 to 64 threads and profiles contention.
+
+    python test/threads1.py                        # against the fake server
+    python test/threads1.py --display :99          # against Xvfb, say
+    python test/threads1.py --threads 1,8,64 --seconds 2 --latency 1
+    python test/threads1.py --modes get_info,watch-shared
+
+For each query path (mode) and thread count, that many threads query as
+fast as they can for a while.  Printed per run: aggregate queries per
+second, latency percentiles over all queries and the worst thread's p99,
+X round trips per query, and how often and how long the module's object
+locks were waited for (xss.profile_queries()).  Modes:
+
+    get_info        xss.get_info(): each thread's own Xlib connection
+    snapshot        xss.get_snapshot(): each thread's own XCB connection
+    watch-shared    one IdleWatch's info() for all threads
+    watch-own       an IdleWatch per thread
+    xcb-shared      one XCBEngine's query() for all threads
+    xcb-own         an XCBEngine per thread
+    sampler-cached  one Sampler's latest(), from its thread's last sample
+
+Every reading is also checked: with no input on the display, each one
+pins the time of the last input to between when its query was sent and
+when it returned, less the idle time, and all of them have to agree to
+within a few ms.  A reply mixed up between threads, or a stale one, shows
+up as a failure.  Under the GIL the Python side of the threads is
+serialized; a free-threaded build shows the native paths alone."""
+
+import argparse, os, subprocess, sys, threading, time
+import xss
+
+MODES = ['get_info', 'snapshot', 'watch-shared', 'watch-own', 'xcb-shared',
+         'xcb-own', 'sampler-cached']
+TOLERANCE = 3           # ms: the server rounds idle time, and clocks tick
+
+def query_function(mode, shared):
+    """A function that makes one query on this thread, and returns the idle
+    time and, for a cached reading, when its query returned (None for a
+    query made there and then)."""
+    if mode == 'get_info':
+        return lambda: (xss.get_info().idle, None)
+    if mode == 'snapshot':
+        return lambda: (xss.get_snapshot().idle, None)
+    if mode == 'watch-shared':
+        return lambda: (shared.info().idle, None)
+    if mode == 'watch-own':
+        watch = xss.IdleWatch()
+        return lambda: (watch.info().idle, None)
+    if mode == 'xcb-shared':
+        return lambda: (shared.query(0).idle, None)
+    if mode == 'xcb-own':
+        engine = xss.XCBEngine()
+        engine.add_display(None)
+        return lambda: (engine.query(0).idle, None)
+    if mode == 'sampler-cached':
+        def latest():
+            out = shared.latest()
+            return out.idle, out.time
+        return latest
+    raise ValueError(mode)
+
+def monotonic_ms():
+    # the clock SamplerOutput.time is on
+    return time.monotonic() * 1000.0
+
+def make_shared(mode):
+    if mode == 'watch-shared':
+        return xss.IdleWatch()
+    if mode == 'xcb-shared':
+        engine = xss.XCBEngine()
+        engine.add_display(None)
+        return engine
+    if mode == 'sampler-cached':
+        sampler = xss.Sampler(10)
+        sampler.start()
+        while sampler.latest() is None:
+            time.sleep(0.01)
+        return sampler
+    return None
+
+def percentile(values, q):
+    return values[min(len(values) - 1, int(q * len(values)))]
+
+class Worker(threading.Thread):
+    def __init__(self, mode, shared, barrier, seconds, round_trip):
+        threading.Thread.__init__(self)
+        self.mode, self.shared = mode, shared
+        self.barrier, self.seconds = barrier, seconds
+        self.round_trip = round_trip    # the longest a sampler's query takes
+        self.latencies = []
+        self.lo = -float('inf')     # bounds on the last input's time
+        self.hi = float('inf')
+        self.errors = 0
+
+    def run(self):
+        query = query_function(self.mode, self.shared)
+        query()                     # connect outside the timed part
+        latencies, lo, hi = self.latencies, self.lo, self.hi
+        self.barrier.wait()
+        end = monotonic_ms() + self.seconds * 1000
+        while 1:
+            start = monotonic_ms()
+            if start >= end:
+                break
+            try:
+                idle, returned = query()
+            except RuntimeError:
+                self.errors += 1
+                continue
+            done = monotonic_ms()
+            latencies.append(done - start)
+            if returned is not None:
+                # the sampler sent its query a round trip before
+                start, done = returned - self.round_trip, returned
+            lo = max(lo, start - idle)
+            hi = min(hi, done - idle)
+        self.lo, self.hi = lo, hi
+
+def run(mode, threads, seconds, round_trip):
+    shared = make_shared(mode)
+    barrier = threading.Barrier(threads + 1)
+    workers = [Worker(mode, shared, barrier, seconds, round_trip)
+               for i in range(threads)]
+    for w in workers:
+        w.start()
+    barrier.wait()
+    xss.reset_query_stats()
+    began = time.perf_counter()
+    for w in workers:
+        w.join()
+    elapsed = time.perf_counter() - began
+    stats = xss.get_query_stats()
+    if mode == 'sampler-cached':
+        shared.stop()
+
+    latencies = sorted(l for w in workers for l in w.latencies)
+    count = len(latencies)
+    worst = max(percentile(sorted(w.latencies), 0.99)
+                for w in workers if w.latencies)
+    ok = max(w.lo for w in workers) <= min(w.hi for w in workers) + TOLERANCE
+    errors = sum(w.errors for w in workers)
+    print("%-14s %3d  %9.0f  %7.3f %7.3f %7.3f %8.3f  %5.2f  %6.1f%% %8.3f"
+          "  %s" %
+          (mode, threads, count / elapsed, percentile(latencies, 0.5),
+           percentile(latencies, 0.9), percentile(latencies, 0.99), worst,
+           stats.round_trips / float(max(stats.queries, 1)),
+           100.0 * stats.contended / max(stats.locks, 1),
+           stats.lock_wait_ms / max(count, 1),
+           ("ok" if ok else "INCONSISTENT") +
+           (" (%d errors)" % errors if errors else "")))
+    return ok and not errors
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--display', help="an X server to use instead of "
+                    "starting the fake one")
+parser.add_argument('--threads', default='1,2,4,8,16,32,64')
+parser.add_argument('--seconds', type=float, default=1)
+parser.add_argument('--latency', default='0',
+                    help="ms of latency for the fake server to add")
+parser.add_argument('--modes', default=','.join(MODES))
+args = parser.parse_args()
+
+server = None
+if args.display:
+    os.environ['DISPLAY'] = args.display
+else:
+    # in a process of its own, so that it doesn't compete for the GIL; the
+    # user was last active ten minutes before it started, and isn't again
+    display = 4700
+    server = subprocess.Popen([sys.executable, '-m', 'xss.fakeserver',
+                               '--base', str(display), '--timeout', '0',
+                               '--latency', args.latency,
+                               '--timeline', '/dev/stdin'],
+                              stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    server.stdin.write(b'{"idle": 600000}')
+    server.stdin.close()
+    server.stdout.readline()
+    os.environ['DISPLAY'] = ':%d' % display
+
+xss.profile_queries(1)
+good = True
+try:
+    print("%-14s %3s  %9s  %7s %7s %7s %8s  %5s  %7s %8s" %
+          ('mode', 'thr', 'queries/s', 'p50 ms', 'p90 ms', 'p99 ms',
+           'worst99', 'rt/q', 'waited', 'lock ms/q'))
+    for mode in args.modes.split(','):
+        for threads in [int(n) for n in args.threads.split(',')]:
+            good = run(mode, threads, args.seconds,
+                       10 + 2 * float(args.latency)) and good
+finally:
+    if server:
+        server.terminate()
+        server.wait()
+sys.exit(0 if good else 1)
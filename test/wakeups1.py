@@ -0,0 +1,38 @@
+import random, sys, threading, time
+import xss
+# runs a few pollers that each sleep like a tracker does, first waking at
+# exactly the time asked for and then with the default slack, and counts
+# how many separate wakeups the process needed for them
+
+agents = 8
+seconds = 10.0
+if len(sys.argv) > 1:
+    agents = int(sys.argv[1])
+
+def poller(seed, slack, stop):
+    rng = random.Random(seed)
+    while time.monotonic() < stop:
+        # an unidle tracker's wait: the time left until the idle threshold
+        xss.sleep(rng.randint(200, 3000), slack)
+
+def run(slack):
+    xss.reset_wake_stats()
+    stop = time.monotonic() + seconds
+    threads = [threading.Thread(target=poller, args=(i, slack, stop))
+               for i in range(agents)]
+    start = time.process_time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    cpu = time.process_time() - start
+    stats = xss.get_wake_stats()
+    wakeups = stats.aligned + stats.exact
+    label = "exact" if slack == 0 else "coalesced"
+    print("%-10s %6d sleeps %6d wakeups (%.2f sleeps each) "
+          "%7.1f ms late on average, %.3f s cpu" %
+          (label, stats.waits, wakeups, stats.waits / max(wakeups, 1),
+           stats.slack_used / max(stats.waits, 1), cpu))
+
+run(0)
+run(None)
@@ -1,4 +1,14 @@
 from .xss import *
+from .xss import get_info as _x_get_info
+from .xss import _C_API     # for PyCapsule_Import(); see core/pyxss_capi.h
+from .backend import (ReplayFinished, RecordedInfo, XBackend, XCBBackend,
+                      EvdevBackend, Recorder, ReplayBackend, load_recording,
+                      sleep)
+from .latency import Histogram, DetectionStamp, LatencyLog
+from .latency import monotonic_ms as _monotonic_ms
+from .adaptive import RunLengthModel, AdaptivePolicy
+from .scheduler import IdleScheduler, Job, JobCancelled
+import threading as _threading
 
 __version__ = "2.1.1"
 __author__ = "David McClosky (dmcc@bigaterisk.com)"
@@ -12,9 +22,9 @@ tell you the following bits of information (and a bit more):
     - How many milliseconds the screensaver has been on for, or how many it
       will take for it to be activated.
 
-It cannot actually activate or deactivate the screensaver.
-(You can do that by typing 'xset s on' and then 'xset s [time]' where time
-is the time in seconds that the screensaver should activate in.
+It can also hold the screensaver off (inhibit(), or "with xss.Inhibit():"),
+turn it on or off now (force_screensaver()), and set its timeout
+(set_screensaver()), as 'xset s' would, without running anything.
 
 Note that this module is not an interface to JWZ's fine screensaver
 package, but the extension in XFree86 instead.
@@ -54,7 +64,141 @@ you whether the user became idle or unidle since the last poll, when the
 next poll should take place, and the current idle time in milliseconds.
 IdleTracker is based on some threshold for idle time, while XSSTracker
 announces that the user is idle when the screensaver activates.  An example
-poller can be found at the end of this file (xss/__init__.py)."""
+poller can be found at the end of this file (xss/__init__.py).
+
+The samples can come from somewhere other than the X server: see
+xss.backend for recording a session and replaying it, which is useful
+for testing and benchmarking tracker logic."""
+
+_backend = None
+
+
+def use_backend(backend):
+    """Makes get_info() (and every tracker not given a backend of its own)
+    read from backend instead of the X server.  Pass None to go back to
+    the X server.  Returns the previous backend."""
+    global _backend
+    previous, _backend = _backend, backend
+    return previous
+
+
+def get_info():
+    """Returns the current XScreenSaverInfo, from the X server unless
+    another backend was selected with use_backend()."""
+    if _backend is None:
+        return _x_get_info()
+    return _backend.get_info()
+
+
+# like get_info()'s connections, one XCB connection per thread, so that
+# threads taking snapshots don't queue behind one engine's lock
+_snapshot_backends = _threading.local()
+
+
+def _now(backend=None):
+    """The clock of backend, or of the backend get_info() reads from."""
+    backend = backend or _backend
+    if backend is None:
+        return _monotonic_ms()
+    return backend.now()
+
+
+def get_snapshot():
+    """Returns a PowerSnapshot of the default display: everything in
+    get_info(), plus the screensaver timeout and interval (in seconds, as
+    set by 'xset s') and the DPMS state, level and timeouts (as shown by
+    'xset q').  All of it is read in a single round trip to the X server.
+    dpms_available is 0 if the server doesn't have DPMS."""
+    backend = getattr(_snapshot_backends, 'backend', None)
+    if backend is None:
+        backend = _snapshot_backends.backend = XCBBackend()
+    return backend.snapshot()
+
+
+def _learn_run(tracker, change, idle):
+    """Tells a tracker's policy how long an idle run lasted, and how late
+    its end was noticed (the idle time when the user was seen again)."""
+    now = _now(tracker.backend)
+    if change == 'idle':
+        tracker.run_start = now - idle
+    elif change == 'unidle' and tracker.run_start is not None:
+        tracker.policy.observe_return(now - idle - tracker.run_start, idle)
+        tracker.run_start = None
+
+
+def _record_run(tracker, change, idle=0):
+    """Passes a change on to the tracker's RunSketches, if it has any."""
+    if tracker.runs is not None:
+        tracker.runs.update(change, _now(tracker.backend), idle)
+
+
+def _sleep(tracker, wait_time):
+    backend = tracker.backend or _backend
+    if backend is None:
+        sleep(wait_time, tracker.slack)
+    else:
+        backend.sleep(wait_time)
+
+
+class Inhibit:
+    """Keeps the screensaver from activating while it's held:
+
+    >>> with xss.Inhibit():
+    ...     play(video)
+
+    Inhibits are counted across the process (see inhibit()), so they nest
+    and overlap freely: the screensaver is suspended with a single request
+    when the first is taken and resumed when the last is let go.  Raises
+    RuntimeError if the X server can't suspend the screensaver."""
+
+    def __init__(self):
+        self.held = False
+
+    def acquire(self):
+        if not self.held:
+            if inhibit() < 0:
+                raise RuntimeError("Can't suspend the screensaver.")
+            self.held = True
+        return self
+
+    def release(self):
+        if self.held:
+            self.held = False
+            uninhibit()
+
+    __enter__ = acquire
+
+    def __exit__(self, *exc_info):
+        self.release()
+
+    def __del__(self):
+        # an Inhibit dropped while held mustn't keep the screen on for good
+        if self.held and uninhibit is not None:
+            self.release()
+
+
+def _sample(tracker):
+    """The tracker's next sample, or None if the query failed."""
+    try:
+        if tracker.backend is None:
+            tracker.info = get_info()
+        else:
+            tracker.info = tracker.backend.get_info()
+    except RuntimeError:  # XSS can raise a RuntimeError if the
+        # XSS extension cannot be found.
+        return None
+    return tracker.info
+
+
+def _core_setting(name):
+    """A tracker setting kept in its IdleTrackerCore or XSSTrackerCore."""
+    return property(lambda self: getattr(self._core, name),
+                    lambda self, value: setattr(self._core, name, value))
+
+
+# the state machines are libpyxss's (core/pyxss.c), the same ones C and
+# C++ programs use; these classes feed them samples from a backend and add
+# latency stamps, adaptive waits and run sketches
 
 
 class IdleTracker:
@@ -66,18 +210,55 @@ class IdleTracker:
     def __init__(self,
                  when_idle_wait=5000,
                  when_disabled_wait=120000,
-                 idle_threshold=60000):
+                 idle_threshold=60000,
+                 backend=None,
+                 latency=None,
+                 policy=None,
+                 slack=None,
+                 runs=None):
         """when_idle_wait is the interval at which you should poll when
         you are already idle.  when_disabled_wait is how often you should
         poll if information is unavailable (default: 2 minutes).
         idle_threshold is the number of seconds of idle time to constitute
-        being idle."""
-        self.when_idle_wait = when_idle_wait
-        self.idle_threshold = idle_threshold
-        # we start with a bogus last_state.  this way, the first call to
-        # check_idle will report whether we are idle or not.  all subsequent
-        # calls will only tell you if the screensaver state has changed
-        self.last_state = None
+        being idle.  backend is where samples come from (see xss.backend);
+        by default, the same place get_info() reads from.  latency is an
+        optional LatencyLog that every change is stamped in (see
+        xss.latency).  policy is an optional AdaptivePolicy that replaces
+        when_idle_wait with intervals learned from past idle runs (see
+        xss.adaptive).  slack is how late sleep() may wake up, in ms (by
+        default, a tenth of the wait up to a second; see xss.sleep).  runs
+        is an optional RunSketches that the length of every idle and
+        active run goes into."""
+        # the core starts with no state, so the first call to check_idle
+        # will report whether we are idle or not.  all subsequent calls
+        # will only tell you if the state has changed
+        self._core = IdleTrackerCore(idle_threshold, when_idle_wait,
+                                     when_disabled_wait)
+        self.backend = backend
+        self.latency = latency
+        self.policy = policy
+        self.slack = slack
+        self.runs = runs
+        self.run_start = None   # last input before the idle run, if idle
+
+    when_idle_wait = _core_setting('when_idle_wait')
+    when_disabled_wait = _core_setting('when_disabled_wait')
+    idle_threshold = _core_setting('idle_threshold')
+
+    _STATES = {None: 0, 'idle': 1, 'unidle': 2}
+
+    @property
+    def last_state(self):
+        """'idle', 'unidle', or None before the first sample.  Set it to
+        None to have the next check_idle() report the state again, as
+        the first one does."""
+        return {1: 'idle', 2: 'unidle'}.get(self._core.last_state)
+
+    @last_state.setter
+    def last_state(self, value):
+        if value not in self._STATES:
+            raise ValueError("last_state must be 'idle', 'unidle' or None")
+        self._core.last_state = self._STATES[value]
 
     def check_idle(self):
         """Returns a tuple:
@@ -91,32 +272,41 @@ class IdleTracker:
             "disabled" - idle time not available
 
         Note that "disabled" will be returned every time there is an error."""
-        try:
-            self.info = get_info()
-        except RuntimeError:  # XSS can raise a RuntimeError if the
-            # XSS extension cannot be found.
-            return ("disabled", self.when_disabled_wait, 0)
-
-        idle = self.info.idle
-
-        if idle > self.idle_threshold:  # if we meet the threshold for being
-            # idle, we are now idle
-            current_state = 'idle'
-            # we use the standard polling interval
-            wait_time = self.when_idle_wait
-        else:  # otherwise, we are not idle
-            current_state = 'unidle'
-            # wait time is however long it will take for us to go over the
-            # idle threshold
-            wait_time = self.idle_threshold - idle
-
-        # check to see if our new state is actually a change
-        change = None
-        if self.last_state != current_state:
-            change = current_state
-
-        self.last_state = current_state
-        return (change, wait_time, self.info.idle)
+        info = _sample(self)
+        if info is None:
+            _record_run(self, "disabled")
+            return (self._core.failed(), self._core.wait, 0)
+
+        first = self.last_state is None
+        idle = info.idle
+        # in whole ms, as the X server reports them
+        change = self._core.update(int(idle), info.state,
+                                   int(info.til_or_since))
+        wait_time = self._core.wait
+        # while idle, the policy may think the user won't be back soon
+        if self.policy is not None and self.last_state == 'idle':
+            wait_time = self.policy.idle_wait(idle)
+
+        if change is not None:
+            # the first report isn't a change anybody waited for
+            if self.latency is not None and not first:
+                now = _now(self.backend)
+                input_time = now - idle
+                due = input_time
+                if change == 'idle':
+                    due += self.idle_threshold
+                self.latency.record('poll', change, input_time, due, now,
+                                    now)
+            if self.policy is not None:
+                _learn_run(self, change, idle)
+            _record_run(self, change, idle)
+        return (change, wait_time, idle)
+
+    def sleep(self, wait_time):
+        """Waits wait_time ms (as suggested by check_idle()) on the
+        backend's clock.  On the X server's, the wakeup is shared with
+        other timers in the process where the slack allows."""
+        _sleep(self, wait_time)
 
 
 class XSSTracker:
@@ -125,7 +315,9 @@ class XSSTracker:
     in milliseconds.  XSSTracker indicates a change in state when your
     screensaver activates.  See also IdleTracker."""
 
-    def __init__(self, when_idle_wait=5000, when_disabled_wait=120000):
+    def __init__(self, when_idle_wait=5000, when_disabled_wait=120000,
+                 backend=None, latency=None, policy=None, slack=None,
+                 runs=None):
         """when_idle_wait is the interval at which you should poll when
         you are already idle.  when_disabled_wait is how often you should
         poll if the screensaver is disabled and you are using XSS for
@@ -134,14 +326,41 @@ class XSSTracker:
         If you set idle_threshold to 'xss', it will say that your
         threshold for becoming idle is whenever the screensaver activates.
         If you don't use the XScreenSaver extension or otherwise want
-        a different idle threshold, you can specify it in milliseconds."""
-        self.when_idle_wait = when_idle_wait
-        self.when_disabled_wait = when_disabled_wait
-        # we start by assuming the screen saver is disabled.  this way, the
-        # first call to check_idle will report whether the screensaver is
-        # active.  all subsequent calls will only tell you if the screensaver
-        # state has changed
-        self.last_state = xss.ScreenSaverDisabled
+        a different idle threshold, you can specify it in milliseconds.
+
+        backend is where samples come from (see xss.backend); by default,
+        the same place get_info() reads from.  latency is an optional
+        LatencyLog that every change is stamped in (see xss.latency).
+        policy is an optional AdaptivePolicy that replaces when_idle_wait
+        while the screensaver is on (see xss.adaptive).  slack is how late
+        sleep() may wake up, in ms (see xss.sleep).  runs is an optional
+        RunSketches, as for IdleTracker."""
+        # the core starts out assuming the screen saver is disabled.  this
+        # way, the first call to check_idle will report whether the
+        # screensaver is active.  all subsequent calls will only tell you
+        # if the screensaver state has changed
+        self._core = XSSTrackerCore(when_idle_wait, when_disabled_wait)
+        self.backend = backend
+        self.latency = latency
+        self.policy = policy
+        self.slack = slack
+        self.runs = runs
+        self.run_start = None
+
+    when_idle_wait = _core_setting('when_idle_wait')
+    when_disabled_wait = _core_setting('when_disabled_wait')
+
+    @property
+    def last_state(self):
+        """The screensaver state of the last sample (ScreenSaverDisabled
+        before the first).  Set it to ScreenSaverDisabled, or None, to have
+        the next check_idle() report the state again."""
+        return self._core.last_state
+
+    @last_state.setter
+    def last_state(self, value):
+        self._core.last_state = ScreenSaverDisabled if value is None \
+            else int(value)
 
     def check_idle(self):
         """Returns a tuple:
@@ -156,47 +375,48 @@ class XSSTracker:
 
         Note that if the screensaver is disabled, it will return "disabled"
         every time."""
-        try:
-            self.info = get_info()
-        except RuntimeError:  # XSS can raise a RuntimeError if the
-            # XSS extension cannot be found.
-            return ("disabled", self.when_disabled_wait, 0)
-
-        state = self.info.state
-
-        # if we're disabled, we tell them that. the polling interval for
-        # disabledness is when_disabled_wait, which defaults to 2 minutes.
-        if state == ScreenSaverDisabled:
-            self.last_state = state
-            return ("disabled", self.when_disabled_wait, 0)
-
-        # wait_time is how long they should wait before polling again.
-        if state == ScreenSaverOff:
-            # if the screen saver is off, til_or_since will tell us
-            # how long it will take to be activated (whether it will
-            # be activated depends on whether the user is idle for that
-            # period of time)
-            wait_time = self.info.til_or_since
-        else:
-            # otherwise, the screensaver is on.  we don't when we will
-            # become unidle, but the when_idle_wait tells us the poll
-            # interval (default is 5 seconds)
-            wait_time = self.when_idle_wait
-
-        # change is whether or not we have changed.  if we have, we use
-        # a string to describe the change
-        if state != self.last_state:
-            if state == ScreenSaverOff:  # if we've changed from On to Off
-                # they're not idle anymore
-                change = 'unidle'
-            else:
-                change = 'idle'  # if we've changed from Off to On, they've gone
-                # idle
-        else:  # otherwise, they haven't changed state
-            change = None
-
-        self.last_state = state
-        return (change, wait_time, self.info.idle)
+        info = _sample(self)
+        if info is None:
+            _record_run(self, "disabled")
+            return (self._core.failed(), self._core.wait, 0)
+
+        last_state = self.last_state
+        change = self._core.update(int(info.idle), info.state,
+                                   int(info.til_or_since))
+        wait_time = self._core.wait
+
+        # if we're disabled, we tell them that, every time
+        if change == 'disabled':
+            if last_state != ScreenSaverDisabled:
+                _record_run(self, "disabled")
+            return (change, wait_time, 0)
+
+        # while the screensaver is on, the policy may think the user won't
+        # be back soon
+        if self.policy is not None and info.state != ScreenSaverOff:
+            wait_time = self.policy.idle_wait(info.idle)
+
+        if change is not None:
+            # coming out of "disabled" isn't a change anybody waited for
+            if self.latency is not None and \
+                    last_state != ScreenSaverDisabled:
+                now = _now(self.backend)
+                input_time = now - info.idle
+                if change == 'idle':   # when the screensaver came on
+                    due = now - info.til_or_since
+                else:
+                    due = input_time
+                self.latency.record('poll', change, input_time, due, now,
+                                    now)
+            if self.policy is not None:
+                _learn_run(self, change, info.idle)
+            _record_run(self, change, info.idle)
+        return (change, wait_time, info.idle)
+
+    def sleep(self, wait_time):
+        """Waits wait_time ms (as suggested by check_idle()); see
+        IdleTracker.sleep()."""
+        _sleep(self, wait_time)
 
 
 if __name__ == "__main__":
@@ -207,6 +427,6 @@ if __name__ == "__main__":
         info = i.check_idle()
         print(time.asctime(), info, end=' ')
         # don't poll more often than 2 seconds
-        wait_time = max(info[1] / 1000, 2)
-        print("wait:", wait_time)
-        time.sleep(wait_time)
+        wait_time = max(info[1], 2000)
+        print("wait:", wait_time / 1000)
+        i.sleep(wait_time)
@@ -0,0 +1,177 @@
+"""Adaptive polling, for when the X server can't send events.
+
+While the user is active, the trackers already know exactly when to poll
+next: not before idle time can reach the threshold.  While the user is
+away, though, any moment could be the one they come back, and a fixed
+when_idle_wait polls every few seconds for as long as they are gone.
+
+AdaptivePolicy learns how long this seat's idle runs last (a run starts
+with the last input before going idle and ends with the input that ends
+it), separately for every hour of the day, and spaces the polls during a
+run by how likely the user is to come back soon:
+
+>>> policy = xss.AdaptivePolicy(latency_target=5000, miss_budget=0.05)
+>>> tracker = xss.IdleTracker(idle_threshold=60000, policy=policy)
+
+latency_target is how quickly a return should be noticed, in ms, and
+miss_budget is the fraction of returns allowed to take longer.  A poll
+interval of latency_target or less can't miss; a longer one misses a
+return that falls in its first (interval - latency_target) ms, so an
+interval is only used if the chance of the user coming back then, given
+how long they have already been away, is below an allowance.  The
+allowance itself is steered by the misses that actually happen (a
+poller knows exactly: its idle time when it sees the user again is the
+detection latency), so the budget holds even when the learned model is
+off.
+
+Models can be saved with to_dict() and loaded with from_dict()."""
+
+import bisect
+import math
+import time
+
+# edges of the run-length bins, in ms: 1 s to about 6 days in 25% steps
+EDGES = [1000.0 * 1.25 ** k for k in range(60)]
+
+
+class RunLengthModel:
+    """Histograms of idle-run lengths, one per hour of the day (by when
+    the run started) and one overall, slowly forgetting old runs."""
+
+    def __init__(self, decay=0.99, hour_weight=5.0, prior_weight=1.0):
+        """Every new run multiplies the older counts by decay.  An hour's
+        histogram is topped up with hour_weight runs' worth of the overall
+        one, and everything with prior_weight runs spread evenly over the
+        (logarithmic) bins, so that a new seat starts out cautious."""
+        self.decay = decay
+        self.hour_weight = hour_weight
+        self.prior_weight = prior_weight
+        self.hours = [[0.0] * len(EDGES) for _ in range(24)]
+        self.overall = [0.0] * len(EDGES)
+        self.runs = 0
+
+    def observe(self, length, hour):
+        i = min(bisect.bisect_left(EDGES, length), len(EDGES) - 1)
+        for counts in (self.hours[hour], self.overall):
+            for j in range(len(counts)):
+                counts[j] *= self.decay
+            counts[i] += 1.0
+        self.runs += 1
+
+    def _counts(self, hour):
+        hour_counts = self.hours[hour]
+        total = sum(self.overall)
+        share = self.hour_weight / total if total else 0.0
+        prior = self.prior_weight / len(EDGES)
+        return [h + share * o + prior
+                for h, o in zip(hour_counts, self.overall)]
+
+    def survival(self, t, hour, counts=None):
+        """P(a run started in hour lasts longer than t ms)."""
+        if counts is None:
+            counts = self._counts(hour)
+        total = sum(counts)
+        i = bisect.bisect_left(EDGES, t)
+        if i >= len(EDGES):
+            return counts[-1] / total * 0.5
+        above = sum(counts[i + 1:])
+        # spread bin i evenly over its (logarithmic) width
+        low = EDGES[i - 1] if i else EDGES[0] / 1.25
+        inside = math.log(EDGES[i] / max(t, low)) / math.log(EDGES[i] / low)
+        return (above + counts[i] * min(max(inside, 0.0), 1.0)) / total
+
+    def hazard(self, t, dt, hour, counts=None):
+        """P(a run that has lasted t ms ends within the next dt ms)."""
+        if counts is None:
+            counts = self._counts(hour)
+        now = self.survival(t, hour, counts)
+        if now <= 0:
+            return 1.0
+        return 1.0 - self.survival(t + dt, hour, counts) / now
+
+    def to_dict(self):
+        return {"decay": self.decay, "hour_weight": self.hour_weight,
+                "prior_weight": self.prior_weight, "hours": self.hours,
+                "overall": self.overall, "runs": self.runs}
+
+    @classmethod
+    def from_dict(cls, state):
+        model = cls(state["decay"], state["hour_weight"],
+                    state["prior_weight"])
+        model.hours = [list(counts) for counts in state["hours"]]
+        model.overall = list(state["overall"])
+        model.runs = state["runs"]
+        return model
+
+
+class AdaptivePolicy:
+    """Chooses poll intervals while the user is idle (see the module
+    docstring).  Times are in ms; clock returns wall-clock seconds (used
+    for the hour of the day only) and can be replaced when replaying."""
+
+    def __init__(self, latency_target=5000, miss_budget=0.05, min_wait=None,
+                 max_wait=3600000, model=None, clock=time.time, gain=0.5):
+        self.latency_target = latency_target
+        self.miss_budget = miss_budget
+        self.min_wait = latency_target if min_wait is None else min_wait
+        self.max_wait = max_wait
+        self.model = model or RunLengthModel()
+        self.clock = clock
+        self.gain = gain
+        self.allowance = miss_budget
+        self.returns = 0
+        self.misses = 0
+
+    def hour(self, idle):
+        """The hour of the day the current idle run started in."""
+        return time.localtime(self.clock() - idle / 1000.0).tm_hour
+
+    def idle_wait(self, idle):
+        """How long to wait before the next poll, for a user who has been
+        idle for idle ms."""
+        target = self.latency_target
+        hour = self.hour(idle)
+        counts = self.model._counts(hour)
+        wait = max(self.min_wait, 1)
+        candidate = max(wait, target)
+        while candidate <= self.max_wait:
+            # returns in the first (candidate - target) ms would be late
+            late = self.model.hazard(idle, candidate - target, hour, counts)
+            if late > self.allowance:
+                break
+            wait = candidate
+            candidate *= 1.25
+        return int(min(wait, self.max_wait))
+
+    def observe_return(self, run, latency):
+        """Learns from a finished idle run: run is how long it lasted and
+        latency how long after it ended the return was noticed, both in
+        ms."""
+        self.model.observe(run, self.hour(latency + run))
+        self.returns += 1
+        missed = latency > self.latency_target
+        self.misses += missed
+        # integral control: the allowance settles where misses come in at
+        # miss_budget
+        step = self.miss_budget - (1.0 if missed else 0.0)
+        self.allowance *= math.exp(self.gain * step)
+        self.allowance = min(max(self.allowance, 1e-5), 0.5)
+
+    def miss_rate(self):
+        return self.misses / self.returns if self.returns else 0.0
+
+    def to_dict(self):
+        return {"latency_target": self.latency_target,
+                "miss_budget": self.miss_budget,
+                "allowance": self.allowance, "returns": self.returns,
+                "misses": self.misses, "model": self.model.to_dict()}
+
+    @classmethod
+    def from_dict(cls, state, **kwargs):
+        policy = cls(state["latency_target"], state["miss_budget"],
+                     model=RunLengthModel.from_dict(state["model"]),
+                     **kwargs)
+        policy.allowance = state["allowance"]
+        policy.returns = state["returns"]
+        policy.misses = state["misses"]
+        return policy
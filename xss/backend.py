@@ -0,0 +1,299 @@
+"""Sources of XScreenSaverInfo samples.
+
+xss.get_info() and the trackers read their samples from a backend.  By
+default that is the live X server, but a backend can be swapped in with
+xss.use_backend() (or passed to a tracker directly) so that tracker logic
+can be tested and benchmarked without an X server:
+
+>>> import xss
+>>> rec = xss.Recorder(open('session.rec', 'w'))
+>>> rec.get_info().idle     # queries X and writes the sample down
+10
+>>> replay = xss.ReplayBackend(xss.load_recording(open('session.rec')))
+>>> tracker = xss.IdleTracker(idle_threshold=5000, backend=replay)
+
+Every backend has three methods: get_info(), which returns an object with
+the XScreenSaverInfo attributes (or raises RuntimeError when the extension
+is unavailable), now(), which is the backend's clock in milliseconds, and
+sleep(ms), which waits on that clock.  Replay backends run on a virtual
+clock, so sleep() can be made to return immediately.  The X backends sleep
+with sleep() below, so their wakeups line up with the rest of the
+process."""
+
+import bisect
+import threading
+import time
+
+from .xss import get_info as _x_get_info
+from .xss import XCBEngine, WakeTimer, EvdevMonitor
+from .xss import ScreenSaverOff, ScreenSaverOn, ScreenSaverDisabled
+
+RECORDING_HEADER = "# pyxss recording v1"
+
+
+_timers = threading.local()
+
+
+def sleep(ms, slack=None):
+    """Sleeps for at least ms milliseconds and at most slack more, waking
+    up together with other timers in the process where it can (see
+    WakeTimer).  The default slack is a tenth of ms, up to a second.
+    Returns how long it meant to sleep, in ms."""
+    timer = getattr(_timers, 'timer', None)
+    if timer is None:
+        timer = _timers.timer = WakeTimer()
+    delay = timer.arm(int(ms), -1 if slack is None else int(slack))
+    if delay < 0:   # no timer after all; sleep the plain way
+        time.sleep(ms / 1000.0)
+        return ms
+    while timer.wait() < 0:     # a signal came in and its handler returned
+        pass
+    return delay
+
+
+class ReplayFinished(EOFError):
+    """Raised by ReplayBackend.get_info() once the virtual clock has run
+    past the last recorded sample."""
+
+
+class RecordedInfo:
+    """A sample with the same attributes as xss.XScreenSaverInfo, plus the
+    timestamp (in milliseconds) at which it was taken.  A recorded sample
+    with error set stands for a failed query."""
+
+    __slots__ = ('timestamp', 'window', 'state', 'kind', 'til_or_since',
+                 'idle', 'eventMask', 'error')
+
+    def __init__(self, timestamp, state=0, kind=0, til_or_since=0, idle=0,
+                 error=False):
+        self.timestamp = timestamp
+        self.window = 0
+        self.state = state
+        self.kind = kind
+        self.til_or_since = til_or_since
+        self.idle = idle
+        self.eventMask = 0
+        self.error = error
+
+    def __repr__(self):
+        if self.error:
+            return "<RecordedInfo t=%d error>" % self.timestamp
+        return "<RecordedInfo t=%d state=%d kind=%d til_or_since=%d " \
+               "idle=%d>" % (self.timestamp, self.state, self.kind,
+                             self.til_or_since, self.idle)
+
+
+class XBackend:
+    """Queries the X server the module is connected to.  now() is the
+    monotonic clock, and sleep() may wake up to slack ms late (see
+    sleep())."""
+
+    slack = None
+
+    def get_info(self):
+        return _x_get_info()
+
+    def now(self):
+        return int(time.monotonic() * 1000)
+
+    def sleep(self, ms):
+        sleep(ms, self.slack)
+
+
+class XCBBackend(XBackend):
+    """Queries through an XCBEngine instead of Xlib.  get_info() costs the
+    same single round trip; the engine itself is available as .engine for
+    pipelining queries to more screens and displays (see add_display(),
+    submit(), poll() and result())."""
+
+    def __init__(self, display=None):
+        self.engine = XCBEngine()
+        self.engine.add_display(display)
+
+    def get_info(self):
+        return self.engine.query(0)
+
+    def snapshot(self):
+        """Returns a PowerSnapshot: screensaver info, screensaver settings
+        and DPMS state, all from a single round trip."""
+        return self.engine.snapshot(0)
+
+
+class EvdevBackend(XBackend):
+    """Idle time from the kernel's input devices instead of the X server,
+    for seats without one.  devices lists the paths to read: event nodes,
+    or FIFOs carrying struct input_event records (see test/evdev1.py).  By
+    default every /dev/input/event* is read, including devices plugged in
+    later.  get_info() raises RuntimeError while none can be read.
+
+    There is no screensaver, so state is ScreenSaverDisabled, unless
+    saver_timeout (ms) is given: then the backend reports a screensaver
+    that comes on once idle time reaches it, and XSSTracker works too.
+    The monitor itself is available as .monitor."""
+
+    def __init__(self, devices=None, saver_timeout=None):
+        self.monitor = EvdevMonitor()
+        if devices is None:
+            self.monitor.add_all()
+        else:
+            for path in devices:
+                self.monitor.add_device(path)
+        self.saver_timeout = saver_timeout
+
+    def get_info(self):
+        self.monitor.pump()
+        if not self.monitor.present():
+            raise RuntimeError("No input devices can be read.")
+        idle = self.monitor.idle()
+        timeout = self.saver_timeout
+        if timeout is None:
+            return RecordedInfo(self.now(), ScreenSaverDisabled, 0, 0, idle)
+        if idle >= timeout:
+            return RecordedInfo(self.now(), ScreenSaverOn, 0, idle - timeout,
+                                idle)
+        return RecordedInfo(self.now(), ScreenSaverOff, 0, timeout - idle,
+                            idle)
+
+
+class Recorder:
+    """Passes get_info() through to another backend (the X server by
+    default) and writes every sample, timestamped with that backend's
+    clock, to a text file.  Failed queries are recorded too, so they
+    replay as RuntimeErrors."""
+
+    def __init__(self, file, backend=None):
+        self.file = file
+        self.backend = backend or XBackend()
+        self.file.write(RECORDING_HEADER + "\n")
+        self.file.write("# timestamp state kind til_or_since idle\n")
+
+    def get_info(self):
+        now = self.backend.now()
+        try:
+            info = self.backend.get_info()
+        except RuntimeError:
+            self.file.write("%d error\n" % now)
+            raise
+        self.file.write("%d %d %d %d %d\n" % (now, info.state, info.kind,
+                                              info.til_or_since, info.idle))
+        return info
+
+    def now(self):
+        return self.backend.now()
+
+    def sleep(self, ms):
+        self.backend.sleep(ms)
+
+    def close(self):
+        self.file.close()
+
+
+def load_recording(file):
+    """Reads a file written by Recorder and returns its samples as a list
+    of RecordedInfo objects, sorted by timestamp."""
+    samples = []
+    for lineno, line in enumerate(file, 1):
+        line = line.strip()
+        if not line or line.startswith('#'):
+            continue
+        fields = line.split()
+        try:
+            # "<timestamp> error", or all five fields of a sample
+            if len(fields) == 2 and fields[1] == 'error':
+                samples.append(RecordedInfo(int(fields[0]), error=True))
+            elif len(fields) == 5:
+                samples.append(RecordedInfo(*[int(f) for f in fields]))
+            else:
+                raise ValueError
+        except ValueError:
+            raise ValueError("bad sample on line %d: %r" % (lineno, line))
+    samples.sort(key=lambda s: s.timestamp)
+    return samples
+
+
+class ReplayBackend:
+    """Feeds recorded samples back on a virtual clock.  The clock starts at
+    the first sample's timestamp and only moves when sleep() or advance()
+    is called, so a replay is fully deterministic.
+
+    speed is how much faster than real time sleep() runs: 1.0 sleeps for
+    real, 10.0 sleeps a tenth of the time, and None (the default) does not
+    sleep at all.
+
+    Between samples, idle is extrapolated from the last input time each
+    sample implies (timestamp - idle), so a poll that lands between two
+    samples sees the same idle time the X server would have reported.
+    Screensaver state changes take effect at the recorded sample, with
+    til_or_since counted down (or up, while the saver is on) in between."""
+
+    def __init__(self, samples, speed=None):
+        if not samples:
+            raise ValueError("cannot replay an empty recording")
+        self.samples = samples
+        self.timestamps = [s.timestamp for s in samples]
+        self.speed = speed
+        self.clock = samples[0].timestamp
+        self.cursor = 0
+        self.queries = 0
+
+    def now(self):
+        return self.clock
+
+    def advance(self, ms):
+        """Moves the virtual clock forward without sleeping."""
+        self.clock += ms
+
+    def sleep(self, ms):
+        if self.speed:
+            time.sleep(ms / 1000.0 / self.speed)
+        self.clock += ms
+
+    def rewind(self):
+        """Starts the replay over from the first sample."""
+        self.clock = self.samples[0].timestamp
+        self.cursor = 0
+
+    def get_info(self):
+        now = self.clock
+        samples = self.samples
+        last = len(samples) - 1
+        if now > samples[last].timestamp:
+            raise ReplayFinished("replay ended at %d" %
+                                 samples[last].timestamp)
+
+        # the clock almost always moves forward by less than a sample or
+        # two, so walk the cursor and only bisect on a big jump or rewind
+        i = self.cursor
+        if samples[i].timestamp > now or \
+           (i + 8 <= last and samples[i + 8].timestamp <= now):
+            i = max(bisect.bisect_right(self.timestamps, now) - 1, 0)
+        else:
+            while i < last and samples[i + 1].timestamp <= now:
+                i += 1
+        self.cursor = i
+        self.queries += 1
+
+        sample = samples[i]
+        if sample.error:
+            raise RuntimeError("Couldn't query screensaver extension.")
+
+        dt = now - sample.timestamp
+        if dt <= 0:
+            return sample
+
+        idle = sample.idle + dt
+        if i < last:
+            following = samples[i + 1]
+            if not following.error:
+                last_input = following.timestamp - following.idle
+                if last_input <= now:
+                    idle = now - last_input
+
+        til_or_since = sample.til_or_since
+        if sample.state == ScreenSaverOff:     # counting down
+            til_or_since = max(til_or_since - dt, 0)
+        elif sample.state == ScreenSaverOn:    # counting up
+            til_or_since += dt
+
+        return RecordedInfo(now, sample.state, sample.kind, til_or_since,
+                            idle)
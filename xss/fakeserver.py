@@ -0,0 +1,1169 @@
+"""A stand-in X server that speaks just enough of the protocol for this module:
+the connection setup, the handful of core requests Xlib sends on its own,
+MIT-SCREEN-SAVER, DPMS, the parts of SYNC that deal with the IDLETIME counter
+and enough of XInput2 to select raw input events.  It lets the real client code
+(Xlib, libXss, the xss module itself) be tested against scripted idle
+timelines, and lets one process stand in for thousands of displays:
+
+    python -m xss.fakeserver -n 1000 --base 4000 --random 7 --latency 2
+
+serves displays :4000 through :4999, each with its own random activity
+pattern and 2ms of latency on every reply.  From Python:
+
+>>> from xss.fakeserver import FakeXServer, Timeline
+>>> server = FakeXServer()
+>>> display = server.add_display(timeline=Timeline(idle=5000))
+>>> server.start()
+>>> os.environ['DISPLAY'] = display.name
+>>> display.input()                 # pretend the user pressed a key
+
+Each display has a Timeline of when its user was active, screensaver
+settings (which clients may change with SetScreenSaver, ForceScreenSaver
+and ScreenSaverSuspend), and knobs for injected latency, jitter, errors
+and dropped connections.  Screensaver state is derived from the idle time
+the same way the X server does it, ScreenSaverNotify events are sent to
+clients that select them, and SYNC alarms on IDLETIME fire on positive
+and negative transitions.
+
+Nothing is drawn and there is no input: requests outside that subset get
+a BadRequest error.  Unix sockets are created in /tmp/.X11-unix, so pick
+display numbers no real X server uses."""
+
+import asyncio
+import bisect
+import errno
+import os
+import random
+import socket
+import struct
+import sys
+import threading
+
+SOCKET_DIR = "/tmp/.X11-unix"
+ROOT_WINDOW = 0x000001e0
+DEFAULT_COLORMAP = 0x00000020
+ROOT_VISUAL = 0x00000021
+IDLETIME_COUNTER = 0x00000040
+RESOURCE_ID_BASE = 0x00200000
+RESOURCE_ID_MASK = 0x001fffff
+
+# core request opcodes
+X_CreateWindow = 1
+X_ChangeWindowAttributes = 2
+X_DestroyWindow = 4
+X_InternAtom = 16
+X_GetAtomName = 17
+X_ChangeProperty = 18
+X_GetProperty = 20
+X_GetInputFocus = 43
+X_CreateGC = 55
+X_ChangeGC = 56
+X_FreeGC = 60
+X_QueryExtension = 98
+X_ListExtensions = 99
+X_SetScreenSaver = 107
+X_GetScreenSaver = 108
+X_ForceScreenSaver = 115
+X_NoOperation = 127
+
+# requests that need no reply and that we can safely ignore: Xlib creates
+# a GC for every screen when it opens the display
+IGNORED_REQUESTS = (X_CreateGC, X_ChangeGC, X_FreeGC, X_NoOperation)
+
+# core events, and the bits of window attributes we look at: clients that
+# need a server timestamp change a property on a window of their own and
+# wait for the PropertyNotify
+PropertyNotify = 28
+CWEventMask = 1 << 11
+PropertyChangeMask = 1 << 22
+
+# core errors
+BadRequest = 1
+BadValue = 2
+BadWindow = 3
+BadAtom = 5
+BadMatch = 8
+BadLength = 16
+BadImplementation = 17
+
+# extension name: (major opcode, first event, first error)
+EXTENSIONS = {
+    "MIT-SCREEN-SAVER": (128, 64, 0),
+    "SYNC": (129, 65, 128),
+    "DPMS": (130, 0, 0),
+    "XInputExtension": (131, 67, 131),
+}
+
+# MIT-SCREEN-SAVER minor opcodes
+X_ScreenSaverQueryVersion = 0
+X_ScreenSaverQueryInfo = 1
+X_ScreenSaverSelectInput = 2
+X_ScreenSaverSuspend = 5
+
+ScreenSaverOff = 0
+ScreenSaverOn = 1
+ScreenSaverDisabled = 3
+ScreenSaverBlanked = 0
+ScreenSaverInternal = 1
+ScreenSaverNotifyMask = 1
+
+# SYNC minor opcodes
+X_SyncInitialize = 0
+X_SyncListSystemCounters = 1
+X_SyncQueryCounter = 5
+X_SyncCreateAlarm = 8
+X_SyncChangeAlarm = 9
+X_SyncQueryAlarm = 10
+X_SyncDestroyAlarm = 11
+
+XSyncBadCounter = 0
+XSyncBadAlarm = 1
+XSyncAlarmNotify = 1
+XSyncCACounter = 1 << 0
+XSyncCAValueType = 1 << 1
+XSyncCAValue = 1 << 2
+XSyncCATestType = 1 << 3
+XSyncCADelta = 1 << 4
+XSyncCAEvents = 1 << 5
+XSyncAbsolute = 0
+XSyncRelative = 1
+XSyncPositiveTransition = 0
+XSyncNegativeTransition = 1
+XSyncPositiveComparison = 2
+XSyncNegativeComparison = 3
+XSyncAlarmActive = 0
+XSyncAlarmInactive = 1
+XSyncAlarmDestroyed = 2
+
+# DPMS minor opcodes
+X_DPMSGetVersion = 0
+X_DPMSCapable = 1
+X_DPMSGetTimeouts = 2
+X_DPMSSetTimeouts = 3
+X_DPMSEnable = 4
+X_DPMSDisable = 5
+X_DPMSForceLevel = 6
+X_DPMSInfo = 7
+
+DPMSModeOn = 0
+DPMSModeOff = 3
+
+# XInputExtension minor opcodes
+X_GetExtensionVersion = 1
+X_XISelectEvents = 46
+X_XIQueryVersion = 47
+X_XIQueryDevice = 48
+
+GenericEvent = 35
+XIAllDevices = 0
+XIAllMasterDevices = 1
+XI_RawKeyPress = 13
+XI_RawMotion = 17
+XI_RawTouchBegin = 22
+
+# deviceid: (name, use, attachment, classes); classes are wire-encoded
+# after the device's sourceid is filled in
+XI_DEVICES = {
+    2: ("Virtual core pointer", 1, 3, ('button',)),
+    3: ("Virtual core keyboard", 2, 2, ('key',)),
+    6: ("fake keyboard", 4, 3, ('key',)),
+    7: ("fake mouse", 3, 2, ('button',)),
+    8: ("fake touchscreen", 3, 2, ('button', 'touch')),
+}
+
+# what each kind of fake input looks like as a raw event:
+# (evtype, deviceid, sourceid)
+XI_RAW_EVENTS = {
+    'keyboard': (XI_RawKeyPress, 3, 6),
+    'pointer': (XI_RawMotion, 2, 7),
+    'touch': (XI_RawTouchBegin, 2, 8),
+}
+
+# atoms 1 through 68 are predefined by the core protocol
+FIRST_ATOM = 69
+
+
+def pad4(data):
+    return data + b'\0' * (-len(data) % 4)
+
+
+class Timeline:
+    """When the user of a fake display was active.  Times are milliseconds
+    since the server started.  Activity is a list of (start, end)
+    stretches of continuous input; a single key press is a stretch with
+    start == end.  idle is how long the user had been idle when the
+    server started."""
+
+    def __init__(self, idle=0, active=()):
+        self.initial_input = -idle
+        self.starts = []
+        self.ends = []
+        self.quiet = []   # quiet[i] = max(ends[:i+1]): when input stops
+        for start, end in sorted(active):
+            self.starts.append(start)
+            self.ends.append(max(start, end))
+        self._rebuild()
+
+    @classmethod
+    def from_dict(cls, script):
+        """Builds a timeline from a dictionary (typically loaded from
+        JSON) with any of the keys "idle", "active" (a list of [start,
+        end] pairs) and "input" (a list of key press times)."""
+        active = [tuple(pair) for pair in script.get("active", ())]
+        active += [(t, t) for t in script.get("input", ())]
+        return cls(script.get("idle", 0), active)
+
+    @classmethod
+    def random(cls, seed=None, duration=86400000, active=(1000, 120000),
+               mean_idle=90000):
+        """A user who alternates stretches of activity (uniformly between
+        active[0] and active[1] ms long) with idle stretches (exponentially
+        distributed around mean_idle ms) for duration ms."""
+        rng = random.Random(seed)
+        stretches = []
+        t = rng.uniform(0, mean_idle)
+        while t < duration:
+            length = rng.uniform(*active)
+            stretches.append((int(t), int(t + length)))
+            t += length + rng.expovariate(1.0 / mean_idle)
+        return cls(int(rng.uniform(0, mean_idle)), stretches)
+
+    def _rebuild(self):
+        self.quiet = []
+        latest = self.initial_input
+        for end in self.ends:
+            latest = max(latest, end)
+            self.quiet.append(latest)
+
+    def input(self, start, end=None):
+        """Adds a stretch of activity (or a single key press)."""
+        if end is None or end < start:
+            end = start
+        i = bisect.bisect_right(self.starts, start)
+        self.starts.insert(i, start)
+        self.ends.insert(i, end)
+        if i == len(self.starts) - 1:
+            previous = self.quiet[-1] if self.quiet else self.initial_input
+            self.quiet.append(max(previous, end))
+        else:
+            self._rebuild()
+
+    def quiet_from(self, now):
+        """When input stops (or stopped), as far as is known at now."""
+        i = bisect.bisect_right(self.starts, now) - 1
+        if i < 0:
+            return self.initial_input
+        return self.quiet[i]
+
+    def idle(self, now):
+        return max(now - self.quiet_from(now), 0)
+
+    def next_input(self, now):
+        """When the next stretch of activity after now starts, or None."""
+        i = bisect.bisect_right(self.starts, now)
+        if i < len(self.starts):
+            return self.starts[i]
+        return None
+
+
+class Alarm:
+    __slots__ = ('id', 'client', 'counter', 'value_type', 'value', 'test',
+                 'delta', 'events', 'state')
+
+    def __init__(self, id, client):
+        self.id = id
+        self.client = client
+        self.counter = 0
+        self.value_type = XSyncAbsolute
+        self.value = 0
+        self.test = XSyncPositiveComparison
+        self.delta = 1
+        self.events = True
+        self.state = XSyncAlarmActive
+
+    def triggered(self, previous, current):
+        if self.test == XSyncPositiveTransition:
+            return previous < self.value <= current
+        if self.test == XSyncNegativeTransition:
+            return previous > self.value >= current
+        if self.test == XSyncPositiveComparison:
+            return current >= self.value
+        return current <= self.value
+
+    def next_positive(self, quiet_from):
+        """When an idle alarm that waits for idle to grow will fire, if
+        no more input arrives."""
+        if self.test in (XSyncPositiveTransition, XSyncPositiveComparison):
+            return quiet_from + self.value
+        return None
+
+
+class FakeDisplay:
+    """One display served by a FakeXServer.  The attributes can be changed
+    at any time: latency and jitter are in milliseconds, error_rate is the
+    probability that an extension request gets a BadImplementation error
+    instead of its reply, and drop_after closes each connection after that
+    many requests.  missing lists extensions to pretend not to have."""
+
+    def __init__(self, server, number, timeline=None, timeout=600000,
+                 interval=600000, dpms_timeouts=(600, 600, 600), latency=0,
+                 jitter=0, error_rate=0.0, drop_after=None, missing=()):
+        self.server = server
+        self.number = number
+        self.name = ":%d" % number
+        self.timeline = timeline or Timeline()
+        self.timeout = timeout
+        self.interval = interval
+        self.prefer_blanking = 1
+        self.allow_exposures = 1
+        self.dpms_enabled = True
+        self.dpms_timeouts = tuple(dpms_timeouts)   # standby, suspend, off
+        self.dpms_forced = None                     # (level, since)
+        self.latency = latency
+        self.jitter = jitter
+        self.error_rate = error_rate
+        self.drop_after = drop_after
+        self.missing = set(missing)
+        self.rng = random.Random(number)
+        self.clients = set()
+        self.alarms = {}
+        self.forced_at = None
+        self.last_state = None
+        self.last_idle = 0
+        self.last_evaluated = 0
+        self.requests = 0
+        self.queries = 0            # QueryInfo requests answered
+        self.watcher = None
+        self.wakeup = None
+        self.listeners = []
+        self.lock_path = None       # set while this process holds them
+        self.socket_path = None
+
+    # -- state ---------------------------------------------------------
+
+    def now(self):
+        return self.server.now()
+
+    def input(self, duration=0, device='keyboard'):
+        """Simulates user input starting now and lasting duration ms.
+        device is 'keyboard', 'pointer' or 'touch': it decides which XInput2
+        raw event clients see.  Safe to call from any thread."""
+        def add():
+            now = self.now()
+            self.timeline.input(now, now + duration)
+            self.raw_event(device, now)
+            self.last_evaluated = now
+            self.poke()
+        self.server.call(add)
+
+    def raw_event(self, device, now):
+        evtype, deviceid, sourceid = XI_RAW_EVENTS[device]
+        for client in self.clients:
+            if evtype in client.raw_events:
+                client.send_event(struct.pack(
+                    client.e + 'BBHIHHIIHHII', GenericEvent,
+                    EXTENSIONS["XInputExtension"][0], 0, 0, evtype,
+                    deviceid, now & 0xffffffff, 0, sourceid, 0, 0, 0))
+
+    def suspended(self):
+        return any(client.suspend for client in self.clients)
+
+    def saver_info(self, now=None):
+        """Returns (state, kind, til_or_since, idle) as QueryInfo would."""
+        if now is None:
+            now = self.now()
+        idle = self.timeline.idle(now)
+        kind = ScreenSaverBlanked if self.prefer_blanking \
+            else ScreenSaverInternal
+        if self.forced_at is not None:
+            following = self.timeline.next_input(self.forced_at)
+            if following is not None and following <= now:
+                # any input turns a forced screensaver off
+                self.forced_at = None
+            else:
+                return (ScreenSaverOn, kind, now - self.forced_at, idle)
+        if self.timeout <= 0:
+            return (ScreenSaverDisabled, kind, 0, idle)
+        if idle >= self.timeout and not self.suspended():
+            return (ScreenSaverOn, kind, idle - self.timeout, idle)
+        return (ScreenSaverOff, kind, max(self.timeout - idle, 0), idle)
+
+    def dpms_level(self, now=None):
+        """The monitor's DPMS power level, derived from the idle time."""
+        if now is None:
+            now = self.now()
+        if not self.dpms_enabled:
+            return DPMSModeOn
+        if self.dpms_forced is not None:
+            level, since = self.dpms_forced
+            following = self.timeline.next_input(since)
+            if following is None or following > now:
+                return level
+            self.dpms_forced = None
+        idle = self.timeline.idle(now)
+        level = DPMSModeOn
+        for mode, timeout in enumerate(self.dpms_timeouts, 1):
+            if timeout and idle >= timeout * 1000:
+                level = max(level, mode)
+        return level
+
+    def force(self, activate):
+        now = self.now()
+        if activate:
+            self.forced_at = now
+        else:
+            self.forced_at = None
+            self.timeline.input(now)
+        self.poke()
+
+    def poke(self):
+        """Tells the watcher that something changed."""
+        if self.wakeup is not None:
+            self.wakeup.set()
+
+    # -- events --------------------------------------------------------
+
+    def watch(self):
+        """Starts sending events, if nothing is sending them yet."""
+        if self.watcher is None:
+            self.last_state = self.saver_info()[0]
+            self.last_idle = self.timeline.idle(self.now())
+            self.last_evaluated = self.now()
+            self.wakeup = asyncio.Event()
+            self.watcher = asyncio.ensure_future(self._watch())
+
+    def next_event_time(self, now):
+        quiet = self.timeline.quiet_from(now)
+        times = [self.timeline.next_input(now)]
+        if self.timeout > 0 and self.forced_at is None and \
+                self.last_state == ScreenSaverOff:
+            times.append(quiet + self.timeout)
+        for alarm in self.alarms.values():
+            if alarm.state == XSyncAlarmActive:
+                times.append(alarm.next_positive(quiet))
+        times = [t for t in times if t is not None and t > now]
+        return min(times) if times else None
+
+    async def _watch(self):
+        while self.clients:
+            now = self.now()
+            self.evaluate(now)
+            when = self.next_event_time(now)
+            self.wakeup.clear()
+            timeout = None if when is None else (when - now) / 1000.0
+            try:
+                await asyncio.wait_for(self.wakeup.wait(), timeout)
+            except asyncio.TimeoutError:
+                pass
+        self.watcher = None
+        self.wakeup = None
+
+    def evaluate(self, now):
+        # scripted activity shows up as a key press when it starts
+        started = self.timeline.next_input(self.last_evaluated)
+        if started is not None and started <= now:
+            self.raw_event('keyboard', now)
+        self.last_evaluated = now
+
+        state, kind, til_or_since, idle = self.saver_info(now)
+        if state != self.last_state and state != ScreenSaverDisabled:
+            forced = int(self.forced_at is not None)
+            for client in self.clients:
+                if client.saver_mask & ScreenSaverNotifyMask:
+                    client.send_event(struct.pack(
+                        client.e + 'BBHIIIBB2x12x',
+                        EXTENSIONS["MIT-SCREEN-SAVER"][1], state, 0,
+                        now & 0xffffffff, ROOT_WINDOW, 0, kind, forced))
+        self.last_state = state
+
+        for alarm in list(self.alarms.values()):
+            if alarm.state != XSyncAlarmActive or \
+                    alarm.counter != IDLETIME_COUNTER:
+                continue
+            if alarm.triggered(self.last_idle, idle):
+                self.fire(alarm, idle, now)
+        self.last_idle = idle
+
+    def fire(self, alarm, value, now, state=None):
+        if state is None:
+            positive = alarm.test in (XSyncPositiveTransition,
+                                      XSyncPositiveComparison)
+            if alarm.delta == 0:
+                if alarm.test in (XSyncPositiveComparison,
+                                  XSyncNegativeComparison):
+                    alarm.state = XSyncAlarmInactive
+            elif (alarm.delta > 0) != positive:
+                # stepping the wrong way would never end
+                alarm.state = XSyncAlarmInactive
+            else:
+                while (value >= alarm.value) if positive \
+                        else (value <= alarm.value):
+                    alarm.value += alarm.delta
+            state = alarm.state
+        if alarm.events:
+            client = alarm.client
+            client.send_event(struct.pack(
+                client.e + 'BBHIiIiIIB3x',
+                EXTENSIONS["SYNC"][1] + XSyncAlarmNotify, XSyncAlarmNotify,
+                0, alarm.id, value >> 32, value & 0xffffffff,
+                alarm.value >> 32, alarm.value & 0xffffffff,
+                now & 0xffffffff, state))
+
+    # -- sockets -------------------------------------------------------
+
+    def _claim(self):
+        """Claims the display number the way X servers do: with a
+        /tmp/.X<n>-lock file, made with O_EXCL, that holds our pid.  A lock
+        whose process is gone is taken over.  Raises OSError (EADDRINUSE)
+        if the display belongs to someone else."""
+        path = "/tmp/.X%d-lock" % self.number
+        for attempt in range(2):
+            try:
+                fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_EXCL,
+                             0o444)
+            except FileExistsError:
+                try:
+                    with open(path) as lock:
+                        pid = int(lock.read().strip())
+                    os.kill(pid, 0)
+                except ProcessLookupError:
+                    os.unlink(path)         # stale: its server is gone
+                    continue
+                except (OSError, ValueError):
+                    pass
+                break
+            os.write(fd, b"%10d\n" % os.getpid())
+            os.close(fd)
+            self.lock_path = path
+            return
+        raise OSError(errno.EADDRINUSE,
+                      "display :%d is in use (see %s)" % (self.number, path))
+
+    async def listen(self, tcp=False):
+        self._claim()
+        path = os.path.join(SOCKET_DIR, "X%d" % self.number)
+        if os.path.exists(path):
+            # only a socket nobody answers on is ours to replace
+            probe = socket.socket(socket.AF_UNIX)
+            try:
+                probe.connect(path)
+            except OSError:
+                os.unlink(path)
+            else:
+                self.close()
+                raise OSError(errno.EADDRINUSE,
+                              "a server is listening on %s" % path)
+            finally:
+                probe.close()
+        self.listeners.append(await asyncio.start_unix_server(
+            self._serve, path=path))
+        self.socket_path = path
+        if tcp:
+            self.listeners.append(await asyncio.start_server(
+                self._serve, host="127.0.0.1", port=6000 + self.number))
+
+    def close(self):
+        for listener in self.listeners:
+            listener.close()
+        self.listeners = []
+        for client in list(self.clients):
+            client.close()
+        # leave alone what belongs to another server
+        for path in (self.socket_path, self.lock_path):
+            if path is not None and os.path.exists(path):
+                os.unlink(path)
+        self.socket_path = self.lock_path = None
+
+    async def _serve(self, reader, writer):
+        client = Client(self, reader, writer)
+        self.clients.add(client)
+        try:
+            await client.run()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            self.clients.discard(client)
+            for alarm_id in [a.id for a in self.alarms.values()
+                             if a.client is client]:
+                del self.alarms[alarm_id]
+            client.close()
+            self.poke()
+
+
+class Client:
+    """One connection to a FakeDisplay."""
+
+    def __init__(self, display, reader, writer):
+        self.display = display
+        self.reader = reader
+        self.writer = writer
+        self.e = '<'
+        self.seq = 0
+        self.saver_mask = 0
+        self.raw_events = set()
+        self.property_windows = set()   # selected PropertyChangeMask
+        self.suspend = False
+        self.outgoing = None
+        self.sender = None
+        self.deliver_at = 0.0
+
+    def close(self):
+        if self.sender is not None:
+            self.sender.cancel()
+            self.sender = None
+        self.writer.close()
+
+    # -- output --------------------------------------------------------
+
+    def send(self, data):
+        display = self.display
+        if not display.latency and not display.jitter:
+            self.writer.write(data)
+            return
+        # replies keep their order, so each one is delivered no earlier
+        # than the one before it
+        delay = display.latency + display.rng.uniform(0, display.jitter)
+        loop = asyncio.get_event_loop()
+        self.deliver_at = max(self.deliver_at, loop.time() + delay / 1000.0)
+        if self.outgoing is None:
+            self.outgoing = asyncio.Queue()
+            self.sender = asyncio.ensure_future(self._send())
+        self.outgoing.put_nowait((self.deliver_at, data))
+
+    async def _send(self):
+        loop = asyncio.get_event_loop()
+        while True:
+            when, data = await self.outgoing.get()
+            delay = when - loop.time()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            self.writer.write(data)
+
+    def reply(self, data_byte, body=b'', extra=b''):
+        payload = body + b'\0' * (24 - len(body)) + pad4(extra)
+        self.send(struct.pack(self.e + 'BBHI', 1, data_byte,
+                              self.seq & 0xffff, (len(payload) - 24) // 4)
+                  + payload)
+
+    def error(self, code, major, minor=0, value=0):
+        self.send(struct.pack(self.e + 'BBHIHB21x', 0, code,
+                              self.seq & 0xffff, value, minor, major))
+
+    def send_event(self, event):
+        self.send(event[:2] + struct.pack(self.e + 'H', self.seq & 0xffff)
+                  + event[4:])
+
+    # -- connection setup ----------------------------------------------
+
+    async def run(self):
+        header = await self.reader.readexactly(12)
+        self.e = '<' if header[0:1] == b'l' else '>'
+        major, minor, name_len, data_len = struct.unpack(
+            self.e + 'HHHH', header[2:10])
+        await self.reader.readexactly(len(pad4(b'\0' * name_len)) +
+                                      len(pad4(b'\0' * data_len)))
+        self.writer.write(self.setup_reply())
+
+        while True:
+            header = await self.reader.readexactly(4)
+            opcode, data, length = struct.unpack(self.e + 'BBH', header)
+            if length == 0:
+                # we don't offer BIG-REQUESTS, so this can't be valid
+                raise ConnectionError("zero-length request")
+            body = await self.reader.readexactly(length * 4 - 4)
+            self.seq += 1
+            self.display.requests += 1
+            self.dispatch(opcode, data, body)
+            drop_after = self.display.drop_after
+            if drop_after is not None and self.seq >= drop_after:
+                raise ConnectionError("dropping connection")
+
+    def setup_reply(self):
+        e = self.e
+        vendor = pad4(b"pyxss fake server")
+        formats = struct.pack(e + 'BBB5x', 1, 1, 32) + \
+            struct.pack(e + 'BBB5x', 24, 32, 32)
+        visual = struct.pack(e + 'IBBHIII4x', ROOT_VISUAL, 4, 8, 256,
+                             0xff0000, 0x00ff00, 0x0000ff)
+        depth = struct.pack(e + 'BxH4x', 24, 1) + visual
+        screen = struct.pack(e + 'IIIIIHHHHHHIBBBB', ROOT_WINDOW,
+                             DEFAULT_COLORMAP, 0xffffff, 0, 0, 1920, 1080,
+                             508, 285, 1, 1, ROOT_VISUAL, 0, 0, 24, 1) + depth
+        body = struct.pack(e + 'IIIIHHBBBBBBBB4x', 12101004,
+                           RESOURCE_ID_BASE, RESOURCE_ID_MASK, 256,
+                           len(b"pyxss fake server"), 65535, 1, 2, 0, 0, 32,
+                           32, 8, 255) + vendor + formats + screen
+        return struct.pack(e + 'BxHHH', 1, 11, 0, len(body) // 4) + body
+
+    # -- requests ------------------------------------------------------
+
+    def dispatch(self, opcode, data, body):
+        e = self.e
+        display = self.display
+        if opcode >= 128:
+            for name, (major, first_event, first_error) in \
+                    EXTENSIONS.items():
+                if major == opcode and name not in display.missing:
+                    break
+            else:
+                return self.error(BadRequest, opcode, data)
+            if display.error_rate and \
+                    display.rng.random() < display.error_rate:
+                return self.error(BadImplementation, opcode, data)
+            if name == "MIT-SCREEN-SAVER":
+                return self.screensaver(data, body)
+            if name == "DPMS":
+                return self.dpms(data, body)
+            if name == "XInputExtension":
+                return self.xinput(data, body)
+            return self.sync(data, body)
+
+        if opcode == X_QueryExtension:
+            (name_len,) = struct.unpack(e + 'H', body[:2])
+            name = body[4:4 + name_len].decode('latin-1')
+            if name in EXTENSIONS and name not in display.missing:
+                major, first_event, first_error = EXTENSIONS[name]
+                self.reply(0, struct.pack(e + 'BBBB', 1, major, first_event,
+                                          first_error))
+            else:
+                self.reply(0, struct.pack(e + 'BBBB', 0, 0, 0, 0))
+        elif opcode == X_ListExtensions:
+            names = [n for n in EXTENSIONS if n not in display.missing]
+            extra = b''.join(bytes([len(n)]) + n.encode() for n in names)
+            self.reply(len(names), extra=extra)
+        elif opcode == X_InternAtom:
+            (name_len,) = struct.unpack(e + 'H', body[:2])
+            name = body[4:4 + name_len].decode('latin-1')
+            atoms = display.server.atoms
+            if name not in atoms and not data:
+                atoms[name] = FIRST_ATOM + len(atoms)
+            self.reply(0, struct.pack(e + 'I', atoms.get(name, 0)))
+        elif opcode == X_GetAtomName:
+            (atom,) = struct.unpack(e + 'I', body[:4])
+            names = dict((v, k) for k, v in display.server.atoms.items())
+            if atom not in names:
+                return self.error(BadAtom, opcode, 0, atom)
+            name = names[atom].encode('latin-1')
+            self.reply(0, struct.pack(e + 'H', len(name)), name)
+        elif opcode in (X_CreateWindow, X_ChangeWindowAttributes):
+            # windows aren't real, but their event masks are kept
+            if opcode == X_CreateWindow:
+                window, value_mask = struct.unpack(e + 'I20xI',
+                                                   body[:28])
+                values = body[28:]
+            else:
+                window, value_mask = struct.unpack(e + 'II', body[:8])
+                values = body[8:]
+            if value_mask & CWEventMask:
+                index = bin(value_mask & (CWEventMask - 1)).count('1')
+                (mask,) = struct.unpack(e + 'I',
+                                        values[index * 4:index * 4 + 4])
+                if mask & PropertyChangeMask:
+                    self.property_windows.add(window)
+                else:
+                    self.property_windows.discard(window)
+        elif opcode == X_DestroyWindow:
+            (window,) = struct.unpack(e + 'I', body[:4])
+            self.property_windows.discard(window)
+        elif opcode == X_ChangeProperty:
+            window, atom = struct.unpack(e + 'II', body[:8])
+            if window in self.property_windows:
+                self.send_event(struct.pack(
+                    e + 'BBHIIIB15x', PropertyNotify, 0, 0, window, atom,
+                    display.now() & 0xffffffff, 0))
+        elif opcode == X_GetProperty:
+            # no window has any properties
+            self.reply(0, struct.pack(e + 'III', 0, 0, 0))
+        elif opcode == X_GetInputFocus:
+            self.reply(1, struct.pack(e + 'I', 1))   # PointerRoot
+        elif opcode == X_SetScreenSaver:
+            timeout, interval, blanking, exposures = struct.unpack(
+                e + 'hhBB', body[:6])
+            if timeout < -1 or interval < -1 or blanking > 2 or \
+                    exposures > 2:
+                return self.error(BadValue, opcode)
+            display.timeout = 600000 if timeout == -1 else timeout * 1000
+            display.interval = 600000 if interval == -1 else interval * 1000
+            if blanking != 2:
+                display.prefer_blanking = blanking
+            if exposures != 2:
+                display.allow_exposures = exposures
+            display.poke()
+        elif opcode == X_GetScreenSaver:
+            self.reply(0, struct.pack(e + 'HHBB', display.timeout // 1000,
+                                      display.interval // 1000,
+                                      display.prefer_blanking,
+                                      display.allow_exposures))
+        elif opcode == X_ForceScreenSaver:
+            if data > 1:
+                return self.error(BadValue, opcode, 0, data)
+            display.force(data == 1)
+        elif opcode not in IGNORED_REQUESTS:
+            self.error(BadRequest, opcode)
+
+    def screensaver(self, minor, body):
+        e = self.e
+        display = self.display
+        major = EXTENSIONS["MIT-SCREEN-SAVER"][0]
+        if minor == X_ScreenSaverQueryVersion:
+            self.reply(0, struct.pack(e + 'HH', 1, 1))
+        elif minor == X_ScreenSaverQueryInfo:
+            display.queries += 1
+            state, kind, til_or_since, idle = display.saver_info()
+            self.reply(state, struct.pack(e + 'IIIIB', 0, til_or_since,
+                                          idle, self.saver_mask, kind))
+        elif minor == X_ScreenSaverSelectInput:
+            drawable, mask = struct.unpack(e + 'II', body[:8])
+            if drawable != ROOT_WINDOW:
+                return self.error(BadWindow, major, minor, drawable)
+            self.saver_mask = mask
+            if mask:
+                display.watch()
+        elif minor == X_ScreenSaverSuspend:
+            (suspend,) = struct.unpack(e + 'I', body[:4])
+            self.suspend = bool(suspend)
+            display.poke()
+        else:
+            self.error(BadRequest, major, minor)
+
+    def dpms(self, minor, body):
+        e = self.e
+        display = self.display
+        major = EXTENSIONS["DPMS"][0]
+        if minor == X_DPMSGetVersion:
+            self.reply(0, struct.pack(e + 'HH', 1, 1))
+        elif minor == X_DPMSCapable:
+            self.reply(0, struct.pack(e + 'B', 1))
+        elif minor == X_DPMSGetTimeouts:
+            self.reply(0, struct.pack(e + 'HHH', *display.dpms_timeouts))
+        elif minor == X_DPMSSetTimeouts:
+            timeouts = struct.unpack(e + 'HHH', body[:6])
+            nonzero = [t for t in timeouts if t]
+            if nonzero != sorted(nonzero):
+                return self.error(BadValue, major, minor)
+            display.dpms_timeouts = timeouts
+        elif minor == X_DPMSEnable:
+            display.dpms_enabled = True
+        elif minor == X_DPMSDisable:
+            display.dpms_enabled = False
+        elif minor == X_DPMSForceLevel:
+            (level,) = struct.unpack(e + 'H', body[:2])
+            if level > DPMSModeOff:
+                return self.error(BadValue, major, minor, level)
+            if not display.dpms_enabled:
+                return self.error(BadMatch, major, minor)
+            display.dpms_forced = (level, display.now())
+        elif minor == X_DPMSInfo:
+            self.reply(0, struct.pack(e + 'HB', display.dpms_level(),
+                                      int(display.dpms_enabled)))
+        else:
+            self.error(BadRequest, major, minor)
+
+    def xinput(self, minor, body):
+        e = self.e
+        display = self.display
+        major = EXTENSIONS["XInputExtension"][0]
+        if minor == X_GetExtensionVersion:
+            self.reply(minor, struct.pack(e + 'HHB', 2, 2, 1))
+        elif minor == X_XIQueryVersion:
+            self.reply(minor, struct.pack(e + 'HH', 2, 2))
+        elif minor == X_XIQueryDevice:
+            (deviceid,) = struct.unpack(e + 'H', body[:2])
+            if deviceid == XIAllMasterDevices:
+                ids = [d for d in XI_DEVICES if XI_DEVICES[d][1] < 3]
+            elif deviceid == XIAllDevices:
+                ids = list(XI_DEVICES)
+            elif deviceid in XI_DEVICES:
+                ids = [deviceid]
+            else:
+                return self.error(BadValue, major, minor, deviceid)
+            self.reply(minor, struct.pack(e + 'H', len(ids)),
+                       b''.join(self.device_info(d) for d in ids))
+        elif minor == X_XISelectEvents:
+            window, num_masks = struct.unpack(e + 'IH', body[:6])
+            offset = 8
+            for i in range(num_masks):
+                deviceid, length = struct.unpack(
+                    e + 'HH', body[offset:offset + 4])
+                mask = body[offset + 4:offset + 4 + length * 4]
+                offset += 4 + length * 4
+                if deviceid not in (XIAllDevices, XIAllMasterDevices):
+                    continue
+                for evtype in (XI_RawKeyPress, XI_RawMotion,
+                               XI_RawTouchBegin):
+                    if len(mask) > evtype >> 3 and \
+                            mask[evtype >> 3] & (1 << (evtype & 7)):
+                        self.raw_events.add(evtype)
+            if self.raw_events:
+                display.watch()
+        else:
+            self.error(BadRequest, major, minor)
+
+    def device_info(self, deviceid):
+        e = self.e
+        name, use, attachment, classes = XI_DEVICES[deviceid]
+        wire = b''
+        for cls in classes:
+            if cls == 'key':
+                wire += struct.pack(e + 'HHHH', 0, 2, deviceid, 0)
+            elif cls == 'button':
+                # three buttons: a one-word state mask and three labels
+                wire += struct.pack(e + 'HHHH', 1, 6, deviceid, 3) + \
+                    b'\0' * 16
+            else:
+                wire += struct.pack(e + 'HHHBB', 8, 2, deviceid, 1, 10)
+        name = name.encode()
+        return struct.pack(e + 'HHHHHBx', deviceid, use, attachment,
+                           len(classes), len(name), 1) + pad4(name) + wire
+
+    def sync(self, minor, body):
+        e = self.e
+        display = self.display
+        major, first_event, first_error = EXTENSIONS["SYNC"]
+        if minor == X_SyncInitialize:
+            self.reply(0, struct.pack(e + 'BB', 3, 1))
+        elif minor == X_SyncListSystemCounters:
+            name = b"IDLETIME"
+            entry = pad4(struct.pack(e + 'IiIH', IDLETIME_COUNTER, 0, 1,
+                                     len(name)) + name)
+            self.reply(0, struct.pack(e + 'i', 1), entry)
+        elif minor == X_SyncQueryCounter:
+            (counter,) = struct.unpack(e + 'I', body[:4])
+            if counter != IDLETIME_COUNTER:
+                return self.error(first_error + XSyncBadCounter, major,
+                                  minor, counter)
+            idle = display.timeline.idle(display.now())
+            self.reply(0, struct.pack(e + 'iI', idle >> 32,
+                                      idle & 0xffffffff))
+        elif minor in (X_SyncCreateAlarm, X_SyncChangeAlarm):
+            alarm_id, mask = struct.unpack(e + 'II', body[:8])
+            if minor == X_SyncCreateAlarm:
+                alarm = Alarm(alarm_id, self)
+            elif alarm_id in display.alarms:
+                alarm = display.alarms[alarm_id]
+            else:
+                return self.error(first_error + XSyncBadAlarm, major, minor,
+                                  alarm_id)
+            values = body[8:]
+            offset = 0
+
+            def card32():
+                nonlocal offset
+                (value,) = struct.unpack(e + 'I', values[offset:offset + 4])
+                offset += 4
+                return value
+
+            def int64():
+                nonlocal offset
+                hi, lo = struct.unpack(e + 'iI', values[offset:offset + 8])
+                offset += 8
+                return (hi << 32) | lo
+
+            try:
+                if mask & XSyncCACounter:
+                    alarm.counter = card32()
+                if mask & XSyncCAValueType:
+                    alarm.value_type = card32()
+                if mask & XSyncCAValue:
+                    alarm.value = int64()
+                if mask & XSyncCATestType:
+                    alarm.test = card32()
+                if mask & XSyncCADelta:
+                    alarm.delta = int64()
+                if mask & XSyncCAEvents:
+                    alarm.events = bool(card32())
+            except struct.error:
+                return self.error(BadLength, major, minor)
+            if alarm.counter not in (0, IDLETIME_COUNTER):
+                return self.error(first_error + XSyncBadCounter, major,
+                                  minor, alarm.counter)
+            if alarm.value_type == XSyncRelative and mask & XSyncCAValue:
+                alarm.value += display.timeline.idle(display.now())
+            alarm.state = XSyncAlarmActive if alarm.counter \
+                else XSyncAlarmInactive
+            display.alarms[alarm_id] = alarm
+            display.watch()
+            display.poke()
+        elif minor == X_SyncQueryAlarm:
+            (alarm_id,) = struct.unpack(e + 'I', body[:4])
+            alarm = display.alarms.get(alarm_id)
+            if alarm is None:
+                return self.error(first_error + XSyncBadAlarm, major, minor,
+                                  alarm_id)
+            self.reply(0, struct.pack(
+                e + 'IIiIIiIBB2x', alarm.counter, alarm.value_type,
+                alarm.value >> 32, alarm.value & 0xffffffff, alarm.test,
+                alarm.delta >> 32, alarm.delta & 0xffffffff,
+                alarm.events, alarm.state))
+        elif minor == X_SyncDestroyAlarm:
+            (alarm_id,) = struct.unpack(e + 'I', body[:4])
+            alarm = display.alarms.pop(alarm_id, None)
+            if alarm is None:
+                return self.error(first_error + XSyncBadAlarm, major, minor,
+                                  alarm_id)
+            now = display.now()
+            display.fire(alarm, display.timeline.idle(now), now,
+                         XSyncAlarmDestroyed)
+        else:
+            self.error(BadRequest, major, minor)
+
+
+class FakeXServer:
+    """Serves any number of FakeDisplays from one asyncio event loop.
+    Either await serve() from your own loop or call start() to run the
+    loop in a background thread."""
+
+    def __init__(self):
+        self.displays = []
+        self.atoms = {}
+        self.loop = None
+        self.thread = None
+        self.started = None
+
+    def now(self):
+        """Server time: milliseconds since the server started."""
+        return int((self.loop.time() - self.started) * 1000)
+
+    def call(self, function):
+        """Runs function on the server's loop."""
+        if self.loop is None or self.thread is None or \
+                threading.current_thread() is self.thread:
+            function()
+        else:
+            self.loop.call_soon_threadsafe(function)
+
+    def add_display(self, number=None, **settings):
+        """Adds a display; see FakeDisplay for the settings.  Displays
+        are numbered from 4000 unless a number is given."""
+        if number is None:
+            number = max([d.number for d in self.displays] + [3999]) + 1
+        display = FakeDisplay(self, number, **settings)
+        self.displays.append(display)
+        return display
+
+    async def serve(self, tcp=False):
+        """Starts listening on every display."""
+        self.loop = asyncio.get_event_loop()
+        self.started = self.loop.time()
+        if not os.path.isdir(SOCKET_DIR):
+            os.makedirs(SOCKET_DIR)
+            os.chmod(SOCKET_DIR, 0o1777)
+        try:
+            for display in self.displays:
+                await display.listen(tcp)
+        except OSError:
+            for display in self.displays:
+                display.close()
+            raise
+
+    def start(self, tcp=False):
+        """Runs the server in a daemon thread; returns once every display
+        is listening."""
+        ready = threading.Event()
+        failure = []
+
+        def run():
+            self.loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(self.loop)
+            try:
+                self.loop.run_until_complete(self.serve(tcp))
+            except Exception as exc:
+                failure.append(exc)
+                ready.set()
+                return
+            ready.set()
+            self.loop.run_forever()
+
+        self.thread = threading.Thread(target=run, name="fakeserver",
+                                       daemon=True)
+        self.thread.start()
+        ready.wait()
+        if failure:
+            raise failure[0]
+
+    def stop(self):
+        """Closes every display and stops a server started with start()."""
+        def shutdown():
+            for display in self.displays:
+                display.close()
+            self.loop.stop()
+        if self.thread is not None:
+            self.loop.call_soon_threadsafe(shutdown)
+            self.thread.join()
+            self.thread = None
+        else:
+            for display in self.displays:
+                display.close()
+
+
+def main(argv=None):
+    import argparse
+    import json
+    import resource
+
+    parser = argparse.ArgumentParser(
+        prog="python -m xss.fakeserver",
+        description="Serve fake X displays with scripted idle timelines.")
+    parser.add_argument("-n", "--displays", type=int, default=1,
+                        help="how many displays to serve (default: 1)")
+    parser.add_argument("--base", type=int, default=4000,
+                        help="first display number (default: 4000)")
+    parser.add_argument("--timeline", metavar="FILE",
+                        help="JSON timeline for every display: keys idle, "
+                             "active, input and timeout, all in ms")
+    parser.add_argument("--random", metavar="SEED", type=int,
+                        help="give each display a random timeline")
+    parser.add_argument("--timeout", type=int, default=600000,
+                        help="screensaver timeout in ms (0 disables it)")
+    parser.add_argument("--latency", type=float, default=0,
+                        help="delay every reply and event by this many ms")
+    parser.add_argument("--jitter", type=float, default=0,
+                        help="add up to this many ms of random delay")
+    parser.add_argument("--error-rate", type=float, default=0,
+                        help="fraction of extension requests that fail")
+    parser.add_argument("--drop-after", type=int,
+                        help="close connections after this many requests")
+    parser.add_argument("--missing", action="append", default=[],
+                        metavar="EXTENSION",
+                        help="pretend not to have this extension")
+    parser.add_argument("--tcp", action="store_true",
+                        help="also listen on TCP port 6000+display")
+    args = parser.parse_args(argv)
+
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+    script = {}
+    if args.timeline:
+        with open(args.timeline) as f:
+            script = json.load(f)
+    server = FakeXServer()
+    for i in range(args.displays):
+        if args.random is not None:
+            timeline = Timeline.random(args.random + i)
+        else:
+            timeline = Timeline.from_dict(script)
+        server.add_display(args.base + i, timeline=timeline,
+                           timeout=script.get("timeout", args.timeout),
+                           latency=args.latency, jitter=args.jitter,
+                           error_rate=args.error_rate,
+                           drop_after=args.drop_after,
+                           missing=args.missing)
+
+    loop = asyncio.new_event_loop()
+    asyncio.set_event_loop(loop)
+    loop.run_until_complete(server.serve(args.tcp))
+    print("serving :%d through :%d" % (args.base, args.base + args.displays
+                                       - 1))
+    sys.stdout.flush()
+    try:
+        loop.run_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.stop()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,164 @@
+"""Idle-detection latency: how long after the user touches the keyboard
+(or stops touching it for long enough) the program finds out.
+
+Every state change a tracker or Watcher reports can be stamped with three
+times, all on CLOCK_MONOTONIC in milliseconds (time.monotonic() * 1000):
+
+    due_time        when the change really happened: the input that ended
+                    idleness, or the moment idle time crossed the threshold
+    notify_time     when the X server told us (for polling, when the reply
+                    that showed the change was read)
+    callback_time   when our callback ran or check_idle() returned
+
+Detection latency is callback_time - due_time.  Pass a LatencyLog to
+IdleTracker, XSSTracker or mainloop.Watcher as latency= to collect them:
+
+>>> log = xss.LatencyLog()
+>>> tracker = xss.IdleTracker(idle_threshold=60000, latency=log)
+>>> ...
+>>> print(log.report())
+
+Stamps are grouped by mode: "poll" for the trackers, "event" for
+screensaver notifications and "alarm" for SYNC idle alarms, so the three
+ways of watching can be compared on the same workload."""
+
+import bisect
+import collections
+import time
+
+# upper bounds of the histogram buckets, in ms: 1-2-5 steps from 0.1 ms
+# to 500 s
+BUCKETS = [b * 10 ** e for e in range(-1, 6) for b in (1, 2, 5)]
+
+
+def monotonic_ms():
+    return time.monotonic() * 1000.0
+
+
+class Histogram:
+    """Counts latencies (in ms) in 1-2-5 buckets, plus the exact count,
+    sum and maximum."""
+
+    def __init__(self):
+        self.counts = [0] * (len(BUCKETS) + 1)  # the last is overflow
+        self.count = 0
+        self.total = 0.0
+        self.max = 0.0
+
+    def add(self, ms):
+        ms = max(ms, 0.0)
+        self.counts[bisect.bisect_left(BUCKETS, ms)] += 1
+        self.count += 1
+        self.total += ms
+        self.max = max(self.max, ms)
+
+    def merge(self, other):
+        for i, n in enumerate(other.counts):
+            self.counts[i] += n
+        self.count += other.count
+        self.total += other.total
+        self.max = max(self.max, other.max)
+
+    def mean(self):
+        return self.total / self.count if self.count else 0.0
+
+    def percentile(self, p):
+        """The upper bound of the bucket holding the p-th percentile
+        (0-100), or the maximum if that is lower."""
+        if not self.count:
+            return 0.0
+        rank = p / 100.0 * self.count
+        seen = 0
+        for i, n in enumerate(self.counts):
+            seen += n
+            if seen >= rank and n:
+                bound = BUCKETS[i] if i < len(BUCKETS) else self.max
+                return min(bound, self.max)
+        return self.max
+
+    def buckets(self):
+        """(upper bound in ms, count) for every non-empty bucket; the
+        overflow bucket's bound is None."""
+        bounds = BUCKETS + [None]
+        return [(bounds[i], n) for i, n in enumerate(self.counts) if n]
+
+    def __str__(self):
+        if not self.count:
+            return "(empty)"
+        lines = []
+        widest = max(self.counts)
+        for bound, n in self.buckets():
+            label = "<= %g ms" % bound if bound is not None else "overflow"
+            lines.append("%12s %6d %s" % (label, n,
+                                          '#' * (40 * n // widest)))
+        return "\n".join(lines)
+
+
+class DetectionStamp:
+    __slots__ = ('mode', 'change', 'input_time', 'due_time', 'notify_time',
+                 'callback_time')
+
+    def __init__(self, mode, change, input_time, due_time, notify_time,
+                 callback_time):
+        self.mode = mode
+        self.change = change
+        self.input_time = input_time
+        self.due_time = due_time
+        self.notify_time = notify_time
+        self.callback_time = callback_time
+
+    @property
+    def latency(self):
+        """From the change happening to our callback running."""
+        return self.callback_time - self.due_time
+
+    @property
+    def server_latency(self):
+        """From the change happening to the server telling us."""
+        return self.notify_time - self.due_time
+
+    def __repr__(self):
+        return "<DetectionStamp %s %s latency=%.1fms>" % \
+               (self.mode, self.change, self.latency)
+
+
+class LatencyLog:
+    """Keeps a latency histogram per (mode, change) and the last few
+    stamps."""
+
+    def __init__(self, keep=1000):
+        self.histograms = {}
+        self.recent = collections.deque(maxlen=keep)
+
+    def record(self, mode, change, input_time, due_time, notify_time,
+               callback_time=None):
+        if callback_time is None:
+            callback_time = monotonic_ms()
+        stamp = DetectionStamp(mode, change, input_time, due_time,
+                               notify_time, callback_time)
+        key = (mode, change)
+        if key not in self.histograms:
+            self.histograms[key] = Histogram()
+        self.histograms[key].add(stamp.latency)
+        self.recent.append(stamp)
+        return stamp
+
+    def histogram(self, mode=None, change=None):
+        """The histogram for a mode and change, merged over every mode or
+        change left as None."""
+        merged = Histogram()
+        for (m, c), histogram in self.histograms.items():
+            if mode in (None, m) and change in (None, c):
+                merged.merge(histogram)
+        return merged
+
+    def report(self):
+        lines = ["%-8s %-10s %7s %9s %9s %9s %9s" %
+                 ("mode", "change", "count", "mean ms", "p50 ms", "p99 ms",
+                  "max ms")]
+        for mode, change in sorted(self.histograms):
+            h = self.histograms[mode, change]
+            lines.append("%-8s %-10s %7d %9.1f %9.1f %9.1f %9.1f" %
+                         (mode, change, h.count, h.mean(), h.percentile(50),
+                          h.percentile(99), h.max))
+        return "\n".join(lines)
@@ -0,0 +1,268 @@
+"""Main-loop integration: callbacks on screensaver and idle events instead
+of polling get_info() on a timer.
+
+A Watcher keeps an IdleWatch (its own X connection) and runs callbacks
+when the X server reports something: the screensaver turning on or off,
+or idle time crossing a threshold in either direction.  Between events,
+nothing runs and nothing is sent to the X server.  The one exception is
+the progress timer, for widgets that show the countdown to the
+screensaver: it ticks only during the last progress_window ms before
+activation.
+
+>>> import xss.mainloop
+>>> watcher = xss.mainloop.Watcher()
+>>> watcher.on_screensaver(lambda event: print("saver", event.state))
+>>> watcher.on_idle(300000, lambda event: print("away"),
+...                 lambda event: print("back"))
+>>> source = xss.mainloop.GLibSource(watcher)   # or TkSource(root, watcher)
+>>> source.attach()
+
+Watcher itself doesn't depend on a main loop: poll fileno(), call
+dispatch() when it's readable (or when pending() is true), and call
+tick() every progress_interval ms for as long as ticking is true."""
+
+from .xss import (IdleWatch, ScreenSaverOff, WatchScreenSaver, WatchIdle,
+                  WatchActive)
+from .latency import monotonic_ms
+
+
+class Watcher:
+    def __init__(self, display=None, progress_window=30000,
+                 progress_interval=100, latency=None):
+        """progress_window is how long before the screensaver activates
+        the progress timer starts ticking, in milliseconds, and
+        progress_interval is how often it ticks.  latency is an optional
+        xss.LatencyLog to stamp every idle and screensaver change in."""
+        self.watch = IdleWatch(display)
+        self.latency = latency
+        self.progress_window = progress_window
+        self.progress_interval = progress_interval
+        self.saver_callbacks = []
+        self.idle_callbacks = {}    # alarm index -> (on_idle, on_active)
+        self.progress_callbacks = []
+        self.progress_alarm = None
+        self.timeout = None         # screensaver timeout, when known
+        self.ticking = False
+
+    def fileno(self):
+        return self.watch.fileno()
+
+    def pending(self):
+        """Whether dispatch() has work without the fd becoming readable."""
+        return self.watch.pending()
+
+    def on_screensaver(self, callback):
+        """Calls callback(event) when the screensaver turns on, off, or
+        cycles.  event.state is ScreenSaverOn, ScreenSaverOff or
+        ScreenSaverCycle, and event.forced is set if something forced the
+        change rather than the user going idle."""
+        self.saver_callbacks.append(callback)
+
+    def on_idle(self, threshold, on_idle, on_active=None):
+        """Calls on_idle(event) when the user has been idle for threshold
+        ms, and on_active(event) on the first input after that.  Returns
+        an id for remove_idle().  Needs the SYNC extension: raises
+        RuntimeError without it."""
+        alarm = self.watch.add_alarm(threshold)
+        if alarm < 0:
+            raise RuntimeError("Couldn't set an idle alarm.")
+        self.idle_callbacks[alarm] = (on_idle, on_active)
+        return alarm
+
+    def remove_idle(self, alarm):
+        if self.idle_callbacks.pop(alarm, None) is not None:
+            self.watch.remove_alarm(alarm)
+
+    def on_progress(self, callback):
+        """Calls callback(info) with a fresh XScreenSaverInfo on every
+        tick of the progress timer, and once more when input cuts the
+        countdown short."""
+        self.progress_callbacks.append(callback)
+        self._rearm()
+
+    def _rearm(self):
+        """Reads the screensaver timeout (it can change under us with
+        'xset s'), moves the progress alarm to match, and works out
+        whether the countdown is already in the window."""
+        if not self.progress_callbacks:
+            return
+        try:
+            info = self.watch.info()
+        except RuntimeError:
+            self.ticking = False
+            return
+        if info.state != ScreenSaverOff:
+            self.ticking = False
+            return
+        was_ticking = self.ticking
+        timeout = info.idle + info.til_or_since
+        start = max(timeout - self.progress_window, 1)
+        if timeout != self.timeout or self.progress_alarm is None:
+            if self.progress_alarm is not None:
+                self.watch.remove_alarm(self.progress_alarm)
+            self.progress_alarm = self.watch.add_alarm(start)
+            self.timeout = timeout
+        self.ticking = info.idle >= start or self.progress_alarm < 0
+        if was_ticking and not self.ticking:
+            for callback in self.progress_callbacks:
+                callback(info)
+
+    def dispatch(self):
+        """Handles every event that has arrived and runs the callbacks.
+        Returns the number of events handled."""
+        handled = 0
+        self.watch.pump()
+        event = self.watch.next()
+        while event is not None:
+            handled += 1
+            if self.latency is not None:
+                self._stamp(event)
+            if event.type == WatchScreenSaver:
+                for callback in self.saver_callbacks:
+                    callback(event)
+                self._rearm()
+            elif event.alarm == self.progress_alarm:
+                if event.type == WatchIdle:
+                    self.ticking = True
+                else:
+                    self._rearm()
+            else:
+                callbacks = self.idle_callbacks.get(event.alarm)
+                if callbacks:
+                    callback = callbacks[event.type == WatchActive]
+                    if callback is not None:
+                        callback(event)
+            event = self.watch.next()
+        return handled
+
+    def _stamp(self, event):
+        if event.type == WatchScreenSaver:
+            if event.forced:
+                return
+            if event.state == ScreenSaverOff:
+                change, due = 'unidle', event.input_time
+            else:
+                change, due = 'idle', event.notify_time
+            mode = 'event'
+        elif event.alarm == self.progress_alarm:
+            return
+        elif event.type == WatchIdle:
+            mode, change = 'alarm', 'idle'
+            due = event.input_time + event.threshold
+        else:
+            mode, change, due = 'alarm', 'unidle', event.input_time
+        self.latency.record(mode, change, event.input_time, due,
+                            event.notify_time, monotonic_ms())
+
+    def tick(self):
+        """Runs the progress callbacks.  Returns whether the timer should
+        keep ticking."""
+        if not self.ticking:
+            return False
+        try:
+            info = self.watch.info()
+        except RuntimeError:
+            self.ticking = False
+            return False
+        if info.state != ScreenSaverOff:
+            self.ticking = False
+        for callback in self.progress_callbacks:
+            callback(info)
+        return self.ticking
+
+
+class GLibSource:
+    """Runs a Watcher from a GLib main loop (GTK, GIO, ...) with a single
+    GSource that wakes up on the X connection and, while the progress
+    timer is ticking, on its ready time."""
+
+    def __init__(self, watcher, priority=None):
+        from gi.repository import GLib
+
+        class Source(GLib.Source):
+            def prepare(source):
+                return watcher.pending(), -1
+
+            def check(source):
+                return bool(source.query_unix_fd(source.tag)) or \
+                       watcher.pending()
+
+            def dispatch(source, callback, args):
+                now = GLib.get_monotonic_time()
+                if source.query_unix_fd(source.tag) or watcher.pending():
+                    watcher.dispatch()
+                ready = source.get_ready_time()
+                if 0 <= ready <= now:
+                    watcher.tick()
+                    ready = -1
+                if not watcher.ticking:
+                    source.set_ready_time(-1)
+                elif ready < 0:
+                    source.set_ready_time(
+                        now + watcher.progress_interval * 1000)
+                return GLib.SOURCE_CONTINUE
+
+        self.watcher = watcher
+        self.source = Source()
+        self.source.tag = self.source.add_unix_fd(watcher.fileno(),
+                                                  GLib.IOCondition.IN)
+        if priority is not None:
+            self.source.set_priority(priority)
+        if watcher.ticking:
+            self.source.set_ready_time(GLib.get_monotonic_time())
+
+    def attach(self, context=None):
+        """Attaches the source to context (the default main context if
+        None) and returns its id."""
+        return self.source.attach(context)
+
+    def destroy(self):
+        self.source.destroy()
+
+
+class TkSource:
+    """Runs a Watcher from Tk's event loop: a file handler on the X
+    connection, plus an after() timer while the progress timer is
+    ticking.  widget is any Tk widget; its interpreter does the
+    waiting."""
+
+    def __init__(self, widget, watcher):
+        self.widget = widget
+        self.watcher = watcher
+        self.timer = None
+        self.attached = False
+
+    def attach(self):
+        import tkinter
+        self.widget.tk.createfilehandler(self.watcher.fileno(),
+                                         tkinter.READABLE, self._readable)
+        self.attached = True
+        self._schedule()
+
+    def destroy(self):
+        if self.attached:
+            self.widget.tk.deletefilehandler(self.watcher.fileno())
+            self.attached = False
+        if self.timer is not None:
+            self.widget.after_cancel(self.timer)
+            self.timer = None
+
+    def _readable(self, fd, mask):
+        self.watcher.dispatch()
+        # a progress tick's query can read events off the socket behind
+        # Tk's back; those won't make the fd readable again
+        if self.watcher.pending():
+            self.widget.after_idle(self._readable, fd, mask)
+        self._schedule()
+
+    def _tick(self):
+        self.timer = None
+        self.watcher.tick()
+        if self.watcher.pending():
+            self.watcher.dispatch()
+        self._schedule()
+
+    def _schedule(self):
+        if self.watcher.ticking and self.timer is None and self.attached:
+            self.timer = self.widget.after(self.watcher.progress_interval,
+                                           self._tick)
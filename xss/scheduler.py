@@ -0,0 +1,574 @@
+"""Background jobs that only run while the user is away.
+
+An IdleScheduler holds jobs, each with a minimum idle time, and runs them
+from a thread of its own: a job starts once the user has been idle for
+its min_idle, and the moment input arrives it is paused (processes get
+SIGSTOP, and SIGCONT on the next idle window), cancelled, or cancelled to
+be started over later:
+
+>>> scheduler = xss.IdleScheduler()
+>>> scheduler.submit_process(['make', '-j8'], min_idle=300000)
+>>> scheduler.submit(reindex, min_idle=600000, on_activity='restart')
+>>> scheduler.start()
+>>> ...
+>>> print(scheduler.stats())
+
+Input is noticed the fastest way available: a SYNC idle alarm on the X
+server (an event on the first input, see xss.IdleWatch), or epoll on the
+input devices with an EvdevBackend, or, failing both, polling idle time
+every poll_interval ms while jobs run.  mode says which is in use.
+
+Python callables can't be stopped from outside, so they take part: a
+callable is called with its Job, and calls job.checkpoint() now and then,
+which blocks while the job is paused and raises JobCancelled once it
+has been cancelled.
+
+stats() reports how well idle windows were used.  An idle window is a
+stretch during which at least one unfinished job had its min_idle met;
+utilization is the part of that time a job was running.  Pauses are
+timed from the input that caused them (the idle time when it was
+noticed).
+
+A cancelled process gets SIGTERM, and SIGKILL if it is still there
+kill_grace ms later; the scheduler thread reaps it meanwhile, so a job
+can be finished while its process is still on its way out."""
+
+import os
+import select
+import signal
+import subprocess
+import threading
+
+from .xss import IdleWatch
+from .backend import EvdevBackend
+from .latency import Histogram, monotonic_ms
+
+
+class JobCancelled(Exception):
+    """Raised by Job.checkpoint() in a callable that has been cancelled."""
+
+
+class Job:
+    """A submitted job.  state is 'waiting', 'running', 'paused', 'done',
+    'failed' or 'cancelled'.  A process job's returncode, and a callable's
+    result or error, are set when it finishes.  run_ms is the time it has
+    spent running, and starts how many times it was started."""
+
+    def __init__(self, scheduler, min_idle, on_activity, name):
+        if on_activity not in ('pause', 'cancel', 'restart'):
+            raise ValueError("on_activity must be 'pause', 'cancel' or "
+                             "'restart'")
+        self.scheduler = scheduler
+        self.min_idle = min_idle
+        self.on_activity = on_activity
+        self.name = name
+        self.state = 'waiting'
+        self.result = self.error = self.returncode = None
+        self.run_ms = 0.0
+        self.starts = 0
+        self.since = None           # when it last started or resumed
+        self.finished = threading.Event()
+        self.resumed = threading.Event()
+        self.resumed.set()
+        self.cancelled = False
+
+    def __repr__(self):
+        return "<Job %s %s>" % (self.name, self.state)
+
+    def checkpoint(self):
+        """For callables: waits while the job is paused, and raises
+        JobCancelled if it has been cancelled."""
+        self.resumed.wait()
+        if self.cancelled:
+            raise JobCancelled(self.name)
+
+    def wait(self, timeout=None):
+        """Waits for the job to be done, failed or cancelled.  Returns
+        whether it is."""
+        return self.finished.wait(timeout)
+
+    def cancel(self):
+        self.scheduler._cancel(self)
+
+    # the scheduler thread calls these with the scheduler's lock held
+
+    def _start(self, now):
+        self.cancelled = False
+        self.resumed.set()
+        self.starts += 1
+        self.since = now
+        self.state = 'running'
+
+    def _stop(self, now, state):
+        if self.since is not None:
+            self.run_ms += now - self.since
+            self.since = None
+        self.state = state
+
+    def _pause(self, now):
+        self.resumed.clear()
+        self._stop(now, 'paused')
+
+    def _resume(self, now):
+        self.resumed.set()
+        self.since = now
+        self.state = 'running'
+
+    def _cancel(self, now, state):
+        self.cancelled = True
+        self.resumed.set()
+        self._stop(now, state)
+
+    def _done(self):
+        return self.state in ('done', 'failed', 'cancelled')
+
+    def _ready(self):
+        """Whether a waiting job can be started now."""
+        return True
+
+
+class _ProcessJob(Job):
+    def __init__(self, scheduler, args, min_idle, on_activity, kwargs):
+        Job.__init__(self, scheduler, min_idle, on_activity,
+                     kwargs.pop('name', None) or str(args))
+        self.args = args
+        self.kwargs = kwargs
+        self.process = None
+        self.pidfd = None           # readable when the process exits
+
+    def _start(self, now):
+        # a session of its own, so that signals reach its children too
+        self.process = subprocess.Popen(self.args, start_new_session=True,
+                                        **self.kwargs)
+        Job._start(self, now)
+        if hasattr(os, 'pidfd_open'):
+            try:
+                self.pidfd = os.pidfd_open(self.process.pid)
+            except OSError:
+                pass
+
+    def _close(self):
+        if self.pidfd is not None:
+            os.close(self.pidfd)
+            self.pidfd = None
+
+    def _signal(self, sig):
+        try:
+            os.killpg(self.process.pid, sig)
+        except ProcessLookupError:
+            pass
+
+    def _pause(self, now):
+        self._signal(signal.SIGSTOP)
+        Job._pause(self, now)
+
+    def _resume(self, now):
+        self._signal(signal.SIGCONT)
+        Job._resume(self, now)
+
+    def _ready(self):
+        # a cancelled process has to exit before the next one starts
+        return self.process is None or self.process.poll() is not None
+
+    def _cancel(self, now, state):
+        if self.process is not None and self.process.poll() is None:
+            self._signal(signal.SIGTERM)
+            self._signal(signal.SIGCONT)    # a stopped process can't exit
+        if self.process is not None:
+            # the scheduler thread reaps it, and closes the pidfd, since it
+            # may be waiting on it right now
+            self.scheduler._reap(self.process, self.pidfd, now)
+            self.pidfd = None
+        Job._cancel(self, now, state)
+
+    def _poll(self, now):
+        """Whether the process has exited; if so, records how."""
+        if self.process is None or self.process.poll() is None:
+            return False
+        self.returncode = self.process.returncode
+        self._close()
+        self._stop(now, 'done' if self.returncode == 0 else 'failed')
+        return True
+
+
+class _CallableJob(Job):
+    def __init__(self, scheduler, func, min_idle, on_activity, name):
+        Job.__init__(self, scheduler, min_idle, on_activity,
+                     name or getattr(func, '__name__', repr(func)))
+        self.func = func
+        self.thread = None
+        self.outcome = None         # set by the thread when func returns
+
+    def _ready(self):
+        # a cancelled run has to notice before the next one starts
+        return self.thread is None or not self.thread.is_alive()
+
+    def _start(self, now):
+        Job._start(self, now)
+        self.outcome = None
+        self.thread = threading.Thread(target=self._run, daemon=True,
+                                       name="pyxss job %s" % self.name)
+        self.thread.start()
+
+    def _run(self):
+        try:
+            outcome = ('done', self.func(self), None)
+        except JobCancelled:
+            outcome = ('cancelled', None, None)
+        except Exception as e:
+            outcome = ('failed', None, e)
+        self.outcome = outcome
+        self.scheduler._wake()
+
+    def _poll(self, now):
+        if self.outcome is None or self.state not in ('running', 'paused'):
+            return False
+        state, self.result, self.error = self.outcome
+        if state == 'cancelled':
+            # it noticed a cancel meant for a restart (or a real one)
+            return False
+        self._stop(now, state)
+        return True
+
+
+class IdleScheduler:
+    def __init__(self, backend=None, max_jobs=1, poll_interval=100,
+                 kill_grace=5000):
+        """backend is where idle time comes from: None for the X server
+        (with a SYNC idle alarm, or polling get_info() if the server has
+        no SYNC), an EvdevBackend for input devices, or any other live
+        backend (polled).  max_jobs is how many jobs run at once.
+        poll_interval is how often idle time is polled while jobs run,
+        in ms, when input can't be waited for.  kill_grace is how long a
+        cancelled process has to exit after SIGTERM before SIGKILL, in
+        ms."""
+        self.max_jobs = max_jobs
+        self.poll_interval = poll_interval
+        self.kill_grace = kill_grace
+        self.backend = backend
+        self.watch = None
+        self.alarm = None           # (alarm index, threshold)
+        if isinstance(backend, EvdevBackend):
+            self.mode = 'evdev'
+        elif backend is None:
+            try:
+                self.watch = IdleWatch()
+                self.mode = 'alarm' if self.watch.has_alarms() else 'poll'
+            except RuntimeError:
+                self.mode = 'poll'
+        else:
+            self.mode = 'poll'
+        self.jobs = []
+        self.exiting = []           # [process, pidfd, when to SIGKILL]
+        self.lock = threading.Lock()
+        self.wake_r = self.wake_w = None
+        self._pipe()
+        self.thread = None
+        self.stopping = False
+        self.last_idle = None
+        # stats
+        self.window_start = None
+        self.busy_start = None
+        self.windows = 0
+        self.window_ms = self.busy_ms = 0.0
+        self.counts = dict(started=0, paused=0, resumed=0, cancelled=0,
+                           restarted=0, done=0, failed=0)
+        self.pause_latency = Histogram()
+
+    def submit(self, func, min_idle, on_activity='pause', name=None):
+        """Runs func(job) once the user has been idle for min_idle ms, and
+        returns the Job.  func should call job.checkpoint() regularly."""
+        return self._add(_CallableJob(self, func, min_idle, on_activity,
+                                      name))
+
+    def submit_process(self, args, min_idle, on_activity='pause', **kwargs):
+        """Runs subprocess.Popen(args, **kwargs) once the user has been idle
+        for min_idle ms, and returns the Job.  Its whole process group is
+        stopped on input with 'pause'."""
+        return self._add(_ProcessJob(self, args, min_idle, on_activity,
+                                     kwargs))
+
+    def _add(self, job):
+        with self.lock:
+            self.jobs.append(job)
+        self._wake()
+        return job
+
+    def _cancel(self, job):
+        with self.lock:
+            if not job._done():
+                job._cancel(monotonic_ms(), 'cancelled')
+                self._finish(job, 'cancelled')
+        self._wake()
+
+    def _reap(self, process, pidfd, now):
+        """Takes a cancelled job's process, to be reaped (and killed after
+        kill_grace) by the scheduler thread.  The lock must be held."""
+        self.exiting.append([process, pidfd, now + self.kill_grace])
+
+    def _pipe(self):
+        # both ends non-blocking: a full pipe already means a wakeup
+        self.wake_r, self.wake_w = os.pipe()
+        os.set_blocking(self.wake_r, False)
+        os.set_blocking(self.wake_w, False)
+
+    def _wake(self):
+        with self.lock:
+            if self.wake_w is None:
+                return
+            try:
+                os.write(self.wake_w, b'x')
+            except BlockingIOError:
+                pass
+
+    def start(self):
+        """Runs the scheduler in a thread of its own."""
+        with self.lock:
+            if self.wake_r is None:
+                self._pipe()
+        self.stopping = False
+        self.thread = threading.Thread(target=self.run, daemon=True,
+                                       name="pyxss scheduler")
+        self.thread.start()
+
+    def stop(self, cancel=True):
+        """Stops the scheduler thread, first cancelling the jobs still
+        running or paused if cancel is set, and waits for cancelled
+        processes to exit (killing them after kill_grace)."""
+        self.stopping = True
+        self._wake()
+        if self.thread is not None:
+            self.thread.join()
+            self.thread = None
+        with self.lock:
+            if cancel:
+                now = monotonic_ms()
+                for job in self.jobs:
+                    if job.state in ('running', 'paused'):
+                        job._cancel(now, 'cancelled')
+                        self._finish(job, 'cancelled')
+                self._account(now, None)
+            exiting, self.exiting = self.exiting, []
+            if self.wake_r is not None:
+                os.close(self.wake_r)
+                os.close(self.wake_w)
+                self.wake_r = self.wake_w = None
+        # no scheduler thread to reap them now, and no lock held
+        for process, pidfd, kill_at in exiting:
+            try:
+                process.wait(max((kill_at or 0) - monotonic_ms(), 0) / 1000.0)
+            except subprocess.TimeoutExpired:
+                try:
+                    os.killpg(process.pid, signal.SIGKILL)
+                except ProcessLookupError:
+                    pass
+                process.wait()
+            if pidfd is not None:
+                os.close(pidfd)
+
+    def run(self):
+        """The scheduler loop; start() runs it in a thread."""
+        while not self.stopping:
+            with self.lock:
+                timeout = self.step()
+            self._wait(timeout)
+
+    def _idle(self):
+        """Idle time in ms, or None if it can't be had."""
+        try:
+            if self.watch is not None:
+                return self.watch.info().idle
+            if self.backend is not None:
+                return self.backend.get_info().idle
+            from . import get_info
+            return get_info().idle
+        except RuntimeError:
+            return None
+
+    def _finish(self, job, state):
+        self.counts[state] += 1
+        job.finished.set()
+
+    def step(self):
+        """Starts, pauses and resumes jobs for the idle time now.  Returns
+        how long to wait before the next step (None: until something
+        happens).  The lock must be held."""
+        now = monotonic_ms()
+        idle = self._idle()
+        self._reap_exiting(now)
+        for job in self.jobs:
+            if job.state in ('running', 'paused') and job._poll(now):
+                self._finish(job, job.state)
+        self.jobs = [job for job in self.jobs if not job._done()]
+
+        active = self._active(idle)
+        running = [job for job in self.jobs if job.state == 'running']
+        if active and running:
+            # input since the jobs started: the idle time is how long ago
+            self.pause_latency.add(idle)
+            for job in running:
+                if job.on_activity == 'pause':
+                    job._pause(now)
+                    self.counts['paused'] += 1
+                elif job.on_activity == 'restart':
+                    job._cancel(now, 'waiting')
+                    self.counts['restarted'] += 1
+                else:
+                    job._cancel(now, 'cancelled')
+                    self._finish(job, 'cancelled')
+            running = []
+        self.last_idle = idle
+
+        if idle is not None:
+            slots = self.max_jobs - len(running)
+            for job in self.jobs:   # paused ones first: they hold resources
+                if slots and job.state == 'paused' and idle >= job.min_idle:
+                    job._resume(now)
+                    self.counts['resumed'] += 1
+                    slots -= 1
+            for job in self.jobs:
+                if slots and job.state == 'waiting' and \
+                        idle >= job.min_idle and job._ready():
+                    try:
+                        job._start(now)
+                    except OSError as e:    # say, no such program
+                        job.error = e
+                        job._stop(now, 'failed')
+                        self._finish(job, 'failed')
+                        continue
+                    self.counts['started'] += 1
+                    slots -= 1
+        self._account(now, idle)
+        return self._timeout(now, idle)
+
+    def _reap_exiting(self, now):
+        """Reaps cancelled processes that have exited, closing their
+        pidfds, and kills the ones past their grace period."""
+        exiting = []
+        for entry in self.exiting:
+            process, pidfd, kill_at = entry
+            if process.poll() is not None:
+                if pidfd is not None:
+                    os.close(pidfd)
+                continue
+            if now >= kill_at:
+                try:
+                    os.killpg(process.pid, signal.SIGKILL)
+                except ProcessLookupError:
+                    pass
+                entry[2] = None     # just waiting for it now
+            exiting.append(entry)
+        self.exiting = exiting
+
+    def _active(self, idle):
+        """Whether there has been input since the last step."""
+        if idle is None or self.last_idle is None:
+            return False
+        return idle < self.last_idle
+
+    def _account(self, now, idle):
+        """Keeps the idle window and busy time totals."""
+        pending = [job for job in self.jobs if not job._done()]
+        in_window = idle is not None and \
+            any(idle >= job.min_idle for job in pending)
+        busy = any(job.state == 'running' for job in pending)
+        if in_window and self.window_start is None:
+            self.window_start = now
+            self.windows += 1
+        elif not in_window and self.window_start is not None:
+            self.window_ms += now - self.window_start
+            self.window_start = None
+        if busy and self.busy_start is None:
+            self.busy_start = now
+        elif not busy and self.busy_start is not None:
+            self.busy_ms += now - self.busy_start
+            self.busy_start = None
+
+    def _timeout(self, now, idle):
+        """How long until the next job's min_idle is reached, and whether
+        input has to be looked for by polling meanwhile."""
+        pending = [job for job in self.jobs if job.state in ('waiting',
+                                                             'paused')]
+        running = any(job.state == 'running' for job in self.jobs)
+        waits = [job.min_idle - idle for job in pending
+                 if idle is not None and idle < job.min_idle]
+        if idle is None and pending:
+            waits.append(1000)      # try again for idle time
+        if running and self.mode == 'poll':
+            waits.append(self.poll_interval)
+        if any(isinstance(job, _ProcessJob) and job.pidfd is None
+               for job in self.jobs if job.state == 'running'):
+            # without a pidfd, exits are noticed on the next step
+            waits.append(250)
+        if any(job.state == 'waiting' and not job._ready()
+               for job in self.jobs):
+            waits.append(50)        # a cancelled job winding down
+        for process, pidfd, kill_at in self.exiting:
+            if kill_at is not None:
+                waits.append(kill_at - now)
+            if pidfd is None or kill_at is None:
+                waits.append(250)
+        if running and self.mode == 'alarm':
+            self._arm()
+        return max(min(waits), 0) if waits else None
+
+    def _arm(self):
+        """Keeps a SYNC alarm at the smallest min_idle of the running jobs:
+        they all started with idle time past it, so the first input sends
+        its WatchActive event."""
+        threshold = min(job.min_idle for job in self.jobs
+                        if job.state == 'running')
+        threshold = max(threshold, 1)
+        if self.alarm is not None and self.alarm[1] == threshold:
+            return
+        if self.alarm is not None:
+            self.watch.remove_alarm(self.alarm[0])
+        index = self.watch.add_alarm(threshold)
+        self.alarm = (index, threshold) if index >= 0 else None
+
+    def _wait(self, timeout):
+        fds = [self.wake_r]
+        if self.mode == 'alarm':
+            fds.append(self.watch.fileno())
+        elif self.mode == 'evdev':
+            fds.append(self.backend.monitor.fileno())
+        # only this thread closes pidfds, so they stay open through select
+        with self.lock:
+            fds += [job.pidfd for job in self.jobs
+                    if getattr(job, 'pidfd', None) is not None]
+            fds += [pidfd for process, pidfd, kill_at in self.exiting
+                    if pidfd is not None]
+        if self.mode == 'alarm' and self.watch.pending():
+            timeout = 0
+        select.select(fds, [], [], None if timeout is None
+                      else timeout / 1000.0)
+        try:
+            while os.read(self.wake_r, 64):
+                pass
+        except BlockingIOError:
+            pass
+        if self.mode == 'alarm':
+            # the events only wake us up: the step reads idle time itself
+            self.watch.pump()
+            while self.watch.next() is not None:
+                pass
+        elif self.mode == 'evdev':
+            self.backend.monitor.pump()
+
+    def stats(self):
+        """A dict of how the idle windows were used: windows, window_ms,
+        busy_ms, utilization (busy_ms / window_ms), the job counts, and
+        pause_ms, a Histogram of input-to-pause latencies."""
+        with self.lock:
+            now = monotonic_ms()
+            window_ms = self.window_ms
+            busy_ms = self.busy_ms
+            if self.window_start is not None:
+                window_ms += now - self.window_start
+            if self.busy_start is not None:
+                busy_ms += now - self.busy_start
+            stats = dict(self.counts, mode=self.mode, windows=self.windows,
+                         window_ms=window_ms, busy_ms=busy_ms,
+                         utilization=busy_ms / window_ms if window_ms else 0.0,
+                         pause_ms=self.pause_latency)
+        return stats
@@ -13,12 +13,21 @@
      crossplatform exceptions.
    - Started sometime around 9.22.2002 */
 
-%module xss
+%module(threads="1") xss
 
 %{
+#include <pthread.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
 #include <X11/extensions/scrnsaver.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/screensaver.h>
+#include <xcb/dpms.h>
+#include <X11/extensions/XInput2.h>
+#include <poll.h>
+#include <time.h>
 %}
 
 /* from X11/extensions/scrnsaver.h */
@@ -41,6 +50,12 @@ typedef struct {
 #define ScreenSaverInternal     1
 #define ScreenSaverExternal     2
 
+/* from X11/extensions/dpmsconst.h */
+#define DPMSModeOn              0
+#define DPMSModeStandby         1
+#define DPMSModeSuspend         2
+#define DPMSModeOff             3
+
 %include "exception.i"
 %exception get_info {
   $action
@@ -50,31 +65,4829 @@ typedef struct {
   }
 }
 
+/* The connection, query and tracker logic lives in libpyxss (core/), which
+   setup.py compiles into the module; this file wraps it and adds what only
+   makes sense here.  Probes are described in core/pyxss_probes.h. */
+
+%{
+#include "pyxss.h"
+#include "pyxss_probes.h"
+%}
+
+/* Query profiling, for finding out where concurrent queries spend their
+   time (see test/threads1.py).  It is off until profile_queries(1); then
+   every query path counts its queries and the X round trips it waited
+   on (connection setup aside), and the object locks on those paths count
+   how often they had to be waited for, and for how long.  The counters
+   are process-wide; while profiling is off each path pays one load. */
+
+%{
+typedef struct {
+    unsigned long queries;
+    unsigned long round_trips;
+    unsigned long locks;        /* object locks taken on query paths */
+    unsigned long contended;    /* ... that another thread held */
+    double lock_wait_ms;        /* time spent waiting for those */
+} QueryStats;
+
+static struct {
+    int enabled;
+    unsigned long queries, round_trips, locks, contended;
+    long long lock_wait_ns;
+} profile;
+
+#define PROFILING() __atomic_load_n(&profile.enabled, __ATOMIC_RELAXED)
+
+static void profile_query(unsigned long queries, unsigned long round_trips) {
+    if (!PROFILING())
+        return;
+    __atomic_fetch_add(&profile.queries, queries, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile.round_trips, round_trips, __ATOMIC_RELAXED);
+}
+
+/* pthread_mutex_lock(), timing the wait while profiling. */
+static void profile_lock(pthread_mutex_t *lock) {
+    long long start;
+
+    if (!PROFILING()) {
+        pthread_mutex_lock(lock);
+        return;
+    }
+    __atomic_fetch_add(&profile.locks, 1, __ATOMIC_RELAXED);
+    if (pthread_mutex_trylock(lock) == 0)
+        return;
+    start = monotonic_ns();
+    pthread_mutex_lock(lock);
+    __atomic_fetch_add(&profile.contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile.lock_wait_ns, monotonic_ns() - start,
+                       __ATOMIC_RELAXED);
+}
+%}
+
+%newobject get_query_stats;
+%inline %{
+/* Turns query profiling on or off; returns whether it was on. */
+int profile_queries(int enable) {
+    return __atomic_exchange_n(&profile.enabled, enable != 0,
+                               __ATOMIC_RELAXED);
+}
+
+QueryStats *get_query_stats(void) {
+    QueryStats *stats = (QueryStats *) malloc(sizeof(QueryStats));
+
+    if (!stats)
+        return NULL;
+    stats->queries = __atomic_load_n(&profile.queries, __ATOMIC_RELAXED);
+    stats->round_trips = __atomic_load_n(&profile.round_trips,
+                                         __ATOMIC_RELAXED);
+    stats->locks = __atomic_load_n(&profile.locks, __ATOMIC_RELAXED);
+    stats->contended = __atomic_load_n(&profile.contended, __ATOMIC_RELAXED);
+    stats->lock_wait_ms = __atomic_load_n(&profile.lock_wait_ns,
+                                          __ATOMIC_RELAXED) / 1e6;
+    return stats;
+}
+
+void reset_query_stats(void) {
+    __atomic_store_n(&profile.queries, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile.round_trips, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile.locks, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile.contended, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile.lock_wait_ns, 0, __ATOMIC_RELAXED);
+}
+%}
+
+typedef struct {
+    %immutable;
+    unsigned long queries;
+    unsigned long round_trips;
+    unsigned long locks;
+    unsigned long contended;
+    double lock_wait_ms;
+    %mutable;
+} QueryStats;
+
 %inline %{
+/* Whether the module was built with static probes. */
+int have_probes(void) {
+#ifdef HAVE_SYS_SDT_H
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Fires the tracker probe, for trackers written in Python; IdleTracker and
+   XSSTracker fire it from libpyxss when they report a change. */
+void trace_tracker(const char *tracker, const char *change, long idle,
+                   long wait) {
+    XSS_PROBE4(tracker, tracker, change, idle, wait);
+}
+%}
 
-int event_base, error_base;
-static XScreenSaverInfo *mit_info;
+%newobject get_info;
 
-Display *dpy;
-int screen;
-Window root;
+%inline %{
 
+/* Queries this thread's own connection (see pyxss_get_info()). */
 XScreenSaverInfo* get_info(void) {
-    if (XScreenSaverQueryExtension(dpy, &event_base, &error_base)) {
-            mit_info = XScreenSaverAllocInfo();
-            XScreenSaverQueryInfo(dpy, root, mit_info);
-            return mit_info;
-    } else {
+    XScreenSaverInfo *info;
+    int got;
+
+    info = (XScreenSaverInfo *) calloc(1, sizeof(XScreenSaverInfo));
+    if (!info)
+        return NULL;
+    got = pyxss_get_info(info);
+    /* a sample the governor shared cost no round trip */
+    profile_query(1, got == PYXSS_QUERIED);
+    if (!got) {
+        free(info);
         return NULL;
     }
+    return info;
 }
 
 %} // end %inline
 
-%init %{
-    dpy = XOpenDisplay("");
-    screen = DefaultScreen(dpy);
-    root = RootWindow(dpy, screen);
+/* The query governor (see pyxss_governor_enable()): a cap on the queries
+   a second that get_info(), and everything built on it, makes to the X
+   server together with every other process that turns it on. */
+
+%{
+typedef pyxss_governor_stats GovernorStats;
+
+static int govern_queries(double rate, double burst) {
+    return pyxss_governor_enable(rate, burst);
+}
+
+static GovernorStats *get_governor_stats(void) {
+    GovernorStats *stats = (GovernorStats *) malloc(sizeof(GovernorStats));
+
+    if (stats)
+        pyxss_governor_read_stats(stats);
+    return stats;
+}
+%}
+
+%exception govern_queries {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't open the query governor.");
+     return NULL;
+  }
+}
+
+/* Turns the governor on at rate queries a second (bursts of burst), or off
+   with a rate of 0. */
+int govern_queries(double rate, double burst=1);
+%newobject get_governor_stats;
+GovernorStats *get_governor_stats(void);
+
+typedef struct {
+    %immutable;
+    double rate;
+    double burst;
+    unsigned long queries;
+    unsigned long cached;
+    unsigned long shared_queries;
+    unsigned long shared_cached;
+    %mutable;
+} GovernorStats;
+
+/* The trackers' state machines, libpyxss's pyxss_idle_tracker and
+   pyxss_saver_tracker, for xss.IdleTracker and xss.XSSTracker to drive
+   with samples from any backend.  update() takes a sample's fields and
+   returns the change it makes ("idle", "unidle", "disabled" or None), and
+   failed() takes a failed query; either leaves how long to wait before the
+   next sample in wait. */
+
+%{
+typedef struct {
+    pyxss_idle_tracker tracker;
+    long wait;
+    pthread_mutex_t lock;
+} IdleTrackerCore;
+
+typedef struct {
+    pyxss_saver_tracker tracker;
+    long wait;
+    pthread_mutex_t lock;
+} XSSTrackerCore;
+
+IdleTrackerCore *new_IdleTrackerCore(long idle_threshold,
+                                     long when_idle_wait,
+                                     long when_disabled_wait) {
+    IdleTrackerCore *self = (IdleTrackerCore *) calloc(1, sizeof(*self));
+
+    if (!self)
+        return NULL;
+    pyxss_idle_tracker_init(&self->tracker, idle_threshold, when_idle_wait,
+                            when_disabled_wait);
+    pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_IdleTrackerCore(IdleTrackerCore *self) {
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+static const char *idle_tracker_update(IdleTrackerCore *self,
+                                       const XScreenSaverInfo *info) {
+    int change;
+
+    pthread_mutex_lock(&self->lock);
+    change = pyxss_idle_tracker_update(&self->tracker, info, &self->wait);
+    pthread_mutex_unlock(&self->lock);
+    return pyxss_change_name(change);
+}
+
+const char *IdleTrackerCore_update(IdleTrackerCore *self, unsigned long idle,
+                                   int state, unsigned long til_or_since) {
+    XScreenSaverInfo info;
+
+    memset(&info, 0, sizeof(info));
+    info.idle = idle;
+    info.state = state;
+    info.til_or_since = til_or_since;
+    return idle_tracker_update(self, &info);
+}
+
+const char *IdleTrackerCore_failed(IdleTrackerCore *self) {
+    return idle_tracker_update(self, NULL);
+}
+
+/* The trackers' settings and state are read and changed under the
+   lock. */
+#define TRACKER_GET(type, name, field) \
+    long type##_##name##_get(type *self) { \
+        long value; \
+        pthread_mutex_lock(&self->lock); \
+        value = self->field; \
+        pthread_mutex_unlock(&self->lock); \
+        return value; \
+    }
+#define TRACKER_ATTR(type, name, field) \
+    TRACKER_GET(type, name, field) \
+    void type##_##name##_set(type *self, long value) { \
+        pthread_mutex_lock(&self->lock); \
+        self->field = value; \
+        pthread_mutex_unlock(&self->lock); \
+    }
+
+TRACKER_ATTR(IdleTrackerCore, idle_threshold, tracker.idle_threshold)
+TRACKER_ATTR(IdleTrackerCore, when_idle_wait, tracker.when_idle_wait)
+TRACKER_ATTR(IdleTrackerCore, when_disabled_wait, tracker.when_disabled_wait)
+TRACKER_ATTR(IdleTrackerCore, last_state, tracker.last_state)
+TRACKER_GET(IdleTrackerCore, wait, wait)
+
+XSSTrackerCore *new_XSSTrackerCore(long when_idle_wait,
+                                   long when_disabled_wait) {
+    XSSTrackerCore *self = (XSSTrackerCore *) calloc(1, sizeof(*self));
+
+    if (!self)
+        return NULL;
+    pyxss_saver_tracker_init(&self->tracker, when_idle_wait,
+                             when_disabled_wait);
+    pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_XSSTrackerCore(XSSTrackerCore *self) {
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+static const char *saver_tracker_update(XSSTrackerCore *self,
+                                        const XScreenSaverInfo *info) {
+    int change;
+
+    pthread_mutex_lock(&self->lock);
+    change = pyxss_saver_tracker_update(&self->tracker, info, &self->wait);
+    pthread_mutex_unlock(&self->lock);
+    return pyxss_change_name(change);
+}
+
+const char *XSSTrackerCore_update(XSSTrackerCore *self, unsigned long idle,
+                                  int state, unsigned long til_or_since) {
+    XScreenSaverInfo info;
+
+    memset(&info, 0, sizeof(info));
+    info.idle = idle;
+    info.state = state;
+    info.til_or_since = til_or_since;
+    return saver_tracker_update(self, &info);
+}
+
+const char *XSSTrackerCore_failed(XSSTrackerCore *self) {
+    return saver_tracker_update(self, NULL);
+}
+
+TRACKER_ATTR(XSSTrackerCore, when_idle_wait, tracker.when_idle_wait)
+TRACKER_ATTR(XSSTrackerCore, when_disabled_wait, tracker.when_disabled_wait)
+TRACKER_ATTR(XSSTrackerCore, last_state, tracker.last_state)
+TRACKER_GET(XSSTrackerCore, wait, wait)
+
+#undef TRACKER_ATTR
+#undef TRACKER_GET
+%}
+
+%exception IdleTrackerCore::IdleTrackerCore {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't create a tracker.");
+     return NULL;
+  }
+}
+%exception XSSTrackerCore::XSSTrackerCore {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't create a tracker.");
+     return NULL;
+  }
+}
+
+typedef struct {
+} IdleTrackerCore;
+
+%extend IdleTrackerCore {
+    IdleTrackerCore(long idle_threshold = 60000, long when_idle_wait = 5000,
+                    long when_disabled_wait = 120000);
+    ~IdleTrackerCore();
+    const char *update(unsigned long idle, int state = ScreenSaverOff,
+                       unsigned long til_or_since = 0);
+    const char *failed();
+    long idle_threshold;
+    long when_idle_wait;
+    long when_disabled_wait;
+    long last_state;            /* PYXSS_IDLE (1), PYXSS_UNIDLE (2), or 0 */
+    %immutable;
+    long wait;
+    %mutable;
+}
+
+typedef struct {
+} XSSTrackerCore;
+
+%extend XSSTrackerCore {
+    XSSTrackerCore(long when_idle_wait = 5000,
+                   long when_disabled_wait = 120000);
+    ~XSSTrackerCore();
+    const char *update(unsigned long idle, int state = ScreenSaverOff,
+                       unsigned long til_or_since = 0);
+    const char *failed();
+    long when_idle_wait;
+    long when_disabled_wait;
+    long last_state;            /* ScreenSaverOff, On, Cycle or Disabled */
+    %immutable;
+    long wait;
+    %mutable;
+}
+
+/* XCBEngine: the same query over XCB, where requests are cookies that can
+   be issued for many screens on many displays before any reply is waited
+   for.  submit() sends one QueryInfo per screen and flushes each connection
+   once, poll() collects whatever replies have arrived without blocking,
+   and wait() blocks for the rest.  Results are read with result(i), where
+   i counts screens in the order their displays were added. */
+
+%{
+typedef struct {
+    xcb_connection_t *c;
+    xcb_window_t root;
+    int owner;                  /* first screen of its display: disconnects */
+    unsigned int sequence;      /* QueryInfo in flight, or 0 */
+    int valid;                  /* info holds a reply */
+    int negotiated;             /* extension reply seen (for the probe) */
+    long long sent;             /* when the query went out, if traced */
+    XScreenSaverInfo info;
+} XCBScreenQuery;
+
+typedef struct {
+    XCBScreenQuery *screens;
+    int nscreens;
+    int pending;
+    pthread_mutex_t lock;
+} XCBEngine;
+
+XCBEngine *new_XCBEngine(void) {
+    XCBEngine *self = (XCBEngine *) calloc(1, sizeof(XCBEngine));
+    if (self)
+        pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_XCBEngine(XCBEngine *self) {
+    int i;
+    for (i = 0; i < self->nscreens; i++) {
+        if (self->screens[i].sequence)
+            xcb_discard_reply(self->screens[i].c, self->screens[i].sequence);
+    }
+    for (i = 0; i < self->nscreens; i++) {
+        if (self->screens[i].owner)
+            xcb_disconnect(self->screens[i].c);
+    }
+    free(self->screens);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+/* Connects to a display (NULL for $DISPLAY) and adds all of its screens.
+   Returns the index of the display's first screen, or -1. */
+static int xcb_engine_add_display(XCBEngine *self, const char *name) {
+    const xcb_setup_t *setup;
+    xcb_screen_iterator_t iter;
+    XCBScreenQuery *screens;
+    xcb_connection_t *c;
+    int first = self->nscreens;
+    long long start = XSS_PROBE_CLOCK(connect);
+
+    c = xcb_connect(name && *name ? name : NULL, NULL);
+    XSS_PROBE3(connect, XSS_ENGINE_XCB, !xcb_connection_has_error(c),
+               XSS_PROBE_SINCE(start));
+    if (xcb_connection_has_error(c)) {
+        xcb_disconnect(c);
+        return -1;
+    }
+    /* ask for the extensions now so the replies are there when needed */
+    xcb_prefetch_extension_data(c, &xcb_screensaver_id);
+    xcb_prefetch_extension_data(c, &xcb_dpms_id);
+
+    setup = xcb_get_setup(c);
+    screens = (XCBScreenQuery *) realloc(self->screens,
+        (self->nscreens + xcb_setup_roots_length(setup)) *
+        sizeof(XCBScreenQuery));
+    if (!screens) {
+        xcb_disconnect(c);
+        return -1;
+    }
+    self->screens = screens;
+    for (iter = xcb_setup_roots_iterator(setup); iter.rem;
+         xcb_screen_next(&iter)) {
+        XCBScreenQuery *s = &self->screens[self->nscreens++];
+        memset(s, 0, sizeof(*s));
+        s->c = c;
+        s->root = iter.data->root;
+        s->owner = (s == &self->screens[first]);
+    }
+    return first;
+}
+
+static void xcb_engine_collect(XCBEngine *self, XCBScreenQuery *s,
+                               xcb_screensaver_query_info_reply_t *reply,
+                               xcb_generic_error_t *error) {
+    XSS_PROBE4(query_end, XSS_ENGINE_XCB, (int) (s - self->screens),
+               reply != NULL, XSS_PROBE_SINCE(s->sent));
+    s->sequence = 0;
+    self->pending--;
+    s->valid = (reply != NULL);
+    if (reply) {
+        s->info.window = reply->saver_window;
+        s->info.state = reply->state;
+        s->info.kind = reply->kind;
+        s->info.til_or_since = reply->ms_until_server;
+        s->info.idle = reply->ms_since_user_input;
+        s->info.eventMask = reply->event_mask;
+    }
+    free(reply);
+    free(error);
+}
+
+static void xcb_engine_send(XCBEngine *self, XCBScreenQuery *s) {
+    const xcb_query_extension_reply_t *ext;
+
+    long long start;
+
+    if (s->sequence)
+        return;
+    start = s->negotiated ? 0 : XSS_PROBE_CLOCK(extension);
+    ext = xcb_get_extension_data(s->c, &xcb_screensaver_id);
+    if (!s->negotiated) {
+        s->negotiated = 1;
+        XSS_PROBE3(extension, XSS_ENGINE_XCB, ext && ext->present,
+                   XSS_PROBE_SINCE(start));
+    }
+    if (xcb_connection_has_error(s->c)) {
+        if (s->valid)
+            XSS_PROBE2(connection_lost, XSS_ENGINE_XCB,
+                       (int) (s - self->screens));
+        s->valid = 0;
+        return;
+    }
+    if (!ext || !ext->present) {
+        s->valid = 0;
+        return;
+    }
+    s->sent = XSS_PROBE_CLOCK(query_end);
+    XSS_PROBE2(query_start, XSS_ENGINE_XCB, (int) (s - self->screens));
+    s->sequence = xcb_screensaver_query_info(s->c, s->root).sequence;
+    self->pending++;
+}
+
+/* Sends a QueryInfo for every screen that doesn't have one in flight.
+   Returns the number of queries in flight. */
+static int xcb_engine_submit(XCBEngine *self) {
+    int i;
+    for (i = 0; i < self->nscreens; i++)
+        xcb_engine_send(self, &self->screens[i]);
+    for (i = 0; i < self->nscreens; i++) {
+        if (self->screens[i].owner)
+            xcb_flush(self->screens[i].c);
+    }
+    return self->pending;
+}
+
+/* Collects the replies that have already arrived.  Never blocks.
+   Returns the number of queries still in flight. */
+static int xcb_engine_poll(XCBEngine *self) {
+    int i;
+    for (i = 0; i < self->nscreens && self->pending; i++) {
+        XCBScreenQuery *s = &self->screens[i];
+        void *reply = NULL;
+        xcb_generic_error_t *error = NULL;
+        if (s->sequence && xcb_poll_for_reply(s->c, s->sequence, &reply,
+                                              &error))
+            xcb_engine_collect(self, s, reply, error);
+    }
+    return self->pending;
+}
+
+/* Blocks until every query in flight has its reply. */
+static void xcb_engine_wait(XCBEngine *self) {
+    int i;
+    for (i = 0; i < self->nscreens && self->pending; i++) {
+        XCBScreenQuery *s = &self->screens[i];
+        xcb_screensaver_query_info_cookie_t cookie;
+        xcb_generic_error_t *error = NULL;
+        if (!s->sequence)
+            continue;
+        cookie.sequence = s->sequence;
+        xcb_engine_collect(self, s,
+            xcb_screensaver_query_info_reply(s->c, cookie, &error), error);
+    }
+}
+
+/* The latest result for screen i, or NULL if it has none. */
+static XScreenSaverInfo *xcb_engine_result(XCBEngine *self, int i) {
+    XScreenSaverInfo *info;
+    if (i < 0 || i >= self->nscreens || !self->screens[i].valid)
+        return NULL;
+    info = (XScreenSaverInfo *) malloc(sizeof(XScreenSaverInfo));
+    if (info)
+        *info = self->screens[i].info;
+    return info;
+}
+
+/* One blocking round trip for screen i, like get_info(). */
+static XScreenSaverInfo *xcb_engine_query(XCBEngine *self, int i) {
+    xcb_screensaver_query_info_cookie_t cookie;
+    xcb_generic_error_t *error = NULL;
+    XCBScreenQuery *s;
+    if (i < 0 || i >= self->nscreens)
+        return NULL;
+    s = &self->screens[i];
+    xcb_engine_send(self, s);
+    if (!s->sequence)
+        return NULL;
+    cookie.sequence = s->sequence;
+    xcb_engine_collect(self, s,
+        xcb_screensaver_query_info_reply(s->c, cookie, &error), error);
+    return xcb_engine_result(self, i);
+}
+
+/* Everything a power policy decision needs, read in one round trip: the
+   screensaver info, the core screensaver settings (GetScreenSaver, in
+   seconds) and, if the server has DPMS, its state and timeouts (also in
+   seconds). */
+typedef struct {
+    int state;
+    int kind;
+    unsigned long til_or_since;
+    unsigned long idle;
+    int saver_timeout;
+    int saver_interval;
+    int prefer_blanking;
+    int allow_exposures;
+    int dpms_available;
+    int dpms_enabled;
+    int dpms_level;
+    int standby_timeout;
+    int suspend_timeout;
+    int off_timeout;
+} PowerSnapshot;
+
+/* Sends QueryInfo, GetScreenSaver and DPMS Info and GetTimeouts for screen
+   i with a single flush, then collects the four replies. */
+static PowerSnapshot *xcb_engine_snapshot(XCBEngine *self, int i) {
+    const xcb_query_extension_reply_t *ext;
+    xcb_screensaver_query_info_cookie_t info_cookie;
+    xcb_get_screen_saver_cookie_t saver_cookie;
+    xcb_dpms_info_cookie_t dpms_cookie;
+    xcb_dpms_get_timeouts_cookie_t timeouts_cookie;
+    xcb_screensaver_query_info_reply_t *info;
+    xcb_get_screen_saver_reply_t *saver;
+    PowerSnapshot *snap;
+    XCBScreenQuery *s;
+    int dpms;
+
+    if (i < 0 || i >= self->nscreens)
+        return NULL;
+    s = &self->screens[i];
+    ext = xcb_get_extension_data(s->c, &xcb_screensaver_id);
+    if (xcb_connection_has_error(s->c) || !ext || !ext->present)
+        return NULL;
+    ext = xcb_get_extension_data(s->c, &xcb_dpms_id);
+    dpms = ext && ext->present;
+
+    info_cookie = xcb_screensaver_query_info(s->c, s->root);
+    saver_cookie = xcb_get_screen_saver(s->c);
+    if (dpms) {
+        dpms_cookie = xcb_dpms_info(s->c);
+        timeouts_cookie = xcb_dpms_get_timeouts(s->c);
+    }
+    xcb_flush(s->c);
+
+    snap = (PowerSnapshot *) calloc(1, sizeof(PowerSnapshot));
+    info = xcb_screensaver_query_info_reply(s->c, info_cookie, NULL);
+    saver = xcb_get_screen_saver_reply(s->c, saver_cookie, NULL);
+    if (info && saver && snap) {
+        snap->state = info->state;
+        snap->kind = info->kind;
+        snap->til_or_since = info->ms_until_server;
+        snap->idle = info->ms_since_user_input;
+        snap->saver_timeout = saver->timeout;
+        snap->saver_interval = saver->interval;
+        snap->prefer_blanking = saver->prefer_blanking;
+        snap->allow_exposures = saver->allow_exposures;
+    } else {
+        free(snap);
+        snap = NULL;
+    }
+    free(info);
+    free(saver);
+
+    if (dpms) {
+        xcb_dpms_info_reply_t *state =
+            xcb_dpms_info_reply(s->c, dpms_cookie, NULL);
+        xcb_dpms_get_timeouts_reply_t *timeouts =
+            xcb_dpms_get_timeouts_reply(s->c, timeouts_cookie, NULL);
+        if (snap && state && timeouts) {
+            snap->dpms_available = 1;
+            snap->dpms_enabled = state->state;
+            snap->dpms_level = state->power_level;
+            snap->standby_timeout = timeouts->standby_timeout;
+            snap->suspend_timeout = timeouts->suspend_timeout;
+            snap->off_timeout = timeouts->off_timeout;
+        }
+        free(state);
+        free(timeouts);
+    }
+    return snap;
+}
+
+/* The connection's file descriptor, for select() and friends. */
+static int xcb_engine_fileno(XCBEngine *self, int i) {
+    if (i < 0 || i >= self->nscreens)
+        return -1;
+    return xcb_get_file_descriptor(self->screens[i].c);
+}
+/* The entry points: each takes the engine's lock, so an engine can be
+   shared between threads.  The helpers above expect it to be held. */
+
+int XCBEngine_add_display(XCBEngine *self, const char *name) {
+    int first;
+    pthread_mutex_lock(&self->lock);
+    first = xcb_engine_add_display(self, name);
+    pthread_mutex_unlock(&self->lock);
+    return first;
+}
+
+int XCBEngine_submit(XCBEngine *self) {
+    int pending, before;
+    profile_lock(&self->lock);
+    before = self->pending;
+    pending = xcb_engine_submit(self);
+    pthread_mutex_unlock(&self->lock);
+    profile_query((unsigned long) (pending - before), 0);
+    return pending;
+}
+
+int XCBEngine_poll(XCBEngine *self) {
+    int pending;
+    profile_lock(&self->lock);
+    pending = xcb_engine_poll(self);
+    pthread_mutex_unlock(&self->lock);
+    return pending;
+}
+
+void XCBEngine_wait(XCBEngine *self) {
+    int pending;
+    profile_lock(&self->lock);
+    pending = self->pending;
+    xcb_engine_wait(self);
+    pthread_mutex_unlock(&self->lock);
+    /* the replies in flight are all waited for at once */
+    profile_query(0, pending > 0);
+}
+
+XScreenSaverInfo *XCBEngine_result(XCBEngine *self, int i) {
+    XScreenSaverInfo *info;
+    profile_lock(&self->lock);
+    info = xcb_engine_result(self, i);
+    pthread_mutex_unlock(&self->lock);
+    return info;
+}
+
+XScreenSaverInfo *XCBEngine_query(XCBEngine *self, int i) {
+    XScreenSaverInfo *info;
+    profile_lock(&self->lock);
+    info = xcb_engine_query(self, i);
+    pthread_mutex_unlock(&self->lock);
+    profile_query(1, info != NULL);
+    return info;
+}
+
+PowerSnapshot *XCBEngine_snapshot(XCBEngine *self, int i) {
+    PowerSnapshot *snap;
+    profile_lock(&self->lock);
+    snap = xcb_engine_snapshot(self, i);
+    pthread_mutex_unlock(&self->lock);
+    profile_query(1, snap != NULL);
+    return snap;
+}
+
+int XCBEngine_fileno(XCBEngine *self, int i) {
+    int fd;
+    pthread_mutex_lock(&self->lock);
+    fd = xcb_engine_fileno(self, i);
+    pthread_mutex_unlock(&self->lock);
+    return fd;
+}
+%}
+
+%newobject XCBEngine::result;
+%newobject XCBEngine::query;
+%newobject XCBEngine::snapshot;
+%exception XCBEngine::add_display {
+  $action
+  if (result < 0) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't connect to display.");
+     return NULL;
+  }
+}
+%exception XCBEngine::result {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "No screensaver info for screen.");
+     return NULL;
+  }
+}
+%exception XCBEngine::query {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't query screensaver extension.");
+     return NULL;
+  }
+}
+
+%exception XCBEngine::snapshot {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't query screensaver extension.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    int state;
+    int kind;
+    unsigned long til_or_since;
+    unsigned long idle;
+    int saver_timeout;
+    int saver_interval;
+    int prefer_blanking;
+    int allow_exposures;
+    int dpms_available;
+    int dpms_enabled;
+    int dpms_level;
+    int standby_timeout;
+    int suspend_timeout;
+    int off_timeout;
+    %mutable;
+} PowerSnapshot;
+
+typedef struct {
+    %immutable;
+    int nscreens;
+    int pending;
+    %mutable;
+} XCBEngine;
+
+%extend XCBEngine {
+    XCBEngine();
+    ~XCBEngine();
+    int add_display(const char *name);
+    int submit();
+    int poll();
+    void wait();
+    XScreenSaverInfo *result(int i);
+    XScreenSaverInfo *query(int i);
+    PowerSnapshot *snapshot(int i);
+    int fileno(int i);
+}
+
+/* ActivityMonitor: which kind of device the user last touched, and how
+   busily.  It selects XInput2 raw events on the root window of its own
+   connection and folds them, in C, into a last-activity time and an event
+   rate per device class (and a last-activity time per device).  Python
+   only sees the totals: call pump() whenever fileno() is readable (or
+   wait(), which does both), then read idle(), device_idle() or
+   summary(). */
+
+#define ActivityKeyboard        0
+#define ActivityPointer         1
+#define ActivityTouch           2
+
+%{
+#define ActivityKeyboard        0
+#define ActivityPointer         1
+#define ActivityTouch           2
+#define ACTIVITY_CLASSES        3
+#define ACTIVITY_DEVICES        256     /* XI device ids are small */
+#define ACTIVITY_RATE_SECONDS   16      /* event rate history */
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+typedef struct {
+    long long last;             /* CLOCK_MONOTONIC ms of the last event */
+    unsigned long server_time;  /* X server time of the last event */
+    unsigned long events;
+    unsigned long per_second[ACTIVITY_RATE_SECONDS];
+    long long second[ACTIVITY_RATE_SECONDS];
+} ActivityClassStats;
+
+typedef struct {
+    Display *dpy;
+    int xi_opcode;
+    long long started;
+    ActivityClassStats classes[ACTIVITY_CLASSES];
+    unsigned char device_class[ACTIVITY_DEVICES];
+    long long device_last[ACTIVITY_DEVICES];
+    unsigned long device_events[ACTIVITY_DEVICES];
+    pthread_mutex_t lock;       /* taken by every entry point */
+} ActivityMonitor;
+
+typedef struct {
+    long keyboard_idle;
+    long pointer_idle;
+    long touch_idle;
+    unsigned long keyboard_events;
+    unsigned long pointer_events;
+    unsigned long touch_events;
+    double keyboard_rate;
+    double pointer_rate;
+    double touch_rate;
+} ActivitySummary;
+
+/* Works out each device's class from XIQueryDevice: touch screens are
+   pointers with a touch class. */
+static void activity_monitor_classify(ActivityMonitor *self) {
+    XIDeviceInfo *devices;
+    int i, j, n;
+
+    devices = XIQueryDevice(self->dpy, XIAllDevices, &n);
+    if (!devices)
+        return;
+    for (i = 0; i < n; i++) {
+        XIDeviceInfo *dev = &devices[i];
+        int cls = ActivityPointer;
+        if (dev->deviceid < 0 || dev->deviceid >= ACTIVITY_DEVICES)
+            continue;
+        if (dev->use == XIMasterKeyboard || dev->use == XISlaveKeyboard)
+            cls = ActivityKeyboard;
+        for (j = 0; j < dev->num_classes; j++) {
+            if (dev->classes[j]->type == XITouchClass)
+                cls = ActivityTouch;
+            else if (dev->use == XIFloatingSlave &&
+                     dev->classes[j]->type == XIKeyClass)
+                cls = ActivityKeyboard;
+        }
+        self->device_class[dev->deviceid] = cls;
+    }
+    XIFreeDeviceInfo(devices);
+}
+
+static void activity_monitor_record(ActivityMonitor *self, int cls,
+                                    int device, unsigned long server_time,
+                                    long long now) {
+    ActivityClassStats *stats = &self->classes[cls];
+    long long second = now / 1000;
+    int slot = (int) (second % ACTIVITY_RATE_SECONDS);
+
+    stats->last = now;
+    stats->server_time = server_time;
+    stats->events++;
+    if (stats->second[slot] != second) {
+        stats->second[slot] = second;
+        stats->per_second[slot] = 0;
+    }
+    stats->per_second[slot]++;
+    if (device >= 0 && device < ACTIVITY_DEVICES) {
+        self->device_last[device] = now;
+        self->device_events[device]++;
+    }
+}
+
+void delete_ActivityMonitor(ActivityMonitor *self);
+
+ActivityMonitor *new_ActivityMonitor(const char *display) {
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+    int event_base, error_base, major = 2, minor = 2, i;
+    XIEventMask mask;
+    ActivityMonitor *self;
+
+    self = (ActivityMonitor *) calloc(1, sizeof(ActivityMonitor));
+    if (!self)
+        return NULL;
+    pthread_mutex_init(&self->lock, NULL);
+    self->dpy = XOpenDisplay(display ? display : "");
+    if (!self->dpy ||
+        !XQueryExtension(self->dpy, "XInputExtension", &self->xi_opcode,
+                         &event_base, &error_base) ||
+        XIQueryVersion(self->dpy, &major, &minor) != Success) {
+        delete_ActivityMonitor(self);
+        return NULL;
+    }
+    self->started = monotonic_ms();
+    for (i = 0; i < ACTIVITY_CLASSES; i++)
+        self->classes[i].last = self->started;
+    for (i = 0; i < ACTIVITY_DEVICES; i++)
+        self->device_class[i] = ActivityPointer;
+    activity_monitor_classify(self);
+
+    memset(bits, 0, sizeof(bits));
+    XISetMask(bits, XI_RawKeyPress);
+    XISetMask(bits, XI_RawButtonPress);
+    XISetMask(bits, XI_RawMotion);
+    if (major > 2 || minor >= 2) {
+        XISetMask(bits, XI_RawTouchBegin);
+        XISetMask(bits, XI_RawTouchUpdate);
+    }
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof(bits);
+    mask.mask = bits;
+    XISelectEvents(self->dpy, DefaultRootWindow(self->dpy), &mask, 1);
+
+    /* hierarchy changes (hotplugs) can only be selected for all devices */
+    memset(bits, 0, sizeof(bits));
+    XISetMask(bits, XI_HierarchyChanged);
+    mask.deviceid = XIAllDevices;
+    XISelectEvents(self->dpy, DefaultRootWindow(self->dpy), &mask, 1);
+    XFlush(self->dpy);
+    return self;
+}
+
+void delete_ActivityMonitor(ActivityMonitor *self) {
+    if (self->dpy)
+        XCloseDisplay(self->dpy);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+int ActivityMonitor_fileno(ActivityMonitor *self) {
+    return ConnectionNumber(self->dpy);
+}
+
+/* Handles every event that has arrived, without blocking.  Returns the
+   number of raw input events. */
+int ActivityMonitor_pump(ActivityMonitor *self) {
+    long long now = monotonic_ms();
+    int count = 0;
+    XEvent ev;
+
+    pthread_mutex_lock(&self->lock);
+    while (XPending(self->dpy)) {
+        XGenericEventCookie *cookie = &ev.xcookie;
+        XNextEvent(self->dpy, &ev);
+        if (cookie->type != GenericEvent ||
+            cookie->extension != self->xi_opcode ||
+            !XGetEventData(self->dpy, cookie))
+            continue;
+        if (cookie->evtype == XI_HierarchyChanged) {
+            activity_monitor_classify(self);
+        } else {
+            XIRawEvent *raw = (XIRawEvent *) cookie->data;
+            int cls;
+            switch (cookie->evtype) {
+            case XI_RawKeyPress:
+                cls = ActivityKeyboard;
+                break;
+            case XI_RawTouchBegin:
+            case XI_RawTouchUpdate:
+                cls = ActivityTouch;
+                break;
+            default:
+                cls = raw->sourceid >= 0 && raw->sourceid < ACTIVITY_DEVICES
+                    ? self->device_class[raw->sourceid] : ActivityPointer;
+                if (cls == ActivityKeyboard)
+                    cls = ActivityPointer;
+            }
+            activity_monitor_record(self, cls, raw->sourceid, raw->time, now);
+            count++;
+        }
+        XFreeEventData(self->dpy, cookie);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+/* Waits up to timeout ms for events to arrive, then pumps them. */
+int ActivityMonitor_wait(ActivityMonitor *self, int timeout) {
+    struct pollfd pfd;
+    if (!XPending(self->dpy)) {
+        pfd.fd = ConnectionNumber(self->dpy);
+        pfd.events = POLLIN;
+        poll(&pfd, 1, timeout);
+    }
+    return ActivityMonitor_pump(self);
+}
+
+/* Milliseconds since the last event from a device class (or since the
+   monitor started, if there was none). */
+static long activity_monitor_idle(ActivityMonitor *self, int cls) {
+    if (cls < 0 || cls >= ACTIVITY_CLASSES)
+        return -1;
+    return (long) (monotonic_ms() - self->classes[cls].last);
+}
+
+/* Events per second from a device class over the last window seconds
+   (at most 15), not counting the current, partial second. */
+static double activity_monitor_rate(ActivityMonitor *self, int cls,
+                                    int window) {
+    long long second = monotonic_ms() / 1000;
+    unsigned long total = 0;
+    ActivityClassStats *stats;
+    int i;
+
+    if (cls < 0 || cls >= ACTIVITY_CLASSES || window <= 0)
+        return 0.0;
+    if (window >= ACTIVITY_RATE_SECONDS)
+        window = ACTIVITY_RATE_SECONDS - 1;
+    stats = &self->classes[cls];
+    for (i = 0; i < ACTIVITY_RATE_SECONDS; i++) {
+        if (stats->second[i] < second && stats->second[i] >= second - window)
+            total += stats->per_second[i];
+    }
+    return (double) total / window;
+}
+
+long ActivityMonitor_idle(ActivityMonitor *self, int cls) {
+    long idle;
+    pthread_mutex_lock(&self->lock);
+    idle = activity_monitor_idle(self, cls);
+    pthread_mutex_unlock(&self->lock);
+    return idle;
+}
+
+double ActivityMonitor_rate(ActivityMonitor *self, int cls, int window) {
+    double rate;
+    pthread_mutex_lock(&self->lock);
+    rate = activity_monitor_rate(self, cls, window);
+    pthread_mutex_unlock(&self->lock);
+    return rate;
+}
+
+long ActivityMonitor_device_idle(ActivityMonitor *self, int device) {
+    long long last;
+    if (device < 0 || device >= ACTIVITY_DEVICES)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    last = self->device_last[device] ? self->device_last[device]
+                                     : self->started;
+    pthread_mutex_unlock(&self->lock);
+    return (long) (monotonic_ms() - last);
+}
+
+int ActivityMonitor_device_class(ActivityMonitor *self, int device) {
+    int cls;
+    if (device < 0 || device >= ACTIVITY_DEVICES)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    cls = self->device_class[device];
+    pthread_mutex_unlock(&self->lock);
+    return cls;
+}
+
+unsigned long ActivityMonitor_events(ActivityMonitor *self, int cls) {
+    unsigned long events;
+    if (cls < 0 || cls >= ACTIVITY_CLASSES)
+        return 0;
+    pthread_mutex_lock(&self->lock);
+    events = self->classes[cls].events;
+    pthread_mutex_unlock(&self->lock);
+    return events;
+}
+
+ActivitySummary *ActivityMonitor_summary(ActivityMonitor *self) {
+    ActivitySummary *summary;
+    summary = (ActivitySummary *) malloc(sizeof(ActivitySummary));
+    if (!summary)
+        return NULL;
+    pthread_mutex_lock(&self->lock);
+    summary->keyboard_idle = activity_monitor_idle(self, ActivityKeyboard);
+    summary->pointer_idle = activity_monitor_idle(self, ActivityPointer);
+    summary->touch_idle = activity_monitor_idle(self, ActivityTouch);
+    summary->keyboard_events = self->classes[ActivityKeyboard].events;
+    summary->pointer_events = self->classes[ActivityPointer].events;
+    summary->touch_events = self->classes[ActivityTouch].events;
+    summary->keyboard_rate = activity_monitor_rate(self, ActivityKeyboard, 5);
+    summary->pointer_rate = activity_monitor_rate(self, ActivityPointer, 5);
+    summary->touch_rate = activity_monitor_rate(self, ActivityTouch, 5);
+    pthread_mutex_unlock(&self->lock);
+    return summary;
+}
+%}
+
+%newobject ActivityMonitor::summary;
+%exception ActivityMonitor::ActivityMonitor {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't select XInput2 raw events.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    long keyboard_idle;
+    long pointer_idle;
+    long touch_idle;
+    unsigned long keyboard_events;
+    unsigned long pointer_events;
+    unsigned long touch_events;
+    double keyboard_rate;
+    double pointer_rate;
+    double touch_rate;
+    %mutable;
+} ActivitySummary;
+
+typedef struct {
+} ActivityMonitor;
+
+%extend ActivityMonitor {
+    ActivityMonitor(const char *display = NULL);
+    ~ActivityMonitor();
+    int fileno();
+    int pump();
+    int wait(int timeout);
+    long idle(int cls);
+    long device_idle(int device);
+    int device_class(int device);
+    unsigned long events(int cls);
+    double rate(int cls, int window = 5);
+    ActivitySummary *summary();
+}
+
+/* IdleWatch: screensaver and idle-time events, for main loops.  It keeps
+   its own connection, selects ScreenSaverNotify on the root window and
+   arms a pair of SYNC IDLETIME alarms per threshold, one that fires when
+   idle time climbs past the threshold and one that fires when input
+   brings it back down.  Nothing is polled: the X server sends an event
+   when something happens, fileno() becomes readable, and pump() turns
+   whatever arrived into WatchEvents for next() to hand out.
+
+   Events are stamped on CLOCK_MONOTONIC (the clock of Python's
+   time.monotonic(), in ms): when pump() read them, when the server sent
+   them and, where the event implies it, when the user last gave input.
+   The server's own clock is tied to ours by sync_clock(), which the
+   constructor runs once. */
+
+#define WatchScreenSaver        0
+#define WatchIdle               1
+#define WatchActive             2
+
+%{
+#include <X11/extensions/sync.h>
+
+#define WatchScreenSaver        0
+#define WatchIdle               1
+#define WatchActive             2
+#define WATCH_ALARMS            32
+#define WATCH_QUEUE             64      /* events held between next()s */
+
+typedef struct {
+    int type;                   /* WatchScreenSaver, WatchIdle, WatchActive */
+    int state;                  /* ScreenSaverOff, On or Cycle */
+    int kind;
+    int forced;                 /* set by XForceScreenSaver, not idleness */
+    int alarm;                  /* index from add_alarm() */
+    long threshold;
+    unsigned long idle;         /* IDLETIME when the alarm fired */
+    unsigned long server_time;
+    double received;            /* CLOCK_MONOTONIC ms: read by pump() */
+    double notify_time;         /* sent by the server, on our clock */
+    double input_time;          /* last input on our clock, or 0 */
+} WatchEvent;
+
+typedef struct {
+    XSyncAlarm idle;            /* idle time rose past threshold */
+    XSyncAlarm active;          /* and fell back below it */
+    long threshold;
+} WatchAlarm;
+
+typedef struct {
+    Display *dpy;
+    Window root;
+    int saver_event_base;
+    int sync_event_base;
+    XSyncCounter idletime;      /* None without SYNC */
+    WatchAlarm alarms[WATCH_ALARMS];
+    WatchEvent queue[WATCH_QUEUE];
+    int head, count;
+    unsigned long dropped;
+    Window clock_window;        /* for server timestamps, see sync_clock() */
+    unsigned long clock_server; /* a server time ... */
+    double clock_local;         /* ... and the same instant on our clock */
+    double clock_error;         /* half the round trip it was taken in */
+    pthread_mutex_t lock;
+} IdleWatch;
+
+void delete_IdleWatch(IdleWatch *self);
+static double idle_watch_sync_clock(IdleWatch *self, int rounds);
+
+IdleWatch *new_IdleWatch(const char *display) {
+    int error_base, major, minor, i, n;
+    XSyncSystemCounter *counters;
+    IdleWatch *self;
+
+    self = (IdleWatch *) calloc(1, sizeof(IdleWatch));
+    if (!self)
+        return NULL;
+    pthread_mutex_init(&self->lock, NULL);
+    self->dpy = XOpenDisplay(display ? display : "");
+    if (!self->dpy ||
+        !XScreenSaverQueryExtension(self->dpy, &self->saver_event_base,
+                                    &error_base)) {
+        delete_IdleWatch(self);
+        return NULL;
+    }
+    self->root = DefaultRootWindow(self->dpy);
+    XScreenSaverSelectInput(self->dpy, self->root,
+                            ScreenSaverNotifyMask | ScreenSaverCycleMask);
+
+    /* idle alarms are optional: screensaver events work without SYNC */
+    if (XSyncQueryExtension(self->dpy, &self->sync_event_base,
+                            &error_base) &&
+        XSyncInitialize(self->dpy, &major, &minor)) {
+        counters = XSyncListSystemCounters(self->dpy, &n);
+        for (i = 0; counters && i < n; i++)
+            if (!strcmp(counters[i].name, "IDLETIME"))
+                self->idletime = counters[i].counter;
+        if (counters)
+            XSyncFreeSystemCounterList(counters);
+    }
+    idle_watch_sync_clock(self, 3);
+    return self;
+}
+
+void delete_IdleWatch(IdleWatch *self) {
+    if (self->dpy)
+        XCloseDisplay(self->dpy);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+int IdleWatch_fileno(IdleWatch *self) {
+    return ConnectionNumber(self->dpy);
+}
+
+/* Whether idle alarms are available (the server has SYNC and IDLETIME). */
+int IdleWatch_has_alarms(IdleWatch *self) {
+    return self->idletime != None;
+}
+
+static double monotonic_msf(void) {
+    return monotonic_ns() / 1e6;
+}
+
+static Bool idle_watch_is_clock(Display *dpy, XEvent *ev, XPointer arg) {
+    return ev->type == PropertyNotify &&
+           ev->xproperty.window == *(Window *) arg;
+}
+
+/* Reads the server's clock the usual way, by changing a property on a
+   window of our own and taking the time off the PropertyNotify, and
+   keeps the reading from the fastest of rounds round trips, putting the
+   server's time at its midpoint.  Returns the uncertainty in ms (half
+   that round trip).  Events other than the PropertyNotify stay queued
+   for pump(). */
+static double idle_watch_sync_clock(IdleWatch *self, int rounds) {
+    XSetWindowAttributes attrs;
+    double best = -1;
+    XEvent ev;
+
+    if (!self->clock_window) {
+        attrs.override_redirect = True;
+        attrs.event_mask = PropertyChangeMask;
+        self->clock_window = XCreateWindow(self->dpy, self->root, -1, -1,
+            1, 1, 0, 0, InputOnly, CopyFromParent,
+            CWOverrideRedirect | CWEventMask, &attrs);
+    }
+    while (rounds-- > 0) {
+        double sent = monotonic_msf(), received;
+        XChangeProperty(self->dpy, self->clock_window, XA_WM_NAME,
+                        XA_STRING, 8, PropModeReplace,
+                        (unsigned char *) "", 0);
+        XIfEvent(self->dpy, &ev, idle_watch_is_clock,
+                 (XPointer) &self->clock_window);
+        received = monotonic_msf();
+        if (best < 0 || received - sent < best) {
+            best = received - sent;
+            self->clock_server = ev.xproperty.time;
+            self->clock_local = (sent + received) / 2;
+        }
+    }
+    self->clock_error = best / 2;
+    return self->clock_error;
+}
+
+double IdleWatch_sync_clock(IdleWatch *self, int rounds) {
+    double error;
+    pthread_mutex_lock(&self->lock);
+    error = idle_watch_sync_clock(self, rounds);
+    pthread_mutex_unlock(&self->lock);
+    return error;
+}
+
+/* A server time on our clock.  Server times are 32 bits of ms and wrap
+   every 49.7 days, so they are taken as the nearest instant to the
+   last sync_clock() that has those low bits. */
+static double idle_watch_local(IdleWatch *self, unsigned long server_time) {
+    int delta = (int) (unsigned int) (server_time - self->clock_server);
+    return self->clock_local + delta;
+}
+
+double IdleWatch_to_monotonic(IdleWatch *self, unsigned long server_time) {
+    double local;
+    pthread_mutex_lock(&self->lock);
+    local = idle_watch_local(self, server_time);
+    pthread_mutex_unlock(&self->lock);
+    return local;
+}
+
+static XSyncAlarm idle_watch_alarm(IdleWatch *self, long threshold,
+                                   int test_type) {
+    XSyncAlarmAttributes attrs;
+
+    attrs.trigger.counter = self->idletime;
+    attrs.trigger.value_type = XSyncAbsolute;
+    XSyncIntToValue(&attrs.trigger.wait_value, (int) threshold);
+    attrs.trigger.test_type = test_type;
+    /* a transition alarm with no delta stays armed after it fires */
+    XSyncIntToValue(&attrs.delta, 0);
+    attrs.events = True;
+    return XSyncCreateAlarm(self->dpy,
+                            XSyncCACounter | XSyncCAValueType |
+                            XSyncCAValue | XSyncCATestType | XSyncCADelta |
+                            XSyncCAEvents, &attrs);
+}
+
+/* Arms an alarm for threshold ms of idle time (at least 1).  Returns its
+   index, which WatchEvents carry in their alarm field, or -1 if there is
+   no IDLETIME counter or no free slot. */
+int IdleWatch_add_alarm(IdleWatch *self, long threshold) {
+    int i, slot = -1;
+
+    if (self->idletime == None || threshold < 1)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    for (i = 0; i < WATCH_ALARMS; i++) {
+        if (!self->alarms[i].threshold) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        WatchAlarm *alarm = &self->alarms[slot];
+        alarm->threshold = threshold;
+        alarm->idle = idle_watch_alarm(self, threshold,
+                                       XSyncPositiveTransition);
+        alarm->active = idle_watch_alarm(self, threshold - 1,
+                                         XSyncNegativeTransition);
+        XFlush(self->dpy);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return slot;
+}
+
+void IdleWatch_remove_alarm(IdleWatch *self, int i) {
+    if (i < 0 || i >= WATCH_ALARMS)
+        return;
+    pthread_mutex_lock(&self->lock);
+    if (self->alarms[i].threshold) {
+        XSyncDestroyAlarm(self->dpy, self->alarms[i].idle);
+        XSyncDestroyAlarm(self->dpy, self->alarms[i].active);
+        memset(&self->alarms[i], 0, sizeof(WatchAlarm));
+        XFlush(self->dpy);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+static WatchEvent *idle_watch_push(IdleWatch *self, int type) {
+    WatchEvent *event;
+    if (self->count == WATCH_QUEUE) {
+        /* keep the newest: a main loop that fell behind wants the
+           current state, not the history */
+        self->head = (self->head + 1) % WATCH_QUEUE;
+        self->count--;
+        self->dropped++;
+    }
+    event = &self->queue[(self->head + self->count++) % WATCH_QUEUE];
+    memset(event, 0, sizeof(WatchEvent));
+    event->type = type;
+    event->alarm = -1;
+    return event;
+}
+
+/* Handles every event that has arrived, without blocking.  Returns the
+   number of WatchEvents waiting for next(). */
+int IdleWatch_pump(IdleWatch *self) {
+    double received = monotonic_msf();
+    XEvent ev;
+    int i, count;
+
+    pthread_mutex_lock(&self->lock);
+    while (XPending(self->dpy)) {
+        XNextEvent(self->dpy, &ev);
+        if (ev.type == self->saver_event_base + ScreenSaverNotify) {
+            XScreenSaverNotifyEvent *saver = (XScreenSaverNotifyEvent *) &ev;
+            WatchEvent *event = idle_watch_push(self, WatchScreenSaver);
+            event->state = saver->state;
+            event->kind = saver->kind;
+            event->forced = saver->forced;
+            event->server_time = saver->time;
+            event->received = received;
+            event->notify_time = idle_watch_local(self, saver->time);
+            /* the saver only goes off by itself on input */
+            if (saver->state == ScreenSaverOff && !saver->forced)
+                event->input_time = event->notify_time;
+        } else if (self->idletime != None &&
+                   ev.type == self->sync_event_base + XSyncAlarmNotify) {
+            XSyncAlarmNotifyEvent *notify = (XSyncAlarmNotifyEvent *) &ev;
+            if (notify->state == XSyncAlarmDestroyed)
+                continue;
+            for (i = 0; i < WATCH_ALARMS; i++) {
+                WatchAlarm *alarm = &self->alarms[i];
+                WatchEvent *event;
+                if (!alarm->threshold)
+                    continue;
+                if (notify->alarm == alarm->idle)
+                    event = idle_watch_push(self, WatchIdle);
+                else if (notify->alarm == alarm->active)
+                    event = idle_watch_push(self, WatchActive);
+                else
+                    continue;
+                event->alarm = i;
+                event->threshold = alarm->threshold;
+                event->idle = XSyncValueLow32(notify->counter_value);
+                event->server_time = notify->time;
+                event->received = received;
+                event->notify_time = idle_watch_local(self, notify->time);
+                event->input_time = event->notify_time - event->idle;
+                break;
+            }
+        }
+    }
+    count = self->count;
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+/* Whether events are waiting, either here or already read off the socket
+   by Xlib (say, while waiting for info()'s reply), where select() on
+   fileno() won't see them. */
+int IdleWatch_pending(IdleWatch *self) {
+    int pending;
+    pthread_mutex_lock(&self->lock);
+    pending = self->count || XEventsQueued(self->dpy, QueuedAlready);
+    pthread_mutex_unlock(&self->lock);
+    return pending;
+}
+
+/* Removes and returns the oldest WatchEvent, or NULL (None) if there is
+   none. */
+WatchEvent *IdleWatch_next(IdleWatch *self) {
+    WatchEvent *event = NULL;
+    pthread_mutex_lock(&self->lock);
+    if (self->count) {
+        event = (WatchEvent *) malloc(sizeof(WatchEvent));
+        if (event)
+            *event = self->queue[self->head];
+        self->head = (self->head + 1) % WATCH_QUEUE;
+        self->count--;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return event;
+}
+
+/* get_info() over the watch's own connection. */
+XScreenSaverInfo *IdleWatch_info(IdleWatch *self) {
+    XScreenSaverInfo *info;
+    info = (XScreenSaverInfo *) calloc(1, sizeof(XScreenSaverInfo));
+    if (!info)
+        return NULL;
+    profile_lock(&self->lock);
+    if (!XScreenSaverQueryInfo(self->dpy, self->root, info)) {
+        free(info);
+        info = NULL;
+    }
+    pthread_mutex_unlock(&self->lock);
+    profile_query(1, info != NULL);
+    return info;
+}
+%}
+
+%newobject IdleWatch::next;
+%newobject IdleWatch::info;
+%exception IdleWatch::IdleWatch {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't query screensaver extension.");
+     return NULL;
+  }
+}
+%exception IdleWatch::info {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't query screensaver extension.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    int type;
+    int state;
+    int kind;
+    int forced;
+    int alarm;
+    long threshold;
+    unsigned long idle;
+    unsigned long server_time;
+    double received;
+    double notify_time;
+    double input_time;
+    %mutable;
+} WatchEvent;
+
+typedef struct {
+    %immutable;
+    unsigned long dropped;
+    double clock_error;
+    %mutable;
+} IdleWatch;
+
+%extend IdleWatch {
+    IdleWatch(const char *display = NULL);
+    ~IdleWatch();
+    int fileno();
+    int has_alarms();
+    int add_alarm(long threshold);
+    void remove_alarm(int i);
+    int pump();
+    int pending();
+    WatchEvent *next();
+    XScreenSaverInfo *info();
+    double sync_clock(int rounds = 3);
+    double to_monotonic(unsigned long server_time);
+}
+
+/* Coalesced wakeups.  A WakeTimer is a timerfd armed with a deadline and
+   some slack, and it fires at a time the rest of the process is waking up
+   at anyway: a wakeup already pending within the slack if there is one,
+   otherwise the roundest boundary of CLOCK_MONOTONIC that fits (a minute,
+   ten seconds, a second, ...), which other processes using this module
+   round to as well.  Slack only ever delays a wakeup, never brings it
+   forward.
+
+   The pending wakeups and the counters behind get_wake_stats() are
+   process-wide, under their own lock. */
+
+%{
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+#define WAKE_PENDING            64
+#define WAKE_MAX_SLACK          1000    /* ms, for the default slack */
+
+typedef struct {
+    unsigned long waits;        /* arm() calls */
+    unsigned long joined;       /* ... that shared a pending wakeup */
+    unsigned long aligned;      /* ... that started one on a boundary */
+    unsigned long exact;        /* ... that had no slack to use */
+    unsigned long fired;        /* expirations read */
+    double slack_used;          /* ms of delay added, in total */
+} WakeStats;
+
+static struct {
+    pthread_mutex_t lock;
+    long long when[WAKE_PENDING];       /* CLOCK_MONOTONIC ns, 0 if free */
+    int users[WAKE_PENDING];
+    WakeStats stats;
+} wakeups = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+typedef struct {
+    int fd;
+    long slack;                 /* ms, or -1 for a tenth of each delay */
+    long long when;             /* when it fires, 0 if disarmed */
+    int slot;                   /* its entry in wakeups, or -1 */
+    pthread_mutex_t lock;
+} WakeTimer;
+
+/* Picks when a wakeup due at deadline fires, and takes a share of it.
+   wakeups.lock must be held. */
+static long long wake_pick(long long now, long long deadline,
+                           long long slack, int *slot) {
+    static const long long grains[] = {60000, 10000, 1000, 250, 100, 10, 1};
+    long long best = 0, grain, when;
+    int i, free_slot = -1;
+
+    *slot = -1;
+    for (i = 0; i < WAKE_PENDING; i++) {
+        if (wakeups.when[i] && wakeups.when[i] <= now)
+            wakeups.when[i] = 0;
+        if (!wakeups.when[i]) {
+            if (free_slot < 0)
+                free_slot = i;
+            continue;
+        }
+        if (wakeups.when[i] >= deadline &&
+            wakeups.when[i] <= deadline + slack &&
+            (!best || wakeups.when[i] < best)) {
+            best = wakeups.when[i];
+            *slot = i;
+        }
+    }
+    wakeups.stats.waits++;
+    if (best) {
+        wakeups.users[*slot]++;
+        wakeups.stats.joined++;
+    } else {
+        best = deadline;
+        if (slack >= 1000000) {
+            /* the 1 ms grain always fits */
+            for (i = 0; ; i++) {
+                grain = grains[i] * 1000000;
+                when = (deadline + grain - 1) / grain * grain;
+                if (when <= deadline + slack) {
+                    best = when;
+                    break;
+                }
+            }
+            wakeups.stats.aligned++;
+        } else
+            wakeups.stats.exact++;
+        if (free_slot >= 0) {
+            wakeups.when[free_slot] = best;
+            wakeups.users[free_slot] = 1;
+            *slot = free_slot;
+        }
+    }
+    wakeups.stats.slack_used += (best - deadline) / 1e6;
+    return best;
+}
+
+/* Gives up the timer's share of its wakeup.  wakeups.lock must be held. */
+static void wake_release(WakeTimer *self) {
+    int i = self->slot;
+
+    if (i >= 0 && wakeups.when[i] == self->when && --wakeups.users[i] <= 0)
+        wakeups.when[i] = 0;
+    self->slot = -1;
+    self->when = 0;
+}
+
+WakeTimer *new_WakeTimer(long slack) {
+    WakeTimer *self = (WakeTimer *) calloc(1, sizeof(WakeTimer));
+
+    if (!self)
+        return NULL;
+    self->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (self->fd < 0) {
+        free(self);
+        return NULL;
+    }
+    self->slack = slack;
+    self->slot = -1;
+    pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_WakeTimer(WakeTimer *self) {
+    pthread_mutex_lock(&wakeups.lock);
+    wake_release(self);
+    pthread_mutex_unlock(&wakeups.lock);
+    close(self->fd);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+int WakeTimer_fileno(WakeTimer *self) {
+    return self->fd;
+}
+
+/* Arms the timer to fire no sooner than delay ms from now and no later
+   than slack ms after that (the timer's own slack if -1).  Returns the
+   delay it chose, in ms, or -1 if the timer couldn't be set. */
+long WakeTimer_arm(WakeTimer *self, long delay, long slack) {
+    struct itimerspec spec;
+    long long now, when;
+    int slot;
+
+    if (delay < 0)
+        delay = 0;
+    if (slack < 0)
+        slack = self->slack;
+    if (slack < 0)
+        slack = delay / 10 < WAKE_MAX_SLACK ? delay / 10 : WAKE_MAX_SLACK;
+    pthread_mutex_lock(&self->lock);
+    pthread_mutex_lock(&wakeups.lock);
+    wake_release(self);
+    now = monotonic_ns();
+    when = wake_pick(now, now + delay * 1000000LL, slack * 1000000LL, &slot);
+    self->when = when;
+    self->slot = slot;
+    pthread_mutex_unlock(&wakeups.lock);
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = when / 1000000000;
+    spec.it_value.tv_nsec = when % 1000000000;
+    if (timerfd_settime(self->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        pthread_mutex_lock(&wakeups.lock);
+        wake_release(self);
+        pthread_mutex_unlock(&wakeups.lock);
+        pthread_mutex_unlock(&self->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return (long) ((when - now + 999999) / 1000000);
+}
+
+void WakeTimer_disarm(WakeTimer *self) {
+    struct itimerspec spec;
+    uint64_t expirations;
+
+    memset(&spec, 0, sizeof(spec));
+    pthread_mutex_lock(&self->lock);
+    timerfd_settime(self->fd, 0, &spec, NULL);
+    /* don't leave an expiration behind for the next expired() */
+    while (read(self->fd, &expirations, sizeof(expirations)) < 0 &&
+           errno == EINTR)
+        ;
+    pthread_mutex_lock(&wakeups.lock);
+    wake_release(self);
+    pthread_mutex_unlock(&wakeups.lock);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Whether the timer has fired, without waiting: 1 if it has (and is now
+   disarmed), 0 if not. */
+int WakeTimer_expired(WakeTimer *self) {
+    uint64_t expirations;
+    ssize_t n;
+
+    pthread_mutex_lock(&self->lock);
+    do
+        n = read(self->fd, &expirations, sizeof(expirations));
+    while (n < 0 && errno == EINTR);
+    if (n != sizeof(expirations)) {
+        pthread_mutex_unlock(&self->lock);
+        return 0;
+    }
+    pthread_mutex_lock(&wakeups.lock);
+    wakeups.stats.fired++;
+    wake_release(self);
+    pthread_mutex_unlock(&wakeups.lock);
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+/* Blocks until the timer fires or timeout ms pass (-1: no limit).  Returns
+   what expired() does; a disarmed timer returns 0 straight away.  A signal
+   cuts the wait short with -1, so that Python gets to run its handler
+   (see %exception WakeTimer::wait). */
+int WakeTimer_wait(WakeTimer *self, int timeout) {
+    struct pollfd pfd;
+    long long armed;
+
+    pthread_mutex_lock(&self->lock);
+    armed = self->when;
+    pthread_mutex_unlock(&self->lock);
+    if (!armed)
+        return 0;
+    pfd.fd = self->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout) < 0 && errno == EINTR)
+        return -1;
+    return WakeTimer_expired(self);
+}
+%}
+
+%newobject get_wake_stats;
+%inline %{
+/* A copy of the process-wide wakeup counters. */
+WakeStats *get_wake_stats(void) {
+    WakeStats *stats = (WakeStats *) malloc(sizeof(WakeStats));
+
+    if (!stats)
+        return NULL;
+    pthread_mutex_lock(&wakeups.lock);
+    *stats = wakeups.stats;
+    pthread_mutex_unlock(&wakeups.lock);
+    return stats;
+}
+
+void reset_wake_stats(void) {
+    pthread_mutex_lock(&wakeups.lock);
+    memset(&wakeups.stats, 0, sizeof(wakeups.stats));
+    pthread_mutex_unlock(&wakeups.lock);
+}
+%}
+
+%exception WakeTimer::WakeTimer {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't create a timer.");
+     return NULL;
+  }
+}
+
+%exception WakeTimer::wait {
+  $action
+  if (result < 0 && PyErr_CheckSignals() < 0)
+     return NULL;
+}
+
+typedef struct {
+    %immutable;
+    unsigned long waits;
+    unsigned long joined;
+    unsigned long aligned;
+    unsigned long exact;
+    unsigned long fired;
+    double slack_used;
+    %mutable;
+} WakeStats;
+
+typedef struct {
+    long slack;
+} WakeTimer;
+
+%extend WakeTimer {
+    WakeTimer(long slack = -1);
+    ~WakeTimer();
+    int fileno();
+    long arm(long delay, long slack = -1);
+    void disarm();
+    int expired();
+    int wait(int timeout = -1);
+}
+
+/* Background sampling.  A Sampler queries idle time from a thread of its
+   own every period ms and runs each sample through a chain of filters in
+   C; Python only hears about what comes out of the chain.  A sample
+   enters the chain as a value (idle ms) and a state (1 while the
+   screensaver is on), and the filters, in the order they were added, are
+
+     SamplerEWMA(tau)           exponential moving average of the value,
+                                with time constant tau ms
+     SamplerHysteresis(low, high)
+                                state becomes 1 when the value reaches
+                                high and 0 when it drops below low
+     SamplerDebounce(ms)        a new state has to hold for ms first
+     SamplerMinDwell(ms)        a state, once output, is kept for ms
+
+   An output is queued when the filtered state changes, when the query
+   starts or stops failing, and, if publish_delta is set, when the value
+   has moved that far since the last output.  fileno() is readable while
+   outputs are queued; next() hands them out.  feed() runs a sample through
+   the chain by hand, for testing filters without the thread.
+
+   enable_rollups(threshold) has every raw sample also rolled up into 1 s,
+   1 min, 1 h and 1 day buckets of active, idle and saver-on ms and
+   transitions (core/pyxss_rollup.c), a few hundred kilobytes however long
+   the sampler runs.  The thread times them by the wall clock, so that
+   days start at UTC midnight; feed() by the time it is given.
+   rollup(level, start, count) copies out count buckets of a level from
+   the one holding start (ms since the epoch), or, with start < 0, the
+   last count up to the latest sample.  Gaps of more than max_gap ms
+   between samples (by default ten periods), such as a suspend or a
+   failed query, count as nothing. */
+
+#define SamplerEWMA             0
+#define SamplerHysteresis       1
+#define SamplerDebounce         2
+#define SamplerMinDwell         3
+#define RollupSeconds           0
+#define RollupMinutes           1
+#define RollupHours             2
+#define RollupDays              3
+
+%{
+#include <sys/eventfd.h>
+#include <math.h>
+
+#define SamplerEWMA             0
+#define SamplerHysteresis       1
+#define SamplerDebounce         2
+#define SamplerMinDwell         3
+#define RollupSeconds           0
+#define RollupMinutes           1
+#define RollupHours             2
+#define RollupDays              3
+#define SAMPLER_FILTERS         8
+#define SAMPLER_QUEUE           64
+
+typedef struct {
+    double time;                /* CLOCK_MONOTONIC ms */
+    unsigned long idle;         /* raw idle time */
+    int saver_state;            /* raw ScreenSaverOff, On, ... */
+    double value;               /* filtered */
+    int state;                  /* filtered */
+    int changed;                /* state differs from the last output */
+    int ok;                     /* 0 if the query failed */
+} SamplerOutput;
+
+typedef struct {
+    int kind;
+    double a, b;
+    int primed;
+    double value, last, since;
+    int state, candidate;
+} SamplerFilter;
+
+typedef struct {
+    int fd;                     /* eventfd, readable while count > 0 */
+    long period;
+    double publish_delta;
+    SamplerFilter filters[SAMPLER_FILTERS];
+    int nfilters;
+    SamplerOutput queue[SAMPLER_QUEUE];
+    int head, count;
+    SamplerOutput last;         /* the last output */
+    SamplerOutput latest;       /* the last sample through the chain */
+    int have_output;
+    unsigned long samples, published, dropped, errors;
+    pyxss_rollup *rollup;       /* NULL until enable_rollups() */
+    pthread_t thread;
+    int running, stopping;
+    pthread_cond_t wake;
+    pthread_mutex_t lock;
+} Sampler;
+
+typedef struct {
+    int level;
+    long long width;
+    long count;
+    pyxss_rollup_bucket bucket[];
+} Rollup;
+
+typedef pyxss_rollup_bucket RollupBucket;
+
+static void sampler_filter(SamplerFilter *f, double t, double *value,
+                           int *state) {
+    switch (f->kind) {
+    case SamplerEWMA:
+        if (!f->primed)
+            f->value = *value;
+        else if (f->a > 0)
+            f->value += (1 - exp(-(t - f->last) / f->a)) * (*value - f->value);
+        else
+            f->value = *value;
+        f->last = t;
+        *value = f->value;
+        break;
+    case SamplerHysteresis:
+        if (!f->primed)
+            f->state = *value >= f->b;
+        else if (f->state && *value < f->a)
+            f->state = 0;
+        else if (!f->state && *value >= f->b)
+            f->state = 1;
+        *state = f->state;
+        break;
+    case SamplerDebounce:
+        if (!f->primed) {
+            f->state = f->candidate = *state;
+            f->since = t;
+        }
+        if (*state != f->candidate) {
+            f->candidate = *state;
+            f->since = t;
+        }
+        if (f->candidate != f->state && t - f->since >= f->a)
+            f->state = f->candidate;
+        *state = f->state;
+        break;
+    case SamplerMinDwell:
+        if (!f->primed) {
+            f->state = *state;
+            f->since = t;
+        } else if (*state != f->state && t - f->since >= f->a) {
+            f->state = *state;
+            f->since = t;
+        }
+        *state = f->state;
+        break;
+    }
+    f->primed = 1;
+}
+
+static void sampler_publish(Sampler *self, SamplerOutput *out) {
+    uint64_t one = 1;
+
+    if (self->count == SAMPLER_QUEUE) {
+        self->head = (self->head + 1) % SAMPLER_QUEUE;
+        self->count--;
+        self->dropped++;
+    }
+    self->queue[(self->head + self->count) % SAMPLER_QUEUE] = *out;
+    if (self->count++ == 0)
+        while (write(self->fd, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    self->last = *out;
+    self->have_output = 1;
+    self->published++;
+}
+
+/* Runs one sample through the chain, and into the rollups by wall, the
+   time on the rollups' clock.  info is NULL if the query failed.  The
+   lock must be held. */
+static void sampler_process(Sampler *self, double t, double wall,
+                            XScreenSaverInfo *info) {
+    SamplerOutput out;
+    int i, publish;
+
+    if (self->rollup) {
+        if (info)
+            pyxss_rollup_add(self->rollup, (int64_t) wall, info->idle,
+                             info->state);
+        else
+            pyxss_rollup_gap(self->rollup);
+    }
+    memset(&out, 0, sizeof(out));
+    out.time = t;
+    self->samples++;
+    if (!info) {
+        self->errors++;
+        out.state = -1;
+        if (!self->have_output || self->last.ok)
+            sampler_publish(self, &out);
+        self->latest = out;
+        return;
+    }
+    out.ok = 1;
+    out.idle = info->idle;
+    out.saver_state = info->state;
+    out.value = info->idle;
+    out.state = info->state == ScreenSaverOn;
+    for (i = 0; i < self->nfilters; i++)
+        sampler_filter(&self->filters[i], t, &out.value, &out.state);
+    out.changed = !self->have_output || out.state != self->last.state;
+    publish = out.changed || !self->last.ok;
+    if (self->publish_delta > 0 &&
+        fabs(out.value - self->last.value) >= self->publish_delta)
+        publish = 1;
+    if (publish)
+        sampler_publish(self, &out);
+    self->latest = out;
+}
+
+static double realtime_msf(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *sampler_run(void *arg) {
+    Sampler *self = (Sampler *) arg;
+    XScreenSaverInfo *info;
+    struct timespec until;
+    long long next = monotonic_ns();
+
+    pthread_mutex_lock(&self->lock);
+    while (!self->stopping) {
+        pthread_mutex_unlock(&self->lock);
+        info = get_info();      /* on this thread's own connection */
+        pthread_mutex_lock(&self->lock);
+        sampler_process(self, monotonic_msf(), realtime_msf(), info);
+        free(info);
+        /* keep to the period's grid; after a stall, skip what was missed */
+        next += self->period * 1000000LL;
+        if (next < monotonic_ns())
+            next = monotonic_ns();
+        until.tv_sec = next / 1000000000;
+        until.tv_nsec = next % 1000000000;
+        while (!self->stopping &&
+               pthread_cond_timedwait(&self->wake, &self->lock, &until) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+void delete_Sampler(Sampler *self);
+int Sampler_stop(Sampler *self);
+
+Sampler *new_Sampler(long period) {
+    pthread_condattr_t attr;
+    Sampler *self = (Sampler *) calloc(1, sizeof(Sampler));
+
+    if (!self)
+        return NULL;
+    self->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (self->fd < 0) {
+        free(self);
+        return NULL;
+    }
+    self->period = period > 0 ? period : 1;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    return self;
+}
+
+void delete_Sampler(Sampler *self) {
+    Sampler_stop(self);
+    close(self->fd);
+    free(self->rollup);
+    pthread_cond_destroy(&self->wake);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+int Sampler_fileno(Sampler *self) {
+    return self->fd;
+}
+
+/* Appends a filter to the chain and starts every filter afresh.  Returns
+   its position, or -1 if the kind is unknown or the chain is full. */
+int Sampler_add_filter(Sampler *self, int kind, double a, double b) {
+    int i, position;
+
+    if (kind < SamplerEWMA || kind > SamplerMinDwell)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    if (self->nfilters == SAMPLER_FILTERS) {
+        pthread_mutex_unlock(&self->lock);
+        return -1;
+    }
+    position = self->nfilters++;
+    memset(&self->filters[position], 0, sizeof(SamplerFilter));
+    self->filters[position].kind = kind;
+    self->filters[position].a = a;
+    self->filters[position].b = b;
+    for (i = 0; i < self->nfilters; i++)
+        self->filters[i].primed = 0;
+    pthread_mutex_unlock(&self->lock);
+    return position;
+}
+
+void Sampler_clear_filters(Sampler *self) {
+    pthread_mutex_lock(&self->lock);
+    self->nfilters = 0;
+    pthread_mutex_unlock(&self->lock);
+}
+
+void Sampler_set_publish_delta(Sampler *self, double delta) {
+    pthread_mutex_lock(&self->lock);
+    self->publish_delta = delta;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Starts the sampling thread.  Returns 0 if it couldn't be started. */
+int Sampler_start(Sampler *self) {
+    int ok = 1;
+
+    pthread_mutex_lock(&self->lock);
+    if (!self->running) {
+        self->stopping = 0;
+        ok = pthread_create(&self->thread, NULL, sampler_run, self) == 0;
+        self->running = ok;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return ok;
+}
+
+/* Stops the thread and waits for it.  Returns whether it was running. */
+int Sampler_stop(Sampler *self) {
+    pthread_mutex_lock(&self->lock);
+    if (!self->running) {
+        pthread_mutex_unlock(&self->lock);
+        return 0;
+    }
+    self->stopping = 1;
+    pthread_cond_signal(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->thread, NULL);
+    pthread_mutex_lock(&self->lock);
+    self->running = 0;
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+void Sampler_feed(Sampler *self, double time, unsigned long idle,
+                  int state) {
+    XScreenSaverInfo info;
+
+    memset(&info, 0, sizeof(info));
+    info.idle = idle;
+    info.state = state;
+    pthread_mutex_lock(&self->lock);
+    sampler_process(self, time, time, &info);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Starts rolling samples up, afresh if it already was.  Returns 0 if there
+   isn't the memory. */
+int Sampler_enable_rollups(Sampler *self, long threshold, long max_gap) {
+    pyxss_rollup *rollup = (pyxss_rollup *) malloc(sizeof(pyxss_rollup));
+
+    if (!rollup)
+        return 0;
+    if (max_gap < 0)
+        max_gap = 10 * self->period;
+    pyxss_rollup_init(rollup, (int32_t) (threshold > INT32_MAX ? INT32_MAX :
+                                         threshold), max_gap);
+    pthread_mutex_lock(&self->lock);
+    free(self->rollup);
+    self->rollup = rollup;
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+/* How many buckets a level keeps, or 0 for no such level. */
+static long sampler_rollup_length(int level) {
+    static const long lengths[PYXSS_ROLLUP_LEVELS] = {
+        PYXSS_ROLLUP_SECONDS, PYXSS_ROLLUP_MINUTES, PYXSS_ROLLUP_HOURS,
+        PYXSS_ROLLUP_DAYS
+    };
+
+    return level >= 0 && level < PYXSS_ROLLUP_LEVELS ? lengths[level] : 0;
+}
+
+/* Whether rollup() can be asked for count buckets of level: rollups are
+   on, the level exists, and count is no more than it keeps. */
+static int sampler_rollup_ok(Sampler *self, int level, long count) {
+    int on;
+
+    pthread_mutex_lock(&self->lock);
+    on = self->rollup != NULL;
+    pthread_mutex_unlock(&self->lock);
+    return on && count >= 0 && count <= sampler_rollup_length(level);
+}
+
+/* count buckets of a level, or NULL if out of memory (or if
+   sampler_rollup_ok() says no). */
+Rollup *Sampler_rollup(Sampler *self, int level, long long start,
+                       long count) {
+    long long width = pyxss_rollup_width(level);
+    Rollup *rollup = NULL;
+
+    if (!width || count < 0 || count > sampler_rollup_length(level))
+        return NULL;
+    pthread_mutex_lock(&self->lock);
+    if (self->rollup && (rollup = (Rollup *) malloc(sizeof(Rollup) +
+                         (size_t) count * sizeof(RollupBucket)))) {
+        if (start < 0) {
+            start = self->rollup->have_last ? self->rollup->last_time :
+                    (long long) realtime_msf();
+            start -= (count - 1) * width;
+        }
+        rollup->level = level;
+        rollup->width = width;
+        rollup->count = count;
+        pyxss_rollup_read(self->rollup, level, start, rollup->bucket,
+                          (size_t) count);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return rollup;
+}
+
+void delete_Rollup(Rollup *self) {
+    free(self);
+}
+
+RollupBucket *Rollup_bucket(Rollup *self, long i) {
+    RollupBucket *bucket = NULL;
+
+    if (i >= 0 && i < self->count &&
+        (bucket = (RollupBucket *) malloc(sizeof(RollupBucket))))
+        *bucket = self->bucket[i];
+    return bucket;
+}
+
+/* The buckets added up, starting where the first does. */
+RollupBucket *Rollup_total(Rollup *self) {
+    RollupBucket *total = (RollupBucket *) calloc(1, sizeof(RollupBucket));
+    long i;
+
+    if (!total)
+        return NULL;
+    total->start = self->count ? self->bucket[0].start : 0;
+    for (i = 0; i < self->count; i++) {
+        total->active_ms += self->bucket[i].active_ms;
+        total->idle_ms += self->bucket[i].idle_ms;
+        total->saver_ms += self->bucket[i].saver_ms;
+        total->transitions += self->bucket[i].transitions;
+        total->samples += self->bucket[i].samples;
+    }
+    return total;
+}
+
+/* The oldest queued output, or NULL if there is none. */
+SamplerOutput *Sampler_next(Sampler *self) {
+    SamplerOutput *out = NULL;
+    uint64_t n;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->count) {
+        out = (SamplerOutput *) malloc(sizeof(SamplerOutput));
+        if (out) {
+            *out = self->queue[self->head];
+            self->head = (self->head + 1) % SAMPLER_QUEUE;
+            self->count--;
+        }
+    }
+    if (!self->count)
+        while (read(self->fd, &n, sizeof(n)) < 0 && errno == EINTR)
+            ;
+    pthread_mutex_unlock(&self->lock);
+    return out;
+}
+
+int Sampler_pending(Sampler *self) {
+    int count;
+
+    pthread_mutex_lock(&self->lock);
+    count = self->count;
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+/* Blocks until an output is queued or timeout ms pass (-1: no limit).
+   Returns the number queued. */
+int Sampler_wait(Sampler *self, int timeout) {
+    struct pollfd pfd;
+
+    pfd.fd = self->fd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, timeout) < 0 && errno == EINTR)
+        ;
+    return Sampler_pending(self);
+}
+
+/* Copies the last sample through the chain, published or not, into out;
+   returns 0 before the first.  Also the C API's sampler_latest(). */
+static int sampler_latest(Sampler *self, SamplerOutput *out) {
+    int ok;
+
+    profile_lock(&self->lock);
+    if ((ok = self->samples != 0))
+        *out = self->latest;
+    pthread_mutex_unlock(&self->lock);
+    profile_query(1, 0);        /* the sampler's thread did the round trip */
+    return ok;
+}
+
+/* The same, or NULL before the first sample. */
+SamplerOutput *Sampler_latest(Sampler *self) {
+    SamplerOutput latest, *out;
+
+    if (!sampler_latest(self, &latest))
+        return NULL;
+    out = (SamplerOutput *) malloc(sizeof(SamplerOutput));
+    if (out)
+        *out = latest;
+    return out;
+}
+%}
+
+%newobject Sampler::next;
+%newobject Sampler::latest;
+%newobject Sampler::rollup;
+%newobject Rollup::bucket;
+%newobject Rollup::total;
+%exception Sampler::enable_rollups {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't allocate rollups.");
+     return NULL;
+  }
+}
+%exception Sampler::rollup {
+  /* arg2 and arg4 are the level and count */
+  if (!sampler_rollup_ok(arg1, arg2, arg4)) {
+     SWIG_exception(SWIG_ValueError, "No rollups enabled, no such level, "
+                    "or count more than the level keeps.");
+     return NULL;
+  }
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't allocate the buckets.");
+     return NULL;
+  }
+}
+%exception Sampler::Sampler {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't create a sampler.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    double time;
+    unsigned long idle;
+    int saver_state;
+    double value;
+    int state;
+    int changed;
+    int ok;
+    %mutable;
+} SamplerOutput;
+
+typedef struct {
+    %immutable;
+    long period;
+    unsigned long samples;
+    unsigned long published;
+    unsigned long dropped;
+    unsigned long errors;
+    %mutable;
+} Sampler;
+
+%extend Sampler {
+    Sampler(long period = 100);
+    ~Sampler();
+    int fileno();
+    int add_filter(int kind, double a = 0, double b = 0);
+    void clear_filters();
+    void set_publish_delta(double delta);
+    int start();
+    int stop();
+    void feed(double time, unsigned long idle, int state = ScreenSaverOff);
+    SamplerOutput *next();
+    int pending();
+    int wait(int timeout = -1);
+    SamplerOutput *latest();
+    int enable_rollups(long threshold, long max_gap = -1);
+    Rollup *rollup(int level, long long start = -1, long count = 60);
+}
+
+typedef struct {
+    %immutable;
+    long long start;
+    long long active_ms;
+    long long idle_ms;
+    long long saver_ms;
+    unsigned int transitions;
+    unsigned int samples;
+    %mutable;
+} RollupBucket;
+
+typedef struct {
+    %immutable;
+    int level;
+    long long width;
+    long count;
+    %mutable;
+} Rollup;
+
+%extend Rollup {
+    ~Rollup();
+    RollupBucket *bucket(long i);
+    RollupBucket *total();
+}
+
+/* Quantile sketches.  A Sketch is a t-digest (core/pyxss_sketch.c): it
+   takes values with add(), answers quantile(q) for any q, and stays a few
+   kilobytes however many values go in.  serialize() gives it as a line of
+   text, and merge() and merge_serialized() fold other sketches in, so a
+   fleet's distribution is the merge of its seats'.
+
+   RunSketches keeps one for idle runs and one for active runs, in ms,
+   fed by the trackers (see their runs argument) or by update() with what
+   a tracker reports.  count, sum, min and max are over everything added
+   (min and max are inf and -inf while empty). */
+
+%{
+typedef struct {
+    pyxss_sketch sketch;
+    pthread_mutex_t lock;
+} Sketch;
+
+typedef struct {
+    pyxss_runs runs;
+    pthread_mutex_t lock;
+} RunSketches;
+
+#define SKETCH_TEXT \
+    (64 + 5 * 25 + PYXSS_SKETCH_CENTROIDS * 50)
+
+Sketch *new_Sketch(void) {
+    Sketch *self = (Sketch *) malloc(sizeof(Sketch));
+
+    if (self) {
+        pyxss_sketch_init(&self->sketch);
+        pthread_mutex_init(&self->lock, NULL);
+    }
+    return self;
+}
+
+void delete_Sketch(Sketch *self) {
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+/* A new Sketch holding a copy of sketch, which the caller has locked. */
+static Sketch *sketch_copy(const pyxss_sketch *sketch) {
+    Sketch *copy = new_Sketch();
+
+    if (copy)
+        copy->sketch = *sketch;
+    return copy;
+}
+
+void Sketch_add(Sketch *self, double value, double weight) {
+    pthread_mutex_lock(&self->lock);
+    pyxss_sketch_add(&self->sketch, value, weight);
+    pthread_mutex_unlock(&self->lock);
+}
+
+double Sketch_quantile(Sketch *self, double q) {
+    double value;
+
+    pthread_mutex_lock(&self->lock);
+    value = pyxss_sketch_quantile(&self->sketch, q);
+    pthread_mutex_unlock(&self->lock);
+    return value;
+}
+
+void Sketch_merge(Sketch *self, Sketch *other) {
+    pyxss_sketch copy;
+
+    if (other == self)
+        return;
+    /* copied first, so that two threads merging both ways can't
+       deadlock */
+    pthread_mutex_lock(&other->lock);
+    copy = other->sketch;
+    pthread_mutex_unlock(&other->lock);
+    pthread_mutex_lock(&self->lock);
+    pyxss_sketch_merge(&self->sketch, &copy);
+    pthread_mutex_unlock(&self->lock);
+}
+
+int Sketch_merge_serialized(Sketch *self, const char *text) {
+    int ok;
+
+    pthread_mutex_lock(&self->lock);
+    ok = pyxss_sketch_parse(&self->sketch, text);
+    pthread_mutex_unlock(&self->lock);
+    return ok;
+}
+
+char *Sketch_serialize(Sketch *self) {
+    char *text = (char *) malloc(SKETCH_TEXT);
+
+    if (!text)
+        return NULL;
+    pthread_mutex_lock(&self->lock);
+    pyxss_sketch_format(&self->sketch, text, SKETCH_TEXT);
+    pthread_mutex_unlock(&self->lock);
+    return text;
+}
+
+/* The totals are read under the lock, since add() and merge() on other
+   threads change them. */
+#define SKETCH_GET(name) \
+    double Sketch_##name##_get(Sketch *self) { \
+        double value; \
+        pthread_mutex_lock(&self->lock); \
+        value = self->sketch.name; \
+        pthread_mutex_unlock(&self->lock); \
+        return value; \
+    }
+
+SKETCH_GET(count)
+SKETCH_GET(sum)
+SKETCH_GET(min)
+SKETCH_GET(max)
+
+#undef SKETCH_GET
+
+void Sketch_clear(Sketch *self) {
+    pthread_mutex_lock(&self->lock);
+    pyxss_sketch_init(&self->sketch);
+    pthread_mutex_unlock(&self->lock);
+}
+
+RunSketches *new_RunSketches(void) {
+    RunSketches *self = (RunSketches *) malloc(sizeof(RunSketches));
+
+    if (self) {
+        pyxss_runs_init(&self->runs);
+        pthread_mutex_init(&self->lock, NULL);
+    }
+    return self;
+}
+
+void delete_RunSketches(RunSketches *self) {
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+/* change is what a tracker's check_idle() reported: "idle", "unidle",
+   "disabled" or None; now is the tracker's clock, in ms. */
+void RunSketches_update(RunSketches *self, const char *change, double now,
+                        unsigned long idle) {
+    int code = PYXSS_NO_CHANGE;
+
+    if (!change)
+        return;
+    if (!strcmp(change, "idle"))
+        code = PYXSS_IDLE;
+    else if (!strcmp(change, "unidle"))
+        code = PYXSS_UNIDLE;
+    else if (!strcmp(change, "disabled"))
+        code = PYXSS_DISABLED;
+    pthread_mutex_lock(&self->lock);
+    pyxss_runs_update(&self->runs, code, now, idle);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Copies of the two sketches. */
+Sketch *RunSketches_idle(RunSketches *self) {
+    Sketch *copy;
+
+    pthread_mutex_lock(&self->lock);
+    copy = sketch_copy(&self->runs.idle);
+    pthread_mutex_unlock(&self->lock);
+    return copy;
+}
+
+Sketch *RunSketches_active(RunSketches *self) {
+    Sketch *copy;
+
+    pthread_mutex_lock(&self->lock);
+    copy = sketch_copy(&self->runs.active);
+    pthread_mutex_unlock(&self->lock);
+    return copy;
+}
+%}
+
+%newobject Sketch::serialize;
+%newobject RunSketches::idle;
+%newobject RunSketches::active;
+%exception Sketch::Sketch {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't create a sketch.");
+     return NULL;
+  }
+}
+%exception Sketch::merge_serialized {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_ValueError, "Not a serialized sketch.");
+     return NULL;
+  }
+}
+%exception RunSketches::RunSketches {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't create run sketches.");
+     return NULL;
+  }
+}
+
+typedef struct {
+} Sketch;
+
+typedef struct {
+} RunSketches;
+
+%extend Sketch {
+    Sketch();
+    ~Sketch();
+    void add(double value, double weight = 1);
+    double quantile(double q);
+    void merge(Sketch *other);
+    int merge_serialized(const char *text);
+    char *serialize();
+    void clear();
+    %immutable;
+    double count;
+    double sum;
+    double min;
+    double max;
+    %mutable;
+}
+
+%extend RunSketches {
+    RunSketches();
+    ~RunSketches();
+    void update(const char *change, double now, unsigned long idle);
+    Sketch *idle();
+    Sketch *active();
+}
+
+/* Metrics.  An Exporter samples idle time from a thread of its own, keeps
+   counters and gauges in C, and publishes them in the Prometheus text
+   format: atomically rewritten into a file (for node-exporter's textfile
+   collector) every write_interval ms, and/or served over HTTP on a local
+   address from a second thread, so a slow client never holds up a sample.
+   Each interval between samples is split at the threshold crossing and at
+   the last input using the idle times at both ends, so idle, active and
+   screensaver time stay exact however coarse the period is, as long as
+   at most one input falls in an interval.  The lengths of idle and active
+   runs go into sketches published as summaries.  feed() takes a sample by
+   hand, and render() returns the text. */
+
+%{
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#define EXPORTER_BUCKETS        11
+#define EXPORTER_TEXT           4096    /* first guess at the text's size */
+#define EXPORTER_CLIENT         1000    /* ms an HTTP client gets in all */
+
+static const double exporter_bounds[EXPORTER_BUCKETS] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1
+};
+
+typedef struct {
+    long period;
+    long threshold;
+    char labels[256];           /* extra label pairs, e.g. seat="kiosk" */
+    char *path;                 /* textfile output, or NULL */
+    long write_interval;
+    int listen_fd;              /* HTTP, or -1 */
+    int stop_fd;                /* eventfd that wakes the threads */
+    /* the metrics */
+    unsigned long idle;         /* last sample */
+    int saver_state;
+    unsigned long til_or_since;
+    int have_sample, was_idle;
+    double last_time;
+    double idle_seconds, active_seconds, saver_seconds;
+    unsigned long to_idle, to_active;
+    unsigned long queries, errors, writes, write_errors, scrapes;
+    unsigned long buckets[EXPORTER_BUCKETS + 1];
+    double query_seconds;
+    pyxss_runs runs;
+    pthread_t thread, server;
+    int running, serving, stopping;
+    pthread_mutex_t lock;
+} Exporter;
+
+#define EXPORTER_SAVER_ON(state) \
+    ((state) == ScreenSaverOn || (state) == ScreenSaverCycle)
+
+/* Takes in a sample at t (ms); info is NULL if the query failed.  The lock
+   must be held. */
+static void exporter_sample(Exporter *self, double t, XScreenSaverInfo *info,
+                            double latency) {
+    double input, mid, from, cross, start, end, idle_ms = 0, saver_ms = 0;
+    int i, now_idle, idle;
+
+    self->queries++;
+    if (latency >= 0) {
+        for (i = 0; i < EXPORTER_BUCKETS && latency > exporter_bounds[i]; i++)
+            ;
+        self->buckets[i]++;
+        self->query_seconds += latency;
+    }
+    if (!info) {
+        self->errors++;
+        self->have_sample = 0;
+        pyxss_runs_update(&self->runs, PYXSS_DISABLED, t, 0);
+        return;
+    }
+    now_idle = (long) info->idle > self->threshold;
+    if (!self->have_sample || now_idle != self->was_idle)
+        pyxss_runs_update(&self->runs, now_idle ? PYXSS_IDLE : PYXSS_UNIDLE,
+                          t, info->idle);
+    if (self->have_sample && t > self->last_time) {
+        /* Only the last input is known.  If it came after the last sample,
+           the run that sample saw went on until it (counted from that
+           sample's last input) and a new one started there; otherwise the
+           whole interval counts from it.  The user is idle once idle time
+           is past the threshold, as for the trackers, so from just after
+           cross. */
+        input = t - info->idle;
+        mid = input > self->last_time ? input : t;
+        from = mid < t ? self->last_time - self->idle : input;
+        idle = self->was_idle;
+        cross = from + self->threshold;
+        if (cross < mid) {
+            idle_ms += mid - (cross > self->last_time ? cross
+                                                      : self->last_time);
+            self->to_idle += !idle;
+            idle = 1;
+        }
+        if (mid < t) {
+            self->to_active += idle;
+            cross = input + self->threshold;
+            if (cross < t) {
+                idle_ms += t - cross;
+                self->to_idle++;
+            }
+        }
+        self->idle_seconds += idle_ms / 1000.0;
+        self->active_seconds += (t - self->last_time - idle_ms) / 1000.0;
+
+        /* The saver counts from when it came on if it's on now.  Before
+           that, or if it's off now, it was on up to the input that turned
+           it off (or up to now, if there was none) if it was on at the last
+           sample, or if it was due to come on before that input. */
+        start = t;
+        if (EXPORTER_SAVER_ON(info->state)) {
+            start = t - info->til_or_since;
+            if (start < self->last_time)
+                start = self->last_time;
+            saver_ms = t - start;
+        }
+        end = mid < start ? mid : start;
+        if (EXPORTER_SAVER_ON(self->saver_state))
+            saver_ms += end - self->last_time;
+        else if (self->saver_state == ScreenSaverOff && self->til_or_since &&
+                 mid < t && self->last_time + self->til_or_since < end)
+            saver_ms += end - (self->last_time + self->til_or_since);
+        self->saver_seconds += saver_ms / 1000.0;
+    }
+    self->idle = info->idle;
+    self->saver_state = info->state;
+    self->til_or_since = info->til_or_since;
+    self->was_idle = now_idle;
+    self->last_time = t;
+    self->have_sample = 1;
+}
+
+/* The text as it's rendered: grows as needed, and remembers running out
+   of memory so the caller can give up instead of publishing part of it. */
+typedef struct {
+    char *buf;
+    size_t len, size;
+    int failed;
+} exporter_text;
+
+static void exporter_emit(exporter_text *out, const char *format, ...) {
+    va_list args;
+    size_t size;
+    char *p;
+    int n;
+
+    while (!out->failed) {
+        va_start(args, format);
+        n = vsnprintf(out->buf + out->len, out->size - out->len, format,
+                      args);
+        va_end(args);
+        if (n < 0) {
+            out->failed = 1;
+        } else if (out->len + n < out->size) {
+            out->len += n;
+            return;
+        } else {
+            size = out->size * 2 > out->len + n + 1 ? out->size * 2
+                                                    : out->len + n + 1;
+            if (!(p = (char *) realloc(out->buf, size)))
+                out->failed = 1;
+            else {
+                out->buf = p;
+                out->size = size;
+            }
+        }
+    }
+}
+
+/* "{labels}" with extra appended, or "" if both are empty. */
+static void exporter_labels(Exporter *self, const char *extra, char *out,
+                            size_t size) {
+    const char *sep = self->labels[0] && extra[0] ? "," : "";
+
+    if (!self->labels[0] && !extra[0])
+        out[0] = 0;
+    else
+        snprintf(out, size, "{%s%s%s}", self->labels, sep, extra);
+}
+
+/* A summary of run lengths (in ms) as one in seconds. */
+static void exporter_summary(Exporter *self, const char *name,
+                             pyxss_sketch *sketch, exporter_text *out) {
+    static const char *quantiles[] = { "0.5", "0.9", "0.99" };
+    char l[320], lq[352];
+    int i;
+
+    exporter_labels(self, "", l, sizeof(l));
+    for (i = 0; i < 3; i++) {
+        char q[32];
+        double value = pyxss_sketch_quantile(sketch, atof(quantiles[i]));
+
+        snprintf(q, sizeof(q), "quantile=\"%s\"", quantiles[i]);
+        exporter_labels(self, q, lq, sizeof(lq));
+        if (isnan(value))
+            exporter_emit(out, "%s%s NaN\n", name, lq);
+        else
+            exporter_emit(out, "%s%s %.3f\n", name, lq, value / 1000.0);
+    }
+    exporter_emit(out, "%s_sum%s %.3f\n%s_count%s %.0f\n", name, l,
+                  sketch->sum / 1000.0, name, l, sketch->count);
+}
+
+/* Returns the metrics as a string to free(), and its length in len, or
+   NULL if out of memory.  The lock must be held. */
+static char *exporter_render(Exporter *self, size_t *len) {
+    char l[320], li[320], la[320], lb[384];
+    unsigned long cumulative = 0;
+    exporter_text out = { NULL, 0, EXPORTER_TEXT, 0 };
+    int i;
+
+#define EMIT(...) exporter_emit(&out, __VA_ARGS__)
+#define HEADER(name, type, help) \
+    EMIT("# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+    if (!(out.buf = (char *) malloc(out.size)))
+        return NULL;
+    exporter_labels(self, "", l, sizeof(l));
+    exporter_labels(self, "to=\"idle\"", li, sizeof(li));
+    exporter_labels(self, "to=\"active\"", la, sizeof(la));
+    if (self->have_sample) {
+        HEADER("pyxss_idle_time_seconds", "gauge",
+               "Time since the last user input.");
+        EMIT("pyxss_idle_time_seconds%s %.3f\n", l, self->idle / 1000.0);
+        HEADER("pyxss_screensaver_active", "gauge",
+               "Whether the screensaver is on.");
+        EMIT("pyxss_screensaver_active%s %d\n", l,
+             EXPORTER_SAVER_ON(self->saver_state));
+    }
+    HEADER("pyxss_idle_threshold_seconds", "gauge",
+           "Idle time after which the user counts as idle.");
+    EMIT("pyxss_idle_threshold_seconds%s %.3f\n", l, self->threshold / 1000.0);
+    HEADER("pyxss_idle_seconds_total", "counter",
+           "Time the user has spent idle.");
+    EMIT("pyxss_idle_seconds_total%s %.3f\n", l, self->idle_seconds);
+    HEADER("pyxss_active_seconds_total", "counter",
+           "Time the user has spent active.");
+    EMIT("pyxss_active_seconds_total%s %.3f\n", l, self->active_seconds);
+    HEADER("pyxss_transitions_total", "counter",
+           "Changes between idle and active.");
+    EMIT("pyxss_transitions_total%s %lu\n", li, self->to_idle);
+    EMIT("pyxss_transitions_total%s %lu\n", la, self->to_active);
+    HEADER("pyxss_idle_run_seconds", "summary",
+           "How long the user stays idle, from their last input.");
+    exporter_summary(self, "pyxss_idle_run_seconds", &self->runs.idle, &out);
+    HEADER("pyxss_active_run_seconds", "summary",
+           "How long the user stays active, up to their last input.");
+    exporter_summary(self, "pyxss_active_run_seconds", &self->runs.active,
+                     &out);
+    HEADER("pyxss_screensaver_on_seconds_total", "counter",
+           "Time the screensaver has been on.");
+    EMIT("pyxss_screensaver_on_seconds_total%s %.3f\n", l,
+         self->saver_seconds);
+    HEADER("pyxss_queries_total", "counter", "Screensaver queries made.");
+    EMIT("pyxss_queries_total%s %lu\n", l, self->queries);
+    HEADER("pyxss_query_errors_total", "counter",
+           "Screensaver queries that failed.");
+    EMIT("pyxss_query_errors_total%s %lu\n", l, self->errors);
+    HEADER("pyxss_query_duration_seconds", "histogram",
+           "Round trip of screensaver queries.");
+    for (i = 0; i <= EXPORTER_BUCKETS; i++) {
+        char le[32];
+        cumulative += self->buckets[i];
+        if (i < EXPORTER_BUCKETS)
+            snprintf(le, sizeof(le), "le=\"%g\"", exporter_bounds[i]);
+        else
+            snprintf(le, sizeof(le), "le=\"+Inf\"");
+        exporter_labels(self, le, lb, sizeof(lb));
+        EMIT("pyxss_query_duration_seconds_bucket%s %lu\n", lb, cumulative);
+    }
+    EMIT("pyxss_query_duration_seconds_sum%s %.6f\n", l, self->query_seconds);
+    EMIT("pyxss_query_duration_seconds_count%s %lu\n", l, cumulative);
+
+#undef HEADER
+#undef EMIT
+    if (out.failed) {
+        free(out.buf);
+        return NULL;
+    }
+    *len = out.len;
+    return out.buf;
+}
+
+/* Replaces the file at path, through a temporary file and rename(), so a
+   reader never sees half of it; if the text can't be rendered, the old
+   file stays.  The lock must be held. */
+static int exporter_write(Exporter *self) {
+    char *text, *tmp;
+    size_t size = strlen(self->path) + 32, len = 0;
+    int fd, ok = 0;
+
+    self->writes++;
+    tmp = (char *) malloc(size);
+    text = tmp ? exporter_render(self, &len) : NULL;
+    if (text) {
+        snprintf(tmp, size, "%s.%d.tmp", self->path, (int) getpid());
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ok = fd >= 0 && write(fd, text, len) == (ssize_t) len;
+        if (fd >= 0 && close(fd) < 0)
+            ok = 0;
+        ok = ok && rename(tmp, self->path) == 0;
+        if (!ok)
+            unlink(tmp);
+    }
+    free(text);
+    free(tmp);
+    self->write_errors += !ok;
+    return ok;
+}
+
+/* Waits until fd is ready for events or the deadline (CLOCK_MONOTONIC ms)
+   passes.  Returns 0 on the deadline. */
+static int exporter_wait(int fd, short events, double deadline) {
+    struct pollfd pfd;
+    double left;
+    int n;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    while ((left = deadline - monotonic_msf()) > 0) {
+        n = poll(&pfd, 1, (int) left + 1);
+        if (n > 0)
+            return 1;
+        if (n == 0 || errno != EINTR)
+            return 0;
+    }
+    return 0;
+}
+
+/* Writes all of buf to the non-blocking fd by the deadline. */
+static int exporter_send(int fd, const char *buf, size_t len,
+                         double deadline) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            if (!exporter_wait(fd, POLLOUT, deadline))
+                return 0;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Answers one HTTP request on the listening socket with the metrics,
+   giving the client EXPORTER_CLIENT ms in all to send the request and
+   take the answer.  The lock must not be held. */
+static void exporter_answer(Exporter *self) {
+    char request[2048], head[160], *text;
+    double deadline;
+    size_t len = 0;
+    int fd, got = 0, n;
+
+    fd = accept4(self->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    deadline = monotonic_msf() + EXPORTER_CLIENT;
+    /* the request itself doesn't matter, but read it before answering */
+    while (got < (int) sizeof(request) - 1) {
+        n = read(fd, request + got, sizeof(request) - 1 - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN) {
+            if (!exporter_wait(fd, POLLIN, deadline))
+                break;
+            continue;
+        }
+        if (n <= 0)
+            break;
+        got += n;
+        request[got] = 0;
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    pthread_mutex_lock(&self->lock);
+    text = exporter_render(self, &len);
+    self->scrapes++;
+    pthread_mutex_unlock(&self->lock);
+    if (text)
+        n = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    else
+        n = snprintf(head, sizeof(head), "HTTP/1.0 500 Out of memory\r\n"
+                     "Content-Length: 0\r\nConnection: close\r\n\r\n");
+    if (exporter_send(fd, head, n, deadline) && text)
+        exporter_send(fd, text, len, deadline);
+    free(text);
+    close(fd);
+}
+
+/* The HTTP thread: answers clients one at a time until stop_fd fires. */
+static void *exporter_serve_run(void *arg) {
+    Exporter *self = (Exporter *) arg;
+    struct pollfd fds[2];
+
+    fds[0].fd = self->stop_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = self->listen_fd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[0].revents)
+            break;
+        if (fds[1].revents & POLLIN)
+            exporter_answer(self);
+    }
+    return NULL;
+}
+
+/* The sampling thread. */
+static void *exporter_run(void *arg) {
+    Exporter *self = (Exporter *) arg;
+    XScreenSaverInfo info;
+    struct pollfd fds[1];
+    double now, next_sample, next_write, wake;
+    long long start;
+    int ok;
+
+    now = monotonic_msf();
+    next_sample = next_write = now;
+    pthread_mutex_lock(&self->lock);
+    while (!self->stopping) {
+        now = monotonic_msf();
+        if (now >= next_sample) {
+            pthread_mutex_unlock(&self->lock);
+            start = monotonic_ns();
+            ok = pyxss_get_info(&info);
+            start = monotonic_ns() - start;
+            pthread_mutex_lock(&self->lock);
+            exporter_sample(self, monotonic_msf(), ok ? &info : NULL,
+                            start / 1e9);
+            next_sample += self->period;
+            if (next_sample < now)
+                next_sample = now + self->period;
+        }
+        if (self->path && now >= next_write) {
+            exporter_write(self);
+            next_write += self->write_interval;
+            if (next_write < now)
+                next_write = now + self->write_interval;
+        }
+        wake = next_sample;
+        if (self->path && next_write < wake)
+            wake = next_write;
+        fds[0].fd = self->stop_fd;
+        fds[0].events = POLLIN;
+        pthread_mutex_unlock(&self->lock);
+        now = monotonic_msf();
+        poll(fds, 1, wake > now ? (int) (wake - now) + 1 : 0);
+        pthread_mutex_lock(&self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+void delete_Exporter(Exporter *self);
+int Exporter_stop(Exporter *self);
+
+Exporter *new_Exporter(long period, long threshold) {
+    Exporter *self = (Exporter *) calloc(1, sizeof(Exporter));
+
+    if (!self)
+        return NULL;
+    self->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (self->stop_fd < 0) {
+        free(self);
+        return NULL;
+    }
+    self->period = period > 0 ? period : 1;
+    self->threshold = threshold;
+    self->listen_fd = -1;
+    pyxss_runs_init(&self->runs);
+    pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_Exporter(Exporter *self) {
+    Exporter_stop(self);
+    if (self->listen_fd >= 0)
+        close(self->listen_fd);
+    close(self->stop_fd);
+    free(self->path);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+/* Whether s starts with a label name, other than the ones the metrics
+   use themselves; returns its length, or 0. */
+static size_t exporter_label_name(const char *s) {
+    size_t n = 0;
+
+    if (!isalpha((unsigned char) s[0]) && s[0] != '_')
+        return 0;
+    while (isalnum((unsigned char) s[n]) || s[n] == '_')
+        n++;
+    if ((n == 2 && !strncmp(s, "le", 2)) || (n == 2 && !strncmp(s, "to", 2)) ||
+        (n == 8 && !strncmp(s, "quantile", 8)) || !strncmp(s, "__", 2))
+        return 0;
+    return n;
+}
+
+/* Whether labels is a list of name="value" pairs separated by commas,
+   with values escaped as the text format wants. */
+static int exporter_valid_labels(const char *labels) {
+    const char *p = labels;
+    size_t n;
+
+    while (*p) {
+        if (!(n = exporter_label_name(p)) || p[n] != '=' || p[n + 1] != '"')
+            return 0;
+        for (p += n + 2; *p != '"'; p++) {
+            if (!*p || *p == '\n')
+                return 0;
+            if (*p == '\\' && *++p != '\\' && *p != '"' && *p != 'n')
+                return 0;
+        }
+        if (*++p == ',' && p[1])
+            p++;
+        else if (*p)
+            return 0;
+    }
+    return 1;
+}
+
+/* Replaces the extra labels with a list of name="value" pairs.  Returns 0
+   if the list isn't valid or is too long. */
+int Exporter_set_labels(Exporter *self, const char *labels) {
+    if (!labels)
+        labels = "";
+    if (strlen(labels) >= sizeof(self->labels) ||
+        !exporter_valid_labels(labels))
+        return 0;
+    pthread_mutex_lock(&self->lock);
+    strcpy(self->labels, labels);
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+/* Adds name="value" to the extra labels, escaping value.  Returns 0 if
+   name isn't a label name or the labels would be too long. */
+int Exporter_add_label(Exporter *self, const char *name, const char *value) {
+    char pair[sizeof(self->labels)];
+    size_t n = 0, used;
+    int ok = 0;
+
+    if (exporter_label_name(name) != strlen(name))
+        return 0;
+    n = snprintf(pair, sizeof(pair), "%s=\"", name);
+    for (; *value && n + 3 < sizeof(pair); value++) {
+        if (*value == '\\' || *value == '"' || *value == '\n')
+            pair[n++] = '\\';
+        pair[n++] = *value == '\n' ? 'n' : *value;
+    }
+    if (*value || n + 2 > sizeof(pair))
+        return 0;
+    pair[n++] = '"';
+    pair[n] = 0;
+    pthread_mutex_lock(&self->lock);
+    used = strlen(self->labels);
+    if (used + (used > 0) + n < sizeof(self->labels)) {
+        if (used)
+            self->labels[used++] = ',';
+        memcpy(self->labels + used, pair, n + 1);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return ok;
+}
+
+/* Rewrites path with the metrics every interval ms while running (and
+   once at start).  Returns 0 if out of memory. */
+int Exporter_write_to(Exporter *self, const char *path, long interval) {
+    char *copy = strdup(path);
+
+    if (!copy)
+        return 0;
+    pthread_mutex_lock(&self->lock);
+    free(self->path);
+    self->path = copy;
+    self->write_interval = interval > 0 ? interval : 1;
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+/* Serves the metrics over HTTP on address: a path for a unix socket, or
+   [host:]port, with IPv6 hosts in brackets ("[::1]:9139").  An empty or
+   missing host is 127.0.0.1; every interface takes an explicit 0.0.0.0
+   or [::].  Call before start().  Returns 0 if the address can't be
+   listened on. */
+int Exporter_serve(Exporter *self, const char *address) {
+    struct addrinfo hints, *found = NULL;
+    char host[256];
+    const char *port, *colon, *start = address;
+    size_t length = 0;
+    int fd = -1;
+
+    if (address[0] == '/') {
+        struct sockaddr_un un;
+
+        if (strlen(address) >= sizeof(un.sun_path))
+            return 0;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, address);
+        unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && (bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0 ||
+                        listen(fd, 8) < 0)) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        if (address[0] == '[') {
+            colon = strchr(address, ']');
+            if (!colon || colon[1] != ':')
+                return 0;
+            start = address + 1;
+            length = (size_t) (colon - start);
+            port = colon + 2;
+        } else if ((colon = strrchr(address, ':'))) {
+            length = (size_t) (colon - address);
+            port = colon + 1;
+        } else
+            port = address;
+        if (length >= sizeof(host))
+            return 0;
+        memcpy(host, start, length);
+        host[length] = '\0';
+        if (!host[0])
+            strcpy(host, "127.0.0.1");
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port, &hints, &found) != 0)
+            return 0;
+        fd = socket(found->ai_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0) {
+            int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(fd, found->ai_addr, found->ai_addrlen) < 0 ||
+                listen(fd, 8) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+    }
+    if (fd < 0)
+        return 0;
+    pthread_mutex_lock(&self->lock);
+    if (self->listen_fd >= 0)
+        close(self->listen_fd);
+    self->listen_fd = fd;
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+int Exporter_start(Exporter *self) {
+    int ok = 1;
+
+    pthread_mutex_lock(&self->lock);
+    if (!self->running) {
+        self->stopping = 0;
+        ok = pthread_create(&self->thread, NULL, exporter_run, self) == 0;
+        self->running = ok;
+        self->serving = ok && self->listen_fd >= 0 &&
+            pthread_create(&self->server, NULL, exporter_serve_run,
+                           self) == 0;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return ok;
+}
+
+/* Stops the threads, writing the file one last time.  Returns whether
+   they were running. */
+int Exporter_stop(Exporter *self) {
+    uint64_t one = 1, n;
+
+    pthread_mutex_lock(&self->lock);
+    if (!self->running) {
+        pthread_mutex_unlock(&self->lock);
+        return 0;
+    }
+    self->stopping = 1;
+    pthread_mutex_unlock(&self->lock);
+    while (write(self->stop_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+    pthread_join(self->thread, NULL);
+    if (self->serving)
+        pthread_join(self->server, NULL);
+    while (read(self->stop_fd, &n, sizeof(n)) < 0 && errno == EINTR)
+        ;
+    pthread_mutex_lock(&self->lock);
+    self->running = self->serving = 0;
+    if (self->path)
+        exporter_write(self);
+    pthread_mutex_unlock(&self->lock);
+    return 1;
+}
+
+/* A sample by hand: idle and state as get_info() would report them at time
+   (CLOCK_MONOTONIC ms), and the query's latency in ms (-1 to leave the
+   histogram alone).  til_or_since is how long the saver has been on. */
+void Exporter_feed(Exporter *self, double time, unsigned long idle,
+                   int state, unsigned long til_or_since, double latency) {
+    XScreenSaverInfo info;
+
+    memset(&info, 0, sizeof(info));
+    info.idle = idle;
+    info.state = state;
+    info.til_or_since = til_or_since;
+    pthread_mutex_lock(&self->lock);
+    exporter_sample(self, time, &info, latency < 0 ? -1 : latency / 1000.0);
+    pthread_mutex_unlock(&self->lock);
+}
+
+void Exporter_feed_error(Exporter *self) {
+    pthread_mutex_lock(&self->lock);
+    exporter_sample(self, 0, NULL, -1);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* The metrics in the Prometheus text format. */
+char *Exporter_render(Exporter *self) {
+    char *text;
+    size_t len;
+
+    pthread_mutex_lock(&self->lock);
+    text = exporter_render(self, &len);
+    pthread_mutex_unlock(&self->lock);
+    return text;
+}
+
+/* Copies of the sketches of run lengths behind the summaries. */
+Sketch *Exporter_idle_runs(Exporter *self) {
+    Sketch *copy;
+
+    pthread_mutex_lock(&self->lock);
+    copy = sketch_copy(&self->runs.idle);
+    pthread_mutex_unlock(&self->lock);
+    return copy;
+}
+
+Sketch *Exporter_active_runs(Exporter *self) {
+    Sketch *copy;
+
+    pthread_mutex_lock(&self->lock);
+    copy = sketch_copy(&self->runs.active);
+    pthread_mutex_unlock(&self->lock);
+    return copy;
+}
+
+int Exporter_write(Exporter *self) {
+    int ok = 0;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->path)
+        ok = exporter_write(self);
+    pthread_mutex_unlock(&self->lock);
+    return ok;
+}
+%}
+
+%newobject Exporter::render;
+%newobject Exporter::idle_runs;
+%newobject Exporter::active_runs;
+%exception Exporter::Exporter {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't create an exporter.");
+     return NULL;
+  }
+}
+%exception Exporter::set_labels {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_ValueError,
+                    "Labels must be name=\"value\" pairs, escaped, separated "
+                    "by commas, in under 256 characters.");
+     return NULL;
+  }
+}
+%exception Exporter::add_label {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_ValueError,
+                    "Not a label name, or the labels would be too long.");
+     return NULL;
+  }
+}
+%exception Exporter::render {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't render the metrics.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    long period;
+    long threshold;
+    unsigned long queries;
+    unsigned long errors;
+    unsigned long writes;
+    unsigned long write_errors;
+    unsigned long scrapes;
+    %mutable;
+} Exporter;
+
+%extend Exporter {
+    Exporter(long period = 1000, long threshold = 60000);
+    ~Exporter();
+    int set_labels(const char *labels);
+    int add_label(const char *name, const char *value);
+    int write_to(const char *path, long interval = 15000);
+    int serve(const char *address);
+    int start();
+    int stop();
+    void feed(double time, unsigned long idle, int state = ScreenSaverOff,
+              unsigned long til_or_since = 0, double latency = -1);
+    void feed_error();
+    char *render();
+    Sketch *idle_runs();
+    Sketch *active_runs();
+    int write();
+}
+
+/* Input without X.  An EvdevMonitor reads input events straight from
+   /dev/input/event* (or any file of struct input_event records, such as a
+   FIFO fed by a test) through epoll, and keeps the last input time and an
+   event count per device, so idle time is available on seats with no X
+   server.  add_all() also watches the directory with inotify, so devices
+   plugged in later are picked up by pump().  Key, relative and absolute
+   events count as input; the rest (sync, LEDs, switches) don't.
+
+   Event times are on CLOCK_MONOTONIC: evdev devices are switched to it
+   with EVIOCSCLOCKID, and other sources are trusted to use it too, except
+   that a time in the future counts as now. */
+
+%{
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <dirent.h>
+
+#define EVDEV_DEVICES           64
+#define EVDEV_INOTIFY           EVDEV_DEVICES   /* epoll tag of inotify */
+
+typedef struct {
+    int fd;
+    int present;                /* 0 once unplugged or at end of file */
+    char path[128];
+    char name[128];
+    double last;                /* last input, CLOCK_MONOTONIC ms, or 0 */
+    unsigned long events;
+    /* the start of an event that a read cut short (a pipe's writer can) */
+    unsigned char partial[sizeof(struct input_event)];
+    size_t partial_len;
+} EvdevDevice;
+
+typedef struct {
+    int epoll_fd;
+    int inotify_fd;             /* -1 until add_all() */
+    char dir[128];
+    EvdevDevice devices[EVDEV_DEVICES];
+    int count;
+    double started;             /* idle time counts from here at first */
+    double last;
+    unsigned long events;
+    pthread_mutex_t lock;
+} EvdevMonitor;
+
+static void evdev_drop(EvdevMonitor *self, EvdevDevice *dev) {
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+    close(dev->fd);
+    dev->fd = -1;
+    dev->present = 0;
+    dev->partial_len = 0;
+}
+
+/* Reads what dev has.  Returns the number of input events.  The lock must
+   be held. */
+static int evdev_read(EvdevMonitor *self, EvdevDevice *dev) {
+    unsigned char buf[64 * sizeof(struct input_event)];
+    struct input_event event;
+    double now = monotonic_msf(), t;
+    size_t have, used;
+    ssize_t n;
+    int count = 0;
+
+    while (dev->fd >= 0) {
+        memcpy(buf, dev->partial, dev->partial_len);
+        n = read(dev->fd, buf + dev->partial_len,
+                 sizeof(buf) - dev->partial_len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0) {           /* unplugged, or the writer went away */
+            evdev_drop(self, dev);
+            break;
+        }
+        have = dev->partial_len + (size_t) n;
+        for (used = 0; used + sizeof(event) <= have; used += sizeof(event)) {
+            memcpy(&event, buf + used, sizeof(event));
+            if (event.type != EV_KEY && event.type != EV_REL &&
+                event.type != EV_ABS)
+                continue;
+            t = event.input_event_sec * 1000.0 +
+                event.input_event_usec / 1000.0;
+            if (t > now)
+                t = now;
+            if (t > dev->last)
+                dev->last = t;
+            if (t > self->last)
+                self->last = t;
+            dev->events++;
+            self->events++;
+            count++;
+        }
+        /* keep the rest for the next read */
+        dev->partial_len = have - used;
+        memcpy(dev->partial, buf + used, dev->partial_len);
+    }
+    return count;
+}
+
+/* The lock must be held. */
+static int evdev_add(EvdevMonitor *self, const char *path) {
+    struct epoll_event ev;
+    EvdevDevice *dev;
+    int fd, i, clock = CLOCK_MONOTONIC;
+
+    for (i = 0; i < self->count; i++)
+        if (self->devices[i].present && !strcmp(self->devices[i].path, path))
+            return i;
+    for (i = 0; i < self->count && self->devices[i].present; i++)
+        ;
+    if (i == EVDEV_DEVICES)
+        return -1;
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    dev = &self->devices[i];
+    memset(dev, 0, sizeof(EvdevDevice));
+    dev->fd = fd;
+    dev->present = 1;
+    snprintf(dev->path, sizeof(dev->path), "%s", path);
+    if (ioctl(fd, EVIOCGNAME(sizeof(dev->name) - 1), dev->name) < 0)
+        snprintf(dev->name, sizeof(dev->name), "%s", path);
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        dev->fd = -1;
+        dev->present = 0;
+        return -1;
+    }
+    if (i == self->count)
+        self->count++;
+    return i;
+}
+
+static int evdev_is_event_node(const char *name) {
+    return !strncmp(name, "event", 5) && name[5] >= '0' && name[5] <= '9';
+}
+
+/* Opens devices that inotify says appeared.  The lock must be held. */
+static void evdev_hotplug(EvdevMonitor *self) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[256];
+    struct inotify_event *event;
+    ssize_t n;
+    char *p;
+
+    while ((n = read(self->inotify_fd, buf, sizeof(buf))) > 0)
+        for (p = buf; p < buf + n; p += sizeof(*event) + event->len) {
+            event = (struct inotify_event *) p;
+            if (event->len && evdev_is_event_node(event->name)) {
+                snprintf(path, sizeof(path), "%s/%s", self->dir, event->name);
+                evdev_add(self, path);
+            }
+        }
+}
+
+/* Handles whatever epoll has ready, without waiting longer than timeout ms.
+   The lock must not be held (epoll_wait can block). */
+static int evdev_pump(EvdevMonitor *self, int timeout) {
+    struct epoll_event ready[16];
+    int n, i, count = 0;
+
+    n = epoll_wait(self->epoll_fd, ready, 16, timeout);
+    pthread_mutex_lock(&self->lock);
+    for (i = 0; i < n; i++) {
+        if (ready[i].data.u32 == EVDEV_INOTIFY)
+            evdev_hotplug(self);
+        else if (ready[i].data.u32 < (unsigned) self->count)
+            count += evdev_read(self, &self->devices[ready[i].data.u32]);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+void delete_EvdevMonitor(EvdevMonitor *self);
+
+EvdevMonitor *new_EvdevMonitor(void) {
+    EvdevMonitor *self = (EvdevMonitor *) calloc(1, sizeof(EvdevMonitor));
+
+    if (!self)
+        return NULL;
+    self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epoll_fd < 0) {
+        free(self);
+        return NULL;
+    }
+    self->inotify_fd = -1;
+    self->started = monotonic_msf();
+    pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_EvdevMonitor(EvdevMonitor *self) {
+    int i;
+
+    for (i = 0; i < self->count; i++)
+        if (self->devices[i].fd >= 0)
+            close(self->devices[i].fd);
+    if (self->inotify_fd >= 0)
+        close(self->inotify_fd);
+    close(self->epoll_fd);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+int EvdevMonitor_fileno(EvdevMonitor *self) {
+    return self->epoll_fd;
+}
+
+/* Starts reading path.  Returns the device's index, or -1 if it can't be
+   opened (often a permissions problem: see the input group). */
+int EvdevMonitor_add_device(EvdevMonitor *self, const char *path) {
+    int i;
+
+    pthread_mutex_lock(&self->lock);
+    i = evdev_add(self, path);
+    pthread_mutex_unlock(&self->lock);
+    return i;
+}
+
+/* Reads every event* device in dir, and any that show up there later.
+   Returns how many could be opened. */
+int EvdevMonitor_add_all(EvdevMonitor *self, const char *dir) {
+    struct epoll_event ev;
+    struct dirent *entry;
+    char path[256];
+    DIR *d;
+    int opened = 0;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->inotify_fd < 0) {
+        self->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        snprintf(self->dir, sizeof(self->dir), "%s", dir);
+        /* nodes get their permissions after they appear, hence IN_ATTRIB */
+        if (self->inotify_fd >= 0 &&
+            inotify_add_watch(self->inotify_fd, dir,
+                              IN_CREATE | IN_ATTRIB) >= 0) {
+            ev.events = EPOLLIN;
+            ev.data.u32 = EVDEV_INOTIFY;
+            epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->inotify_fd, &ev);
+        }
+    }
+    d = opendir(dir);
+    while (d && (entry = readdir(d)))
+        if (evdev_is_event_node(entry->d_name)) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            opened += evdev_add(self, path) >= 0;
+        }
+    if (d)
+        closedir(d);
+    pthread_mutex_unlock(&self->lock);
+    return opened;
+}
+
+/* Reads every event waiting, without blocking.  Returns the number of
+   input events. */
+int EvdevMonitor_pump(EvdevMonitor *self) {
+    int count = 0, n;
+
+    while ((n = evdev_pump(self, 0)) > 0)
+        count += n;
+    return count;
+}
+
+/* Waits up to timeout ms (-1: no limit) for input, then reads it. */
+int EvdevMonitor_wait(EvdevMonitor *self, int timeout) {
+    return evdev_pump(self, timeout) + EvdevMonitor_pump(self);
+}
+
+/* Milliseconds since the last input on any device, or since the monitor
+   was created if there hasn't been any. */
+long EvdevMonitor_idle(EvdevMonitor *self) {
+    double since;
+
+    pthread_mutex_lock(&self->lock);
+    since = self->last ? self->last : self->started;
+    pthread_mutex_unlock(&self->lock);
+    return (long) (monotonic_msf() - since);
+}
+
+/* How many devices are open. */
+int EvdevMonitor_present(EvdevMonitor *self) {
+    int i, n = 0;
+
+    pthread_mutex_lock(&self->lock);
+    for (i = 0; i < self->count; i++)
+        n += self->devices[i].present;
+    pthread_mutex_unlock(&self->lock);
+    return n;
+}
+
+int EvdevMonitor_device_count(EvdevMonitor *self) {
+    int count;
+
+    pthread_mutex_lock(&self->lock);
+    count = self->count;
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+/* A copy of device i's state, or NULL past the end. */
+EvdevDevice *EvdevMonitor_device(EvdevMonitor *self, int i) {
+    EvdevDevice *dev = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && i < self->count) {
+        dev = (EvdevDevice *) malloc(sizeof(EvdevDevice));
+        if (dev)
+            *dev = self->devices[i];
+    }
+    pthread_mutex_unlock(&self->lock);
+    return dev;
+}
+%}
+
+%newobject EvdevMonitor::device;
+%exception EvdevMonitor::EvdevMonitor {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_RuntimeError, "Couldn't create an epoll instance.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    int present;
+    char path[128];
+    char name[128];
+    double last;
+    unsigned long events;
+    %mutable;
+} EvdevDevice;
+
+typedef struct {
+    %immutable;
+    double started;
+    double last;
+    unsigned long events;
+    %mutable;
+} EvdevMonitor;
+
+%extend EvdevMonitor {
+    EvdevMonitor();
+    ~EvdevMonitor();
+    int fileno();
+    int add_device(const char *path);
+    int add_all(const char *dir = "/dev/input");
+    int pump();
+    int wait(int timeout = -1);
+    long idle();
+    int present();
+    int device_count();
+    EvdevDevice *device(int i);
+}
+
+/* Screensaver control.  inhibit() keeps the screensaver (and DPMS) from
+   activating with XScreenSaverSuspend, counting references across the
+   process: the first inhibit() suspends, the matching last uninhibit()
+   resumes.  The suspension belongs to a connection of its own, which the
+   server drops (and the suspension with it) if the process dies, so a
+   crash never leaves the screen unable to blank.  force_screensaver() and
+   set_screensaver() are XForceScreenSaver and XSetScreenSaver, what
+   'xset s activate', 'xset s reset' and 'xset s <timeout> <cycle>' do. */
+
+#define ScreenSaverReset        0
+#define ScreenSaverActive       1
+#define DontPreferBlanking      0
+#define PreferBlanking          1
+#define DefaultBlanking         2
+#define DontAllowExposures      0
+#define AllowExposures          1
+#define DefaultExposures        2
+
+%{
+static struct {
+    pthread_mutex_t lock;
+    Display *dpy;
+    int can_suspend;            /* the extension is 1.1 or later */
+    int count;
+} control = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* The control connection, opened on first use.  control.lock must be
+   held. */
+static Display *control_display(void) {
+    int event_base, error_base, major = 0, minor = 0;
+
+    if (!control.dpy) {
+        control.dpy = XOpenDisplay("");
+        if (control.dpy &&
+            XScreenSaverQueryExtension(control.dpy, &event_base,
+                                       &error_base) &&
+            XScreenSaverQueryVersion(control.dpy, &major, &minor))
+            control.can_suspend = major > 1 || (major == 1 && minor >= 1);
+    }
+    return control.dpy;
+}
+
+/* Sets the screensaver timeout and cycle interval, in seconds (0 timeout:
+   off, -1: the server's default).  Returns 0 without an X server. */
+int set_screensaver(int timeout, int interval, int prefer_blanking,
+                    int allow_exposures) {
+    int ok = 0;
+
+    pthread_mutex_lock(&control.lock);
+    if (control_display()) {
+        XSetScreenSaver(control.dpy, timeout, interval, prefer_blanking,
+                        allow_exposures);
+        XFlush(control.dpy);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&control.lock);
+    return ok;
+}
+%}
+
+%inline %{
+/* Adds a reference to the process's inhibition.  Returns the new count,
+   or -1 if the screensaver can't be suspended. */
+int inhibit(void) {
+    int count;
+
+    pthread_mutex_lock(&control.lock);
+    if (!control_display() || !control.can_suspend) {
+        pthread_mutex_unlock(&control.lock);
+        return -1;
+    }
+    if (control.count++ == 0) {
+        XScreenSaverSuspend(control.dpy, True);
+        XFlush(control.dpy);
+    }
+    count = control.count;
+    pthread_mutex_unlock(&control.lock);
+    return count;
+}
+
+/* Drops a reference.  Returns the count left; at 0, the screensaver is
+   back to normal. */
+int uninhibit(void) {
+    int count;
+
+    pthread_mutex_lock(&control.lock);
+    if (control.count > 0 && --control.count == 0) {
+        XScreenSaverSuspend(control.dpy, False);
+        XFlush(control.dpy);
+    }
+    count = control.count;
+    pthread_mutex_unlock(&control.lock);
+    return count;
+}
+
+int inhibit_count(void) {
+    int count;
+
+    pthread_mutex_lock(&control.lock);
+    count = control.count;
+    pthread_mutex_unlock(&control.lock);
+    return count;
+}
+
+/* ScreenSaverActive turns the screensaver on now, ScreenSaverReset turns
+   it off and restarts the countdown as input would.  Returns 0 without an
+   X server. */
+int force_screensaver(int mode) {
+    int ok = 0;
+
+    pthread_mutex_lock(&control.lock);
+    if (control_display()) {
+        XForceScreenSaver(control.dpy, mode);
+        XFlush(control.dpy);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&control.lock);
+    return ok;
+}
+%}
+
+int set_screensaver(int timeout, int interval,
+                    int prefer_blanking = DefaultBlanking,
+                    int allow_exposures = DefaultExposures);
+
+/* Bulk analytics.  A Series holds recorded samples as three contiguous
+   arrays (times, idle times and screensaver states) and runs the kernels
+   of core/pyxss_series.c over them: counts and crossings of an idle
+   threshold, the active segments between crossings, and per-bucket sums
+   and maxima (an hourly activity histogram is buckets of 3600000 ms).
+   Samples go in from a Recorder file with load(), or from any buffers of
+   int64, int32 and uint8 (array('q'), array('i'), array('B'), numpy
+   arrays) with extend(), so nothing passes through Python objects one
+   sample at a time.  Results are read back by index, like
+   XCBEngine.result(). */
+
+%{
+/* Whether a buffer holds whole items of itemsize bytes in native order,
+   of one of the struct-module formats in formats; sets TypeError if not. */
+static int pyxss_buffer_ok(Py_buffer *view, const char *formats,
+                           size_t itemsize) {
+    const char *format = view->format ? view->format : "B";
+    const char native = PY_LITTLE_ENDIAN ? '<' : '>';
+
+    if (*format == '@' || *format == '=' || *format == native)
+        format++;
+    if (format[0] && !format[1] && strchr(formats, format[0]) &&
+        view->itemsize == (Py_ssize_t) itemsize &&
+        view->len % (Py_ssize_t) itemsize == 0)
+        return 1;
+    PyErr_Format(PyExc_TypeError, "expected a buffer of %zu-byte items "
+                 "(format '%c'), not format '%s' with %zd-byte items",
+                 itemsize, formats[0], view->format ? view->format : "B",
+                 view->itemsize);
+    return 0;
+}
+%}
+
+/* Typemaps for (buffer, item count) arguments: the buffer has to be
+   C-contiguous, of one of the formats, and is held until the call returns,
+   since the call runs without the GIL. */
+%define %pyxss_buffer(TYPEMAP, SIZE, FORMATS, FLAGS)
+%typemap(in) (TYPEMAP, SIZE) (Py_buffer view, int held = 0) {
+  if (PyObject_GetBuffer($input, &view,
+                         FLAGS | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+    SWIG_fail;
+  held = 1;
+  if (!pyxss_buffer_ok(&view, FORMATS, sizeof($*1_type)))
+    SWIG_fail;
+  $1 = ($1_ltype) view.buf;
+  $2 = ($2_ltype) (view.len / sizeof($*1_type));
+}
+%typemap(freearg) (TYPEMAP, SIZE) {
+  if (held$argnum)
+    PyBuffer_Release(&view$argnum);
+}
+%enddef
+
+%{
+typedef struct {
+    pthread_mutex_t lock;
+    int64_t *time;
+    int32_t *idle;
+    uint8_t *state;
+    size_t size;
+    unsigned long samples;
+    unsigned long errors;       /* failed queries skipped by load() */
+    size_t *crossings;          /* from the last crossings() */
+    size_t ncrossings;
+    size_t *segments;           /* first, end pairs from segments() */
+    size_t nsegments;
+    pyxss_bucket *buckets;      /* from the last buckets() */
+    size_t nbuckets;
+} Series;
+
+typedef struct {
+    unsigned long first;        /* index of the first sample */
+    unsigned long samples;
+    long long start;            /* time of the first sample */
+    long long end;              /* ... and of the next one after */
+} SeriesSegment;
+
+typedef pyxss_series_counts SeriesCounts;
+typedef pyxss_bucket SeriesBucket;
+
+static int32_t series_threshold(long threshold) {
+    if (threshold > INT32_MAX)
+        return INT32_MAX;
+    return threshold < INT32_MIN ? INT32_MIN : (int32_t) threshold;
+}
+
+static pyxss_series series_view(const Series *self) {
+    pyxss_series s = { self->time, self->idle, self->state, self->samples };
+
+    return s;
+}
+
+/* Makes room for n samples in all.  self->lock must be held. */
+static int series_reserve(Series *self, size_t n) {
+    size_t size = self->size ? self->size : 4096;
+    void *p;
+
+    if (n <= self->size)
+        return 1;
+    while (size < n)
+        size *= 2;
+    if (!(p = realloc(self->time, size * sizeof(int64_t))))
+        return 0;
+    self->time = (int64_t *) p;
+    if (!(p = realloc(self->idle, size * sizeof(int32_t))))
+        return 0;
+    self->idle = (int32_t *) p;
+    if (!(p = realloc(self->state, size)))
+        return 0;
+    self->state = (uint8_t *) p;
+    self->size = size;
+    return 1;
+}
+
+static void series_push(Series *self, long long time, long idle, int state) {
+    size_t i = self->samples++;
+
+    self->time[i] = time;
+    self->idle[i] = idle > INT32_MAX ? INT32_MAX : (int32_t) idle;
+    self->state[i] = (uint8_t) state;
+}
+
+/* Runs the crossings kernel into self->crossings.  self->lock must be
+   held. */
+static long series_crossings(Series *self, long threshold) {
+    pyxss_series s = series_view(self);
+    pyxss_series_counts counts;
+    size_t *at;
+
+    pyxss_series_count(&s, series_threshold(threshold), &counts);
+    at = (size_t *) malloc((counts.went_idle + counts.came_back + 1) *
+                           sizeof(size_t));
+    if (!at)
+        return -1;
+    free(self->crossings);
+    self->crossings = at;
+    self->ncrossings = pyxss_series_crossings(&s, series_threshold(threshold),
+        at, counts.went_idle + counts.came_back);
+    return (long) self->ncrossings;
+}
+%}
+
+%inline %{
+const char *series_kernels(void) {
+    return pyxss_series_kernels();
+}
+
+int series_use_simd(int enable) {
+    return pyxss_series_use_simd(enable);
+}
+%}
+
+%{
+Series *new_Series(void) {
+    Series *self = (Series *) calloc(1, sizeof(Series));
+
+    if (self)
+        pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+void delete_Series(Series *self) {
+    pthread_mutex_destroy(&self->lock);
+    free(self->time);
+    free(self->idle);
+    free(self->state);
+    free(self->crossings);
+    free(self->segments);
+    free(self->buckets);
+    free(self);
+}
+
+int Series_append(Series *self, long long time, long idle, int state) {
+    int ok;
+
+    pthread_mutex_lock(&self->lock);
+    ok = series_reserve(self, self->samples + 1);
+    if (ok)
+        series_push(self, time, idle, state);
+    pthread_mutex_unlock(&self->lock);
+    return ok;
+}
+
+/* Appends ntimes samples from three buffers; states may be empty, for
+   ScreenSaverOff throughout.  Returns how many, or -1 if the lengths
+   differ or memory runs out. */
+long Series_extend(Series *self, const long long *times, size_t ntimes,
+                   const int *idles, size_t nidles,
+                   const unsigned char *states, size_t nstates) {
+    size_t n;
+
+    if (nidles != ntimes || (nstates && nstates != ntimes))
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    if (!series_reserve(self, self->samples + ntimes)) {
+        pthread_mutex_unlock(&self->lock);
+        return -1;
+    }
+    n = self->samples;
+    memcpy(self->time + n, times, ntimes * sizeof(int64_t));
+    memcpy(self->idle + n, idles, ntimes * sizeof(int32_t));
+    if (nstates)
+        memcpy(self->state + n, states, ntimes);
+    else
+        memset(self->state + n, ScreenSaverOff, ntimes);
+    self->samples += ntimes;
+    pthread_mutex_unlock(&self->lock);
+    return (long) ntimes;
+}
+
+/* Appends the samples of a file written by xss.Recorder, skipping failed
+   queries.  Returns how many, or -1 (adding none) if the file can't be
+   read or has a line that isn't a sample. */
+long Series_load(Series *self, const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[256];
+    unsigned long before, errors = 0;
+    long long time;
+    long til_or_since, idle;
+    int state, kind, ok = 1;
+
+    if (!f)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    before = self->samples;
+    while (ok && fgets(line, sizeof(line), f)) {
+        char word[8];
+
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        if (sscanf(line, "%lld %d %d %ld %ld", &time, &state, &kind,
+                   &til_or_since, &idle) == 5) {
+            ok = series_reserve(self, self->samples + 1);
+            if (ok)
+                series_push(self, time, idle, state);
+        } else if (sscanf(line, "%lld %7s", &time, word) == 2 &&
+                 !strcmp(word, "error"))
+            errors++;
+        else
+            ok = 0;
+    }
+    ok = ok && !ferror(f);
+    fclose(f);
+    if (ok)
+        self->errors += errors;
+    else
+        self->samples = before;
+    pthread_mutex_unlock(&self->lock);
+    return ok ? (long) (self->samples - before) : -1;
+}
+
+/* Sample i's time and idle time, or -1 past the end. */
+long long Series_time(Series *self, long i) {
+    long long time = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && (unsigned long) i < self->samples)
+        time = self->time[i];
+    pthread_mutex_unlock(&self->lock);
+    return time;
+}
+
+long Series_idle(Series *self, long i) {
+    long idle = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && (unsigned long) i < self->samples)
+        idle = self->idle[i];
+    pthread_mutex_unlock(&self->lock);
+    return idle;
+}
+
+void Series_clear(Series *self) {
+    pthread_mutex_lock(&self->lock);
+    self->samples = 0;
+    self->errors = 0;
+    self->ncrossings = self->nsegments = self->nbuckets = 0;
+    pthread_mutex_unlock(&self->lock);
+}
+
+SeriesCounts *Series_count(Series *self, long threshold) {
+    SeriesCounts *counts = (SeriesCounts *) malloc(sizeof(SeriesCounts));
+    pyxss_series s;
+
+    if (!counts)
+        return NULL;
+    pthread_mutex_lock(&self->lock);
+    s = series_view(self);
+    pyxss_series_count(&s, series_threshold(threshold), counts);
+    pthread_mutex_unlock(&self->lock);
+    return counts;
+}
+
+/* Finds where idle time crosses threshold; returns how many crossings
+   there are, for crossing(). */
+long Series_crossings(Series *self, long threshold) {
+    long count;
+
+    pthread_mutex_lock(&self->lock);
+    count = series_crossings(self, threshold);
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+/* The index of crossing i, the first sample on its new side, or -1. */
+long Series_crossing(Series *self, long i) {
+    long at = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && (size_t) i < self->ncrossings)
+        at = (long) self->crossings[i];
+    pthread_mutex_unlock(&self->lock);
+    return at;
+}
+
+/* Splits the series into runs at threshold and keeps the active ones (at
+   or below it) for segment().  Returns how many there are. */
+long Series_segments(Series *self, long threshold) {
+    size_t k, first, *segments;
+    long count = -1;
+    int active;
+
+    pthread_mutex_lock(&self->lock);
+    if (series_crossings(self, threshold) < 0)
+        goto out;
+    segments = (size_t *) malloc((self->ncrossings / 2 + 1) * 2 *
+                                 sizeof(size_t));
+    if (!segments)
+        goto out;
+    free(self->segments);
+    self->segments = segments;
+    self->nsegments = 0;
+    active = self->samples && self->idle[0] <= series_threshold(threshold);
+    for (first = 0, k = 0; first < self->samples; k++) {
+        size_t end = k < self->ncrossings ? self->crossings[k] : self->samples;
+
+        if (active) {
+            segments[2 * self->nsegments] = first;
+            segments[2 * self->nsegments + 1] = end;
+            self->nsegments++;
+        }
+        active = !active;
+        first = end;
+    }
+    count = (long) self->nsegments;
+out:
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+SeriesSegment *Series_segment(Series *self, long i) {
+    SeriesSegment *segment = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && (size_t) i < self->nsegments &&
+        (segment = (SeriesSegment *) malloc(sizeof(SeriesSegment)))) {
+        size_t first = self->segments[2 * i], end = self->segments[2 * i + 1];
+
+        segment->first = first;
+        segment->samples = end - first;
+        segment->start = self->time[first];
+        segment->end = self->time[end < self->samples ? end : end - 1];
+    }
+    pthread_mutex_unlock(&self->lock);
+    return segment;
+}
+
+/* Sorts the samples into count buckets of width ms from origin, for
+   bucket().  Returns how many samples fell into one, or -1. */
+long Series_buckets(Series *self, long long origin, long long width,
+                    long count, long threshold) {
+    pyxss_bucket *buckets;
+    pyxss_series s;
+    long placed = -1;
+
+    if (width <= 0 || count < 0)
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    buckets = (pyxss_bucket *) malloc(((size_t) count + 1) *
+                                      sizeof(pyxss_bucket));
+    if (buckets) {
+        free(self->buckets);
+        self->buckets = buckets;
+        self->nbuckets = (size_t) count;
+        s = series_view(self);
+        placed = (long) pyxss_series_buckets(&s, origin, width,
+            series_threshold(threshold), buckets, (size_t) count);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return placed;
+}
+
+SeriesBucket *Series_bucket(Series *self, long i) {
+    SeriesBucket *bucket = NULL;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && (size_t) i < self->nbuckets &&
+        (bucket = (SeriesBucket *) malloc(sizeof(SeriesBucket))))
+        *bucket = self->buckets[i];
+    pthread_mutex_unlock(&self->lock);
+    return bucket;
+}
+%}
+
+%pyxss_buffer(const long long *times, size_t ntimes, "ql", PyBUF_SIMPLE);
+%pyxss_buffer(const int *idles, size_t nidles, "il", PyBUF_SIMPLE);
+%pyxss_buffer(const unsigned char *states, size_t nstates, "B",
+              PyBUF_SIMPLE);
+
+%newobject Series::count;
+%newobject Series::segment;
+%newobject Series::bucket;
+%exception Series::Series {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't create a series.");
+     return NULL;
+  }
+}
+%exception Series::extend {
+  $action
+  if (result < 0) {
+     SWIG_exception(SWIG_ValueError,
+                    "times, idles and states differ in length.");
+     return NULL;
+  }
+}
+%exception Series::load {
+  $action
+  if (result < 0) {
+     SWIG_exception(SWIG_IOError, "Couldn't read recording.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    unsigned long samples;
+    unsigned long above;
+    unsigned long went_idle;
+    unsigned long came_back;
+    unsigned long saver_on;
+    %mutable;
+} SeriesCounts;
+
+typedef struct {
+    %immutable;
+    unsigned long first;
+    unsigned long samples;
+    long long start;
+    long long end;
+    %mutable;
+} SeriesSegment;
+
+typedef struct {
+    %immutable;
+    long long start;
+    unsigned long samples;
+    unsigned long active;
+    unsigned long saver_on;
+    long long active_ms;
+    long long idle_sum;
+    int idle_max;
+    %mutable;
+} SeriesBucket;
+
+typedef struct {
+    %immutable;
+    unsigned long samples;
+    unsigned long errors;
+    %mutable;
+} Series;
+
+%extend Series {
+    Series();
+    ~Series();
+    int append(long long time, long idle, int state = ScreenSaverOff);
+    long extend(const long long *times, size_t ntimes,
+                const int *idles, size_t nidles,
+                const unsigned char *states, size_t nstates);
+    long load(const char *path);
+    long long time(long i);
+    long idle(long i);
+    void clear();
+    SeriesCounts *count(long threshold);
+    long crossings(long threshold);
+    long crossing(long i);
+    long segments(long threshold);
+    SeriesSegment *segment(long i);
+    long buckets(long long origin, long long width, long count,
+                 long threshold);
+    SeriesBucket *bucket(long i);
+}
+
+/* Fleets.  A Fleet runs IdleTracker logic for many seats at once (a VDI
+   broker's sessions, say) without a tracker object per seat: thresholds,
+   waits, last states and last readings are kept as arrays
+   (core/pyxss_series.c), and update() takes one idle reading per seat, in
+   ms, from any int32 buffer (-1 for a seat whose query failed) and works
+   out every seat's change and wait in one pass.  Only the seats that
+   report a change are read back, with change(i); min_wait is how long the
+   soonest seat can wait, and waits() copies every seat's wait out. */
+
+%{
+typedef struct {
+    pthread_mutex_t lock;
+    pyxss_fleet fleet;
+} Fleet;
+
+typedef struct {
+    unsigned long seat;
+    const char *change;         /* as IdleTracker.check_idle() reports */
+    long idle;
+    long wait;
+} FleetChange;
+
+Fleet *new_Fleet(void) {
+    Fleet *self = (Fleet *) malloc(sizeof(Fleet));
+
+    if (self) {
+        pyxss_fleet_init(&self->fleet);
+        pthread_mutex_init(&self->lock, NULL);
+    }
+    return self;
+}
+
+void delete_Fleet(Fleet *self) {
+    pyxss_fleet_free(&self->fleet);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+/* Adds a seat; returns its index, or -1 if there isn't the memory. */
+long Fleet_add(Fleet *self, long idle_threshold, long when_idle_wait,
+               long when_disabled_wait) {
+    long seat;
+
+    pthread_mutex_lock(&self->lock);
+    seat = pyxss_fleet_add(&self->fleet, series_threshold(idle_threshold),
+                           series_threshold(when_idle_wait),
+                           series_threshold(when_disabled_wait));
+    pthread_mutex_unlock(&self->lock);
+    return seat;
+}
+
+/* Returns how many seats report a change, or -1 if there isn't a reading
+   for every seat. */
+long Fleet_update(Fleet *self, const int *readings, size_t nreadings) {
+    long changes = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (nreadings == self->fleet.seats)
+        changes = (long) pyxss_fleet_update(&self->fleet, readings);
+    pthread_mutex_unlock(&self->lock);
+    return changes;
+}
+
+/* The i-th change of the last update, or NULL. */
+FleetChange *Fleet_change(Fleet *self, long i) {
+    FleetChange *change = NULL;
+    size_t seat;
+
+    pthread_mutex_lock(&self->lock);
+    if (i >= 0 && (size_t) i < self->fleet.nchanged &&
+        (change = (FleetChange *) malloc(sizeof(FleetChange)))) {
+        seat = self->fleet.changed[i];
+        change->seat = seat;
+        change->change = pyxss_change_name(
+            pyxss_fleet_change(&self->fleet, seat));
+        change->idle = self->fleet.idle[seat];
+        change->wait = self->fleet.wait[seat];
+    }
+    pthread_mutex_unlock(&self->lock);
+    return change;
+}
+
+/* A seat's wait from the last update, or -1 for no such seat. */
+long Fleet_wait(Fleet *self, long seat) {
+    long wait = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (seat >= 0 && (size_t) seat < self->fleet.seats)
+        wait = self->fleet.wait[seat];
+    pthread_mutex_unlock(&self->lock);
+    return wait;
+}
+
+/* Copies every seat's wait into a writable int32 buffer of one per seat.
+   Returns -1 if it's the wrong size. */
+long Fleet_waits(Fleet *self, int *waits, size_t nwaits) {
+    long copied = -1;
+
+    pthread_mutex_lock(&self->lock);
+    if (nwaits == self->fleet.seats) {
+        memcpy(waits, self->fleet.wait, nwaits * sizeof(int32_t));
+        copied = (long) nwaits;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return copied;
+}
+
+unsigned long Fleet_seats_get(Fleet *self) {
+    return self->fleet.seats;
+}
+
+unsigned long Fleet_changes_get(Fleet *self) {
+    return self->fleet.nchanged;
+}
+
+long Fleet_min_wait_get(Fleet *self) {
+    return self->fleet.min_wait;
+}
+%}
+
+%pyxss_buffer(const int *readings, size_t nreadings, "il", PyBUF_SIMPLE);
+%pyxss_buffer(int *waits, size_t nwaits, "il", PyBUF_WRITABLE);
+
+%newobject Fleet::change;
+%exception Fleet::Fleet {
+  $action
+  if (!result) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't create a fleet.");
+     return NULL;
+  }
+}
+%exception Fleet::add {
+  $action
+  if (result < 0) {
+     SWIG_exception(SWIG_MemoryError, "Couldn't add a seat.");
+     return NULL;
+  }
+}
+%exception Fleet::update {
+  $action
+  if (result < 0) {
+     SWIG_exception(SWIG_ValueError, "Need one reading per seat.");
+     return NULL;
+  }
+}
+%exception Fleet::waits {
+  $action
+  if (result < 0) {
+     SWIG_exception(SWIG_ValueError, "Need room for one wait per seat.");
+     return NULL;
+  }
+}
+
+typedef struct {
+    %immutable;
+    unsigned long seat;
+    const char *change;
+    long idle;
+    long wait;
+    %mutable;
+} FleetChange;
+
+typedef struct {
+} Fleet;
+
+%extend Fleet {
+    Fleet();
+    ~Fleet();
+    long add(long idle_threshold = 60000, long when_idle_wait = 5000,
+             long when_disabled_wait = 120000);
+    long update(const int *readings, size_t nreadings);
+    FleetChange *change(long i);
+    long wait(long seat);
+    long waits(int *waits, size_t nwaits);
+    %immutable;
+    unsigned long seats;
+    unsigned long changes;
+    long min_wait;
+    %mutable;
+}
+
+/* The C API (see core/pyxss_capi.h): the table behind the xss._C_API
+   capsule. */
+
+%{
+#include "pyxss_capi.h"
+
+static void *capi_sampler_from_object(PyObject *obj) {
+    void *sampler = NULL;
+
+    if (!SWIG_IsOK(SWIG_ConvertPtr(obj, &sampler, SWIGTYPE_p_Sampler, 0))) {
+        PyErr_SetString(PyExc_TypeError, "Not a Sampler.");
+        return NULL;
+    }
+    return sampler;
+}
+
+static int capi_sampler_latest(void *sampler, PyXSS_Sample *out) {
+    SamplerOutput latest;
+
+    if (!sampler_latest((Sampler *) sampler, &latest))
+        return 0;
+    out->time = latest.time;
+    out->idle = latest.idle;
+    out->saver_state = latest.saver_state;
+    out->value = latest.value;
+    out->state = latest.state;
+    out->changed = latest.changed;
+    out->ok = latest.ok;
+    return 1;
+}
+
+static const PyXSS_CAPI capi = {
+    PYXSS_CAPI_VERSION,
+    sizeof(PyXSS_CAPI),
+    pyxss_connect,
+    pyxss_disconnect,
+    pyxss_query,
+    pyxss_get_info,
+    pyxss_governor_admit,
+    pyxss_governor_publish,
+    capi_sampler_from_object,
+    capi_sampler_latest,
+    pyxss_idle_tracker_init,
+    pyxss_idle_tracker_update,
+    pyxss_idle_tracker_check,
+    pyxss_saver_tracker_init,
+    pyxss_saver_tracker_update,
+    pyxss_saver_tracker_check,
+};
+%}
+
+%pythoncode %{
+_C_API = _xss._C_API
+%}
+
+%init %{
+    /* the engines and monitors may be used from any thread */
+    XInitThreads();
+    {
+        PyObject *capsule = PyCapsule_New((void *) &capi, PYXSS_CAPI_NAME,
+                                          NULL);
+
+        if (!capsule || PyModule_AddObject(m, "_C_API", capsule) < 0) {
+            Py_XDECREF(capsule);
+            return NULL;
+        }
+    }
+#ifdef Py_GIL_DISABLED
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+#endif
 %}
 
 // vi:syntax=c